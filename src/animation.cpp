@@ -0,0 +1,492 @@
+/*
+ * animation.cpp
+ *
+ * Frame-to-frame reuse works on the sample grid: every strategy
+ * computes pixel (x, y) at (topleft_x + x * inc_re, topleft_y +
+ * y * inc_im), so the grid is separable and each axis can be
+ * matched against the previous frame on its own. A pixel is reused
+ * only when both of its coordinates are bit-for-bit equal to a
+ * previous sample, so the count is exactly what iterating it
+ * again would give.
+ *
+ * The exponential map goes further for fixed-center zooms: one
+ * strip is iterated with x as the angle around the center and y as
+ * log(radius), from the corner of the widest frame down to half a
+ * pixel of the deepest. Its samples are spaced 2pi/W apart on both
+ * axes, so they're square everywhere and never coarser than a
+ * pixel of any frame; every frame is then a nearest-sample lookup
+ * into the strip. Only the rows the current frame touches are kept,
+ * in a ring, and they're iterated just before they're needed.
+ */
+
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <atomic>
+#include <vector>
+#include <cmath>
+
+#include "include/animation.h"
+#include "include/rendering.h"
+#include "include/strategy.h"
+#include "include/precision.h"
+
+namespace anim
+{
+    /*
+     * Zoom level of frame k. Frames are spaced evenly in log(zoom),
+     * and without an end zoom every frame doubles the last one.
+     */
+    double frame_zoom(const opts::Settings& s, uint32_t k)
+    {
+        if(s.zoom_end <= 0.0)
+            return s.zoom * std::exp2(double(k));
+        if(s.frames < 2)
+            return s.zoom;
+
+        double steps = std::log2(s.zoom_end / s.zoom);
+        return s.zoom * std::exp2((steps * k) / (s.frames - 1));
+    }
+
+
+    /*
+     * The output name of frame k: the frame number goes in front
+     * of the extension ("out.ppm" becomes "out_00012.ppm")
+     */
+    std::string frame_name(const std::string& fname, uint32_t k)
+    {
+        size_t slash = fname.find_last_of('/');
+        size_t dot   = fname.find_last_of('.');
+        if(dot == std::string::npos || (slash != std::string::npos && dot < slash))
+            dot = fname.size();
+
+        std::ostringstream o;
+        o << fname.substr(0, dot) << "_" << std::setw(5) << std::setfill('0') << k << fname.substr(dot);
+        return o.str();
+    }
+
+
+    /*
+     * For each sample of the new axis (o1 + j * inc1), the index of
+     * the old sample (o0 + i * inc0) at exactly the same position,
+     * or -1 when there is none
+     */
+    static void axis_map(double o0, double inc0, uint32_t n0,
+                         double o1, double inc1, uint32_t n1,
+                         std::vector<int32_t>& map)
+    {
+        map.assign(n1, -1);
+        for(uint32_t j=0; j < n1; j++)
+        {
+            double x = o1 + j * inc1;
+            double f = std::floor((x - o0) / inc0 + 0.5);
+
+            // rounding can put the match one index either way
+            for(double i=f-1.0; i <= f+1.0; i += 1.0)
+            {
+                if(i < 0.0 || i >= double(n0))
+                    continue;
+                if(o0 + uint32_t(i) * inc0 == x)
+                {
+                    map[j] = int32_t(i);
+                    break;
+                }
+            }
+        }
+    }
+
+
+    /*
+     * What the previous frame computed, for reuse
+     */
+    typedef struct frame_t
+    {
+        bool               valid;
+        uint32_t           tier, flags;
+        double             topleft_x, topleft_y;
+        double             inc_re, inc_im;
+        std::vector<float> counts;
+    } frame_t;
+
+
+    /*
+     * Render one frame in the float or double tier, copying every
+     * count the previous frame already has. Tiles without a single
+     * reusable pixel go through the normal strategy.
+     */
+    static int reuse_frame(opts::Settings& fs, uint32_t tier, frame_t& prev,
+                           frame_t& cur, pool::ThreadPool& tp)
+    {
+        uint32_t w = fs.res->width;
+        uint32_t h = fs.res->height;
+
+        std::vector<int32_t> cols, rows;
+        if(prev.valid && prev.tier == tier && prev.flags == fs.kernel_flags)
+        {
+            axis_map(prev.topleft_x, prev.inc_re, w, fs.topleft_x, fs.inc_re, w, cols);
+            axis_map(prev.topleft_y, prev.inc_im, h, fs.topleft_y, fs.inc_im, h, rows);
+        }
+        else
+        {
+            cols.assign(w, -1);
+            rows.assign(h, -1);
+        }
+
+        cur.counts.resize(size_t(w) * h);
+
+        render::BatchFunc    batch = render::mandel_batch(tier, fs.kernel_flags, fs.max_iters);
+        strategy::Strategy_t fill  = strategy::all[fs.strategy].func;
+        std::atomic<uint64_t> reused(0);
+
+        int ret = render::render_bands(fs, [&](const render::tile_t& t, float* out, uint8_t*, size_t stride)
+        {
+            double   counts[TILE_SIZE * TILE_SIZE];
+            double   cr[TILE_SIZE * TILE_SIZE], ci[TILE_SIZE * TILE_SIZE];
+            double   got[TILE_SIZE * TILE_SIZE];
+            uint32_t where[TILE_SIZE * TILE_SIZE];
+            uint32_t m = 0, hits = 0;
+
+            for(uint32_t y=0; y < t.h; y++)
+            {
+                int32_t py = rows[t.y + y];
+                for(uint32_t x=0; x < t.w; x++)
+                {
+                    uint32_t i  = (y * t.w) + x;
+                    int32_t  px = cols[t.x + x];
+                    if(py >= 0 && px >= 0)
+                    {
+                        counts[i] = prev.counts[(size_t(py) * w) + px];
+                        hits++;
+                    }
+                    else
+                    {
+                        cr[m]    = fs.topleft_x + (t.x + x) * fs.inc_re;
+                        ci[m]    = fs.topleft_y + (t.y + y) * fs.inc_im;
+                        where[m] = i;
+                        m++;
+                    }
+                }
+            }
+
+            if(hits == 0)
+                fill(fs, t, batch, counts);
+            else if(m > 0)
+            {
+                batch(cr, ci, m, got);
+                for(uint32_t k=0; k < m; k++)
+                    counts[where[k]] = got[k];
+            }
+            reused += hits;
+
+            for(uint32_t y=0; y < t.h; y++)
+                for(uint32_t x=0; x < t.w; x++)
+                    cur.counts[(size_t(t.y + y) * w) + t.x + x] = float(counts[(y * t.w) + x]);
+
+            render::store_tile(t, counts, out, stride, fs.max_iters);
+        }, tp);
+
+        cur.valid     = true;
+        cur.tier      = tier;
+        cur.flags     = fs.kernel_flags;
+        cur.topleft_x = fs.topleft_x;
+        cur.topleft_y = fs.topleft_y;
+        cur.inc_re    = fs.inc_re;
+        cur.inc_im    = fs.inc_im;
+
+        if(fs.verbose)
+            std::cout << "Reused samples:    " << (100.0 * reused) / (double(w) * h) << "%" << std::endl;
+        return ret;
+    }
+
+
+    /*
+     * The exponential map and the window of its rows in memory.
+     * Row j is at radius rmax * exp(-j * dl), column i at angle
+     * -pi + i * dl around the center.
+     */
+    typedef struct strip_t
+    {
+        uint32_t           w, h;
+        double             rmax, dl;
+        uint32_t           cap;      // rows kept in the ring
+        uint32_t           done;     // rows iterated so far
+        std::vector<float> ring;
+    } strip_t;
+
+
+    /*
+     * The strip rows frame fs reads from, [lo, hi)
+     */
+    static void strip_rows(const strip_t& st, const opts::Settings& fs, uint32_t* lo, uint32_t* hi)
+    {
+        double outer = std::hypot(fs.span_x, fs.span_y);
+        double inner = 0.5 * std::min(fs.inc_re, fs.inc_im);
+        double jlo   = std::floor(std::log(st.rmax / outer) / st.dl);
+        double jhi   = std::ceil(std::log(st.rmax / inner) / st.dl) + 2.0;
+        *lo = uint32_t(std::max(jlo, 0.0));
+        *hi = uint32_t(std::min(jhi, double(st.h)));
+    }
+
+
+    /*
+     * Iterate strip rows up to (not including) row `target`, TILE_SIZE
+     * square tiles at a time across the pool. The points are absolute
+     * for the float/double kernels and offsets for the others.
+     */
+    static void strip_fill(strip_t& st, uint32_t target, const opts::Settings& s,
+                           const render::BatchFunc& batch, bool offsets, pool::ThreadPool& tp)
+    {
+        if(target <= st.done)
+            return;
+
+        std::vector<render::tile_t> tiles = render::make_tiles(st.w, target - st.done, TILE_SIZE);
+        uint32_t first = st.done;
+
+        tp.run(tiles.size(), [&](uint32_t idx, uint32_t)
+        {
+            const render::tile_t& t = tiles[idx];
+            double cr[TILE_SIZE], ci[TILE_SIZE], out[TILE_SIZE];
+
+            for(uint32_t y=0; y < t.h; y++)
+            {
+                uint32_t j = first + t.y + y;
+                double   r = st.rmax * std::exp(-(j * st.dl));
+                for(uint32_t x=0; x < t.w; x++)
+                {
+                    double a = -M_PI + (t.x + x) * st.dl;
+                    cr[x] = r * std::cos(a);
+                    ci[x] = r * std::sin(a);
+                    if(!offsets)
+                    {
+                        cr[x] += s.init_real;
+                        ci[x] += s.init_imag;
+                    }
+                }
+                batch(cr, ci, t.w, out);
+
+                float* row = &st.ring[size_t(j % st.cap) * st.w];
+                for(uint32_t x=0; x < t.w; x++)
+                    row[t.x + x] = float(out[x]);
+            }
+        });
+
+        st.done = target;
+    }
+
+
+    /*
+     * The size of the strip covering every frame, from the corner
+     * of the widest down to half a pixel of the deepest
+     */
+    static void strip_shape(const opts::Settings& s, strip_t& st)
+    {
+        opts::Settings ws = s;
+        opts::Settings ds = s;
+        ws.set_zoom(std::min(frame_zoom(s, 0), frame_zoom(s, s.frames - 1)));
+        ds.set_zoom(std::max(frame_zoom(s, 0), frame_zoom(s, s.frames - 1)));
+
+        st.rmax = std::hypot(ws.span_x, ws.span_y);
+        st.w    = uint32_t(std::ceil((2.0 * M_PI * st.rmax) / std::min(ws.inc_re, ws.inc_im)));
+        st.dl   = (2.0 * M_PI) / st.w;
+        st.h    = uint32_t(std::ceil(std::log(st.rmax / (0.5 * std::min(ds.inc_re, ds.inc_im))) / st.dl)) + 2;
+        st.done = 0;
+    }
+
+
+    /*
+     * Rows the ring has to hold, those of any single frame
+     */
+    static uint32_t strip_cap(const opts::Settings& s, const strip_t& st)
+    {
+        uint32_t cap = 1;
+        for(uint32_t k=0; k < s.frames; k++)
+        {
+            opts::Settings fs = s;
+            fs.set_zoom(frame_zoom(s, k));
+            uint32_t lo, hi;
+            strip_rows(st, fs, &lo, &hi);
+            cap = std::max(cap, hi - lo);
+        }
+        return cap;
+    }
+
+
+    /*
+     * Render a zoom sequence by resampling one exponential map
+     */
+    static int strip_frames(opts::Settings& s, pool::ThreadPool& tp)
+    {
+        // frames go from the widest view to the deepest
+        bool     out    = frame_zoom(s, s.frames - 1) < frame_zoom(s, 0);
+        uint32_t narrow = out ? 0 : s.frames - 1;
+
+        opts::Settings ds = s;
+        ds.set_zoom(frame_zoom(s, narrow));
+
+        strip_t st;
+        strip_shape(s, st);
+
+        // the deepest frame decides the numeric type for the whole strip
+        uint32_t tier = precision::choose(ds);
+        bool     offsets = tier > PRECISION_DOUBLE;
+        render::BatchFunc batch = offsets ? render::offset_batch(ds, tier)
+                                          : render::mandel_batch(tier, s.kernel_flags, s.max_iters);
+        if(!batch)
+            return 1;
+
+        st.cap = strip_cap(s, st);
+        st.ring.resize(size_t(st.cap) * st.w);
+
+        if(s.verbose)
+        {
+            std::cout << "Exponential map:   " << st.w << "x" << st.h << " samples, "
+                      << st.cap << " rows in memory, " << precision::all[tier].name << std::endl;
+            std::cout << "Work vs frames:    " << (100.0 * st.w * st.h)
+                         / (double(s.frames) * s.res->width * s.res->height) << "%" << std::endl;
+        }
+
+        // where each pixel sits around the center is the same in
+        // every frame once it's measured in pixels: its column of the
+        // strip, and log(radius) in strip rows, which only moves by
+        // a per frame offset as the zoom changes
+        uint32_t w = s.res->width;
+        uint32_t h = s.res->height;
+        std::vector<uint32_t> angle(size_t(w) * h);
+        std::vector<float>    radius(size_t(w) * h);
+        for(uint32_t y=0; y < h; y++)
+            for(uint32_t x=0; x < w; x++)
+            {
+                double dx = x - (0.5 * w);
+                double dy = y - (0.5 * h);
+                double af = std::floor(((std::atan2(dy, dx) + M_PI) / st.dl) + 0.5);
+                angle[(size_t(y) * w) + x]  = uint32_t(af) % st.w;
+                radius[(size_t(y) * w) + x] = float(std::log(std::max(std::hypot(dx, dy), 0.5)) / st.dl);
+            }
+
+        for(uint32_t n=0; n < s.frames; n++)
+        {
+            uint32_t k = out ? s.frames - 1 - n : n;
+
+            opts::Settings fs = s;
+            fs.set_zoom(frame_zoom(s, k));
+            fs.fname = frame_name(s.fname, k);
+            if(!s.iter_file.empty())
+                fs.iter_file = frame_name(s.iter_file, k);
+
+            uint32_t lo, hi;
+            strip_rows(st, fs, &lo, &hi);
+            strip_fill(st, hi, s, batch, offsets, tp);
+
+            if(s.verbose)
+                std::cout << "Frame " << k << ":           zoom " << fs.zoom
+                          << ", rows " << lo << "-" << hi << ", " << fs.fname << std::endl;
+
+            // the row of a pixel is the frame's offset less its own
+            double base = (std::log(st.rmax / fs.inc_re) / st.dl) + 0.5;
+            int ret = render::render_bands(fs, [&](const render::tile_t& t, float* px, uint8_t*, size_t stride)
+            {
+                double counts[TILE_SIZE * TILE_SIZE];
+
+                for(uint32_t y=0; y < t.h; y++)
+                {
+                    size_t at = (size_t(t.y + y) * w) + t.x;
+                    for(uint32_t x=0; x < t.w; x++)
+                    {
+                        // nearest sample, so every count is one iterate_m gave
+                        double   jf = std::floor(base - radius[at + x]);
+                        uint32_t j  = uint32_t(std::min(std::max(jf, double(lo)), double(hi - 1)));
+
+                        counts[(y * t.w) + x] = st.ring[(size_t(j % st.cap) * st.w) + angle[at + x]];
+                    }
+                }
+
+                render::store_tile(t, counts, px, stride, fs.max_iters);
+            }, tp);
+
+            if(ret != 0)
+                return ret;
+        }
+
+        return 0;
+    }
+
+
+    /*
+     * Render every frame of a Mandelbrot zoom sequence
+     */
+    int mandelbrot(opts::Settings& s, pool::ThreadPool& tp)
+    {
+        double pixels = double(s.res->width) * s.res->height;
+        double cap    = double(ANIM_MEMORY_MB) * (1 << 20);
+
+        if(s.exp_map)
+        {
+            // the strip costs the same however many frames it serves
+            strip_t st;
+            strip_shape(s, st);
+            double share = (double(st.w) * st.h) / (double(s.frames) * pixels);
+
+            // its ring of rows, and a column and a radius per pixel
+            double bytes = (double(strip_cap(s, st)) * st.w * sizeof(float))
+                         + (pixels * (sizeof(uint32_t) + sizeof(float)));
+
+            if(share * EXPMAP_BREAK_EVEN > 1.0)
+                std::cerr << "Warning: the exponential map would iterate " << llround(100.0 * share)
+                          << "% as many samples as the frames, it only pays off below "
+                          << llround(100.0 / EXPMAP_BREAK_EVEN) << "%; rendering frame by frame" << std::endl;
+            else if(bytes > cap)
+                std::cerr << "Warning: the exponential map would keep " << llround(bytes / (1 << 20))
+                          << " MB in memory, over the " << ANIM_MEMORY_MB << " MB cap; rendering frame by frame" << std::endl;
+            else
+                return strip_frames(s, tp);
+        }
+
+        // reuse keeps the counts of two whole frames, bigger ones
+        // are streamed band by band like a single render
+        bool reuse = (2.0 * pixels * sizeof(float)) <= cap;
+        if(!reuse && s.verbose)
+            std::cout << "Frame reuse:       off, two frames would take "
+                      << llround((2.0 * pixels * sizeof(float)) / (1 << 20)) << " MB" << std::endl;
+
+        frame_t prev, cur;
+        prev.valid = false;
+        cur.valid  = false;
+
+        for(uint32_t k=0; k < s.frames; k++)
+        {
+            opts::Settings fs = s;
+            fs.set_zoom(frame_zoom(s, k));
+            fs.fname = frame_name(s.fname, k);
+            if(!s.iter_file.empty())
+                fs.iter_file = frame_name(s.iter_file, k);
+
+            uint32_t tier = precision::choose(fs);
+            if(s.verbose)
+                std::cout << "Frame " << k << ":           zoom " << fs.zoom
+                          << ", " << precision::all[tier].name << ", " << fs.fname << std::endl;
+
+            int ret;
+            // supersampled frames go through the regular renderer,
+            // the copied counts have no edge samples to go with them
+            if(reuse && !fs.deep && fs.supersample == 0 && (tier == PRECISION_FLOAT || tier == PRECISION_DOUBLE))
+            {
+                ret = reuse_frame(fs, tier, prev, cur, tp);
+                std::swap(prev, cur);
+            }
+            else
+            {
+                // offsets from the center don't share a grid
+                fs.verbose = 0;
+                ret = render::mandelbrot_frame(fs, tp);
+                prev.valid = false;
+            }
+
+            if(ret != 0)
+                return ret;
+        }
+
+        return 0;
+    }
+}
+
+// end
@@ -0,0 +1,374 @@
+/*
+ * bench.cpp
+ *
+ * The benchmark harness run by `make bench`. It times the complex
+ * arithmetic, every iteration kernel on a fixed set of points and
+ * end-to-end renders of a few canonical views, and writes it all
+ * out as JSON so the numbers of two builds can be diffed.
+ *
+ * Every measurement is the best of several runs, the one least
+ * disturbed by anything else on the machine. Iteration counts are
+ * the z updates the kernels really made (simd::ran), so points a
+ * fast exit settled, or Mariani-Silver filled in, cost nothing.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <functional>
+#include <getopt.h>
+
+#include "include/complex.h"
+#include "include/ddouble.h"
+#include "include/opts.h"
+#include "include/rendering.h"
+#include "include/functions.h"
+#include "include/simd.h"
+#include "include/threadpool.h"
+#include "include/precision.h"
+#include "include/stats.h"
+
+// calls of each complex operation per run
+#define BENCH_OPS      (1u << 24)
+
+// points the kernels are timed on, a square grid over the set
+#define BENCH_GRID     256
+
+// iteration limit of the kernel runs
+#define BENCH_LIMIT    1000
+
+
+/*
+ * One row of the results
+ */
+typedef struct result_t
+{
+    std::string name;
+    double      seconds;        // best run
+    uint64_t    ops;            // operations or iterations per run
+    uint64_t    pixels;         // end-to-end renders only
+} result_t;
+
+
+/*
+ * Best wall time of `reps` runs of f
+ */
+static double best_of(uint32_t reps, const std::function<void()>& f)
+{
+    double best = 1e300;
+    for(uint32_t r=0; r < reps; r++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+        best = std::min(best, took.count());
+    }
+    return best;
+}
+
+
+// keeps the compiler from dropping a result nobody reads
+static volatile double sink;
+
+
+/*
+ * The Complex<double> operations the scalar kernels are built
+ * from, each in a dependent chain so every call is paid for
+ */
+static void bench_cmp(uint32_t reps, std::vector<result_t>& out)
+{
+    // on the unit circle, so repeated products stay bounded
+    const Cmp w(std::cos(0.001), std::sin(0.001));
+    const Cmp c(-0.75, 0.1);
+
+    out.push_back(result_t{"Cmp::add", best_of(reps, [&]()
+    {
+        Cmp z(0.0, 0.0);
+        for(uint32_t k=0; k < BENCH_OPS; k++)
+            z.add(w);
+        sink = z.real + z.imag;
+    }), BENCH_OPS, 0});
+
+    out.push_back(result_t{"Cmp::mul", best_of(reps, [&]()
+    {
+        Cmp z(1.0, 0.0);
+        for(uint32_t k=0; k < BENCH_OPS; k++)
+            z.mul(w);
+        sink = z.real + z.imag;
+    }), BENCH_OPS, 0});
+
+    out.push_back(result_t{"Cmp::length2", best_of(reps, [&]()
+    {
+        Cmp    z(0.5, 0.25);
+        double sum = 0.0;
+        for(uint32_t k=0; k < BENCH_OPS; k++)
+        {
+            sum += z.length2();
+            z.real = sum * 1e-9;
+        }
+        sink = sum;
+    }), BENCH_OPS, 0});
+
+    // z^2 + c, one whole Mandelbrot step
+    out.push_back(result_t{"Cmp::mul+add", best_of(reps, [&]()
+    {
+        Cmp z(0.0, 0.0);
+        for(uint32_t k=0; k < BENCH_OPS; k++)
+        {
+            z.mul(z);
+            z.add(c);
+        }
+        sink = z.real + z.imag;
+    }), BENCH_OPS, 0});
+}
+
+
+/*
+ * Time a batch kernel over the grid of points
+ */
+static result_t bench_kernel(const std::string& name, uint32_t reps,
+                             const std::vector<double>& cr, const std::vector<double>& ci,
+                             const render::BatchFunc& batch)
+{
+    std::vector<double> counts(cr.size());
+    uint64_t            from = simd::ran;
+    double took = best_of(reps, [&]()
+    {
+        for(size_t k=0; k < cr.size(); k += BENCH_GRID)
+            batch(&cr[k], &ci[k], BENCH_GRID, &counts[k]);
+    });
+    return result_t{name, took, (simd::ran - from) / reps, 0};
+}
+
+
+/*
+ * iterate_m in every numeric type and vector width, and iterate_j
+ * for each formula of funcs::all, all without fast exits
+ */
+static void bench_kernels(uint32_t reps, std::vector<result_t>& out)
+{
+    // the whole Mandelbrot set, and a disc the Julia sets fit in
+    std::vector<double> mr, mi, jr, ji;
+    for(uint32_t y=0; y < BENCH_GRID; y++)
+        for(uint32_t x=0; x < BENCH_GRID; x++)
+        {
+            mr.push_back(-2.0 + (2.5 * x) / BENCH_GRID);
+            mi.push_back(-1.25 + (2.5 * y) / BENCH_GRID);
+            jr.push_back(-1.6 + (3.2 * x) / BENCH_GRID);
+            ji.push_back(-1.2 + (2.4 * y) / BENCH_GRID);
+        }
+
+    out.push_back(bench_kernel("iterate_m double", reps, mr, mi,
+        [](const double* cr, const double* ci, uint32_t n, double* counts)
+        {
+            for(uint32_t k=0; k < n; k++)
+            {
+                Cmp z(0.0, 0.0);
+                counts[k] = render::iterate_m(z, Cmp(cr[k], ci[k]), BENCH_LIMIT);
+            }
+        }));
+
+    out.push_back(bench_kernel("iterate_m dd", reps, mr, mi,
+        [](const double* cr, const double* ci, uint32_t n, double* counts)
+        {
+            for(uint32_t k=0; k < n; k++)
+            {
+                Complex<DDouble> z(0.0, 0.0);
+                counts[k] = render::iterate_m(z, Complex<DDouble>(cr[k], ci[k]), BENCH_LIMIT);
+            }
+        }));
+
+    out.push_back(bench_kernel(std::string("simd::iterate_m ") + simd::isa_name(), reps, mr, mi,
+                               render::mandel_batch(PRECISION_DOUBLE, 0, BENCH_LIMIT)));
+    out.push_back(bench_kernel(std::string("simd::iterate_mf ") + simd::isa_name(), reps, mr, mi,
+                               render::mandel_batch(PRECISION_FLOAT, 0, BENCH_LIMIT)));
+
+    const Cmp c(-0.8, 0.156);
+    for(uint32_t f=0; f < funcs::JFUNC_COUNT; f++)
+    {
+        funcs::JBatch_t batch = funcs::all[f].batch;
+        out.push_back(bench_kernel(std::string("iterate_j ") + funcs::all[f].name, reps, jr, ji,
+            [&c, batch](const double* zr, const double* zi, uint32_t n, double* counts)
+            {
+                batch(c, zr, zi, n, counts, BENCH_LIMIT);
+            }));
+    }
+}
+
+
+/*
+ * A view rendered end to end
+ */
+typedef struct view_t
+{
+    const char* name;
+    const char* real;
+    const char* imag;
+    double      zoom;
+    uint32_t    limit;
+    bool        deep;
+    uint32_t    res;        // index into reso::all
+} view_t;
+
+// the deep zoom runs at 480p, it costs as much as the rest together
+static const view_t views[] =
+{
+    {"full set",        "-0.7",  "0.0", 0.5, 255, false, 1},
+    {"seahorse valley", "-0.743643887037151", "0.131825904205330", 5e3, 2000, false, 1},
+    {"interior",        "-0.12", "0.75", 4.0, 2000, false, 1},
+    {"deep zoom",       "-0.743643887037158704752191506114774",
+                        "0.131825904205311970493132056385139", 1e14, 5000, true, 0},
+};
+
+
+/*
+ * The settings of a view, the way the mandelbrot
+ * program would set them up from the same options
+ */
+static opts::Settings view_settings(const view_t& v, uint32_t threads)
+{
+    opts::Settings s(0, 0, atof(v.real), atof(v.imag), v.zoom, &reso::all[v.res]);
+    s.real_str  = v.real;
+    s.imag_str  = v.imag;
+    s.deep      = v.deep;
+    s.max_iters = v.limit;
+    s.threads   = threads;
+    s.fname     = "/dev/null";
+    s.label     = "mandelbrot z^2+c";
+    return s;
+}
+
+
+static void bench_renders(uint32_t reps, uint32_t threads, std::vector<result_t>& out)
+{
+    pool::ThreadPool tp(threads);
+
+    for(const view_t& v : views)
+    {
+        opts::Settings s = view_settings(v, threads);
+        double took = best_of(reps, [&]()
+        {
+            if(render::mandelbrot_frame(s, tp) != 0)
+                exit(1);
+        });
+
+        // one more render, counting the iterations its workers run
+        stats::Report tally(STATS_OFF, threads);
+        s.stats = &tally;
+        if(render::mandelbrot_frame(s, tp) != 0)
+            exit(1);
+        uint64_t total = tally.ran();
+
+        out.push_back(result_t{v.name, took, total, uint64_t(s.res->width) * s.res->height});
+    }
+}
+
+
+/*
+ * A result as a JSON object; rates are left out when they
+ * don't apply
+ */
+static void write_result(std::ostream& o, const result_t& r, const char* unit, bool last)
+{
+    o << "    {\"name\": \"" << r.name << "\", \"seconds\": " << r.seconds
+      << ", \"" << unit << "\": " << r.ops;
+    if(r.pixels > 0)
+        o << ", \"pixels\": " << r.pixels
+          << ", \"mpix_per_s\": " << (r.pixels / r.seconds) / 1e6;
+    if(r.ops > 0)
+        o << ", \"" << unit << "_per_s\": " << r.ops / r.seconds
+          << ", \"ns_per_" << (unit[0] == 'o' ? "op" : "iteration") << "\": " << (r.seconds * 1e9) / r.ops;
+    o << "}" << (last ? "" : ",") << std::endl;
+}
+
+
+static void write_section(std::ostream& o, const char* name, const std::vector<result_t>& rs,
+                          const char* unit, bool last)
+{
+    o << "  \"" << name << "\": [" << std::endl;
+    for(size_t k=0; k < rs.size(); k++)
+        write_result(o, rs[k], unit, k + 1 == rs.size());
+    o << "  ]" << (last ? "" : ",") << std::endl;
+}
+
+
+/*
+ * Run everything and write the report
+ */
+int main(int argc, char** argv)
+{
+    std::string path;
+    uint32_t    reps    = 3;
+    uint32_t    threads = 0;
+    int         c;
+
+    while((c = getopt(argc, argv, "o:r:t:h")) != -1)
+        switch(c)
+        {
+        case 'o':
+            path = optarg;
+            break;
+        case 'r':
+            reps = std::max(1, atoi(optarg));
+            break;
+        case 't':
+            threads = std::max(0, atoi(optarg));
+            break;
+        default:
+            std::cout << "Usage: benchmark [-o report.json] [-r runs] [-t threads]" << std::endl;
+            return (c == 'h') ? 0 : 1;
+        }
+
+    if(threads == 0)
+        threads = pool::default_threads();
+
+    std::vector<result_t> cmp, kernels, renders;
+    std::cerr << "[BENCH] complex arithmetic" << std::endl;
+    bench_cmp(reps, cmp);
+    std::cerr << "[BENCH] iteration kernels" << std::endl;
+    bench_kernels(reps, kernels);
+    std::cerr << "[BENCH] end-to-end renders" << std::endl;
+    bench_renders(reps, threads, renders);
+
+    std::ostringstream o;
+    o.precision(6);
+    o << "{" << std::endl
+      << "  \"isa\": \"" << simd::isa_name() << "\"," << std::endl
+      << "  \"compiler\": \"" << __VERSION__ << "\"," << std::endl
+#ifdef DGMP
+      << "  \"gmp\": true," << std::endl
+#else
+      << "  \"gmp\": false," << std::endl
+#endif
+      << "  \"threads\": " << threads << "," << std::endl
+      << "  \"runs\": " << reps << "," << std::endl;
+    write_section(o, "complex",  cmp,     "ops", false);
+    write_section(o, "kernels",  kernels, "iterations", false);
+    write_section(o, "renders",  renders, "iterations", true);
+    o << "}" << std::endl;
+
+    if(path.empty())
+    {
+        std::cout << o.str();
+        return 0;
+    }
+
+    std::ofstream f(path);
+    f << o.str();
+    if(!f.good())
+    {
+        std::cerr << "Error: cannot write " << path << std::endl;
+        return 1;
+    }
+
+    // a short summary next to the full report
+    for(const result_t& r : renders)
+        std::cout << "  " << r.name << ": " << r.seconds << " s, "
+                  << (r.pixels / r.seconds) / 1e6 << " Mpix/s" << std::endl;
+    return 0;
+}
+
+// end
@@ -0,0 +1,286 @@
+/*
+ * cache.cpp
+ *
+ * Every tile lives in <dir>/<fnv1a of key>.tile:
+ *
+ *   "MTC1"  uint32 key length  key bytes  uint32 count  float[count]
+ *
+ * The full key is stored and compared on load, so a hash collision
+ * is only ever a miss. Counts are whole numbers far below 2^24 and
+ * round trip through float exactly. Tiles are written to a private
+ * temporary name and renamed into place, so concurrent renders
+ * sharing a directory never see a partial file.
+ *
+ * Recency is the file's mtime: a hit touches the file, and at the
+ * end of a render the oldest tiles are removed until the directory
+ * is back under its limit. The directory is also trimmed whenever
+ * an eighth of the limit has been stored, which is what keeps the
+ * server's long-lived cache in bounds.
+ */
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "include/cache.h"
+
+#define CACHE_MAGIC   "MTC1"
+#define CACHE_SUFFIX  ".tile"
+
+
+namespace cache
+{
+    // tells apart the temporary files of concurrent stores
+    static std::atomic<uint32_t> serial(0);
+
+
+    /*
+     * 64 bit FNV-1a
+     */
+    uint64_t fnv1a(const std::string& data)
+    {
+        uint64_t h = 0xcbf29ce484222325ULL;
+        for(size_t k=0; k < data.size(); k++)
+        {
+            h ^= uint8_t(data[k]);
+            h *= 0x100000001b3ULL;
+        }
+        return h;
+    }
+
+
+    /*
+     * Read or write all of len bytes, retrying short transfers
+     */
+    static bool read_all(int fd, void* data, size_t len)
+    {
+        uint8_t* p = (uint8_t*)data;
+        while(len > 0)
+        {
+            ssize_t n = ::read(fd, p, len);
+            if(n < 0 && errno == EINTR)
+                continue;
+            if(n <= 0)
+                return false;
+            p   += n;
+            len -= n;
+        }
+        return true;
+    }
+
+
+    static bool write_all(int fd, const void* data, size_t len)
+    {
+        const uint8_t* p = (const uint8_t*)data;
+        while(len > 0)
+        {
+            ssize_t n = ::write(fd, p, len);
+            if(n < 0 && errno == EINTR)
+                continue;
+            if(n <= 0)
+                return false;
+            p   += n;
+            len -= n;
+        }
+        return true;
+    }
+
+
+    TileCache::TileCache(const std::string& d, uint64_t lim, bool v)
+        : dir(d), limit(lim), usable(true), verbose(v), hits(0), misses(0), added(0)
+    {
+        if(::mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+        {
+            std::cerr << "Warning: cannot create the cache " << dir << ": "
+                      << strerror(errno) << ", rendering without it" << std::endl;
+            usable = false;
+        }
+    }
+
+
+    TileCache::~TileCache()
+    {
+        if(!usable)
+            return;
+        std::lock_guard<std::mutex> g(scanning);
+        evict();
+        if(verbose)
+            std::cout << "Tile cache:        " << hits << " hits, " << misses << " misses" << std::endl;
+    }
+
+
+    bool TileCache::ok() const
+    {
+        return usable;
+    }
+
+
+    std::string TileCache::path(const std::string& key) const
+    {
+        std::ostringstream p;
+        p << dir << "/" << std::hex;
+        p.width(16);
+        p.fill('0');
+        p << fnv1a(key) << CACHE_SUFFIX;
+        return p.str();
+    }
+
+
+    bool TileCache::load(const std::string& key, double* counts, uint32_t n)
+    {
+        if(!usable)
+            return false;
+
+        std::string p  = path(key);
+        int         fd = ::open(p.c_str(), O_RDONLY);
+        if(fd < 0)
+        {
+            misses++;
+            return false;
+        }
+
+        char     magic[4];
+        uint32_t klen = 0, count = 0;
+        std::string        stored;
+        std::vector<float> data;
+
+        bool good = read_all(fd, magic, 4) && memcmp(magic, CACHE_MAGIC, 4) == 0
+                 && read_all(fd, &klen, 4) && klen == key.size();
+        if(good)
+        {
+            stored.resize(klen);
+            good = read_all(fd, &stored[0], klen) && stored == key
+                && read_all(fd, &count, 4) && count == n;
+        }
+        if(good)
+        {
+            data.resize(n);
+            good = read_all(fd, data.data(), n * sizeof(float));
+        }
+        ::close(fd);
+
+        if(!good)
+        {
+            misses++;
+            return false;
+        }
+
+        for(uint32_t k=0; k < n; k++)
+            counts[k] = data[k];
+
+        // a hit makes the tile the most recently used
+        ::utimensat(AT_FDCWD, p.c_str(), NULL, 0);
+        hits++;
+        return true;
+    }
+
+
+    void TileCache::store(const std::string& key, const double* counts, uint32_t n)
+    {
+        if(!usable)
+            return;
+
+        std::vector<float> data(counts, counts + n);
+        uint32_t klen = key.size();
+
+        std::string p = path(key);
+        std::ostringstream tmp;
+        tmp << p << ".tmp." << ::getpid() << "." << serial++;
+
+        int fd = ::open(tmp.str().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0)
+            return;
+
+        bool good = write_all(fd, CACHE_MAGIC, 4)
+                 && write_all(fd, &klen, 4)
+                 && write_all(fd, key.data(), klen)
+                 && write_all(fd, &n, 4)
+                 && write_all(fd, data.data(), n * sizeof(float));
+
+        if(::close(fd) != 0)
+            good = false;
+        if(!good || ::rename(tmp.str().c_str(), p.c_str()) != 0)
+        {
+            ::unlink(tmp.str().c_str());
+            return;
+        }
+
+        // a cache that outlives a render trims itself as it fills,
+        // one thread at a time and the others don't wait for it
+        uint64_t size = 12 + klen + (uint64_t(n) * sizeof(float));
+        if(added.fetch_add(size) + size < limit / CACHE_TRIM_SHARE)
+            return;
+
+        std::unique_lock<std::mutex> g(scanning, std::try_to_lock);
+        if(g.owns_lock())
+        {
+            added = 0;
+            evict();
+        }
+    }
+
+
+    /*
+     * Remove the least recently used tiles until the
+     * directory fits in the limit again
+     */
+    void TileCache::evict()
+    {
+        typedef struct entry_t
+        {
+            struct timespec used;
+            uint64_t        size;
+            std::string     name;
+        } entry_t;
+
+        DIR* d = ::opendir(dir.c_str());
+        if(d == NULL)
+            return;
+
+        std::vector<entry_t> tiles;
+        uint64_t total = 0;
+        size_t   slen  = strlen(CACHE_SUFFIX);
+
+        struct dirent* e;
+        while((e = ::readdir(d)) != NULL)
+        {
+            std::string name = e->d_name;
+            if(name.size() <= slen || name.compare(name.size() - slen, slen, CACHE_SUFFIX) != 0)
+                continue;
+
+            struct stat st;
+            std::string full = dir + "/" + name;
+            if(::stat(full.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+                continue;
+
+            tiles.push_back(entry_t{st.st_mtim, uint64_t(st.st_size), full});
+            total += st.st_size;
+        }
+        ::closedir(d);
+
+        if(total <= limit)
+            return;
+
+        std::sort(tiles.begin(), tiles.end(), [](const entry_t& a, const entry_t& b)
+        {
+            if(a.used.tv_sec != b.used.tv_sec)
+                return a.used.tv_sec < b.used.tv_sec;
+            return a.used.tv_nsec < b.used.tv_nsec;
+        });
+
+        for(size_t k=0; k < tiles.size() && total > limit; k++)
+        {
+            if(::unlink(tiles[k].name.c_str()) == 0)
+                total -= tiles[k].size;
+        }
+    }
+}
+
+// end
@@ -11,16 +11,84 @@
 
 namespace colors
 {
+    static const rgb_t grey_stops[] =
+    {
+        {  0.0,   0.0,   0.0},
+        {255.0, 255.0, 255.0},
+    };
 
-    /*
-    void print_color_info()
+    static const rgb_t fire_stops[] =
+    {
+        {  0.0,   0.0,   0.0},
+        {160.0,  20.0,   0.0},
+        {255.0, 140.0,   0.0},
+        {255.0, 230.0, 100.0},
+        {255.0, 255.0, 255.0},
+    };
+
+    static const rgb_t ocean_stops[] =
+    {
+        {  0.0,   0.0,  30.0},
+        {  0.0,  60.0, 140.0},
+        { 20.0, 170.0, 210.0},
+        {200.0, 250.0, 255.0},
+    };
+
+
+    // the first map is the default
+    const colormap_t all[COLORMAP_COUNT] =
+    {
+        {"grey",  grey_stops,  2, {0.0, 0.0, 0.0}},
+        {"fire",  fire_stops,  5, {0.0, 0.0, 0.0}},
+        {"ocean", ocean_stops, 4, {0.0, 0.0, 0.0}},
+    };
+
+
+    void print_all()
     {
         std::cout << "Color schemes available: " << std::endl;
         
         for(uint32_t c=0; c < COLORMAP_COUNT; c++)
-            std::cout << " -- " << all_colormaps[c].name << std::endl;
+            std::cout << " -- " << all[c].name << std::endl;
+    }
+
+
+    /*
+     * Sample the map's stops into the table once, so coloring
+     * a pixel is a single lookup
+     */
+    Palette::Palette(const colormap_t& map)
+    {
+        for(uint32_t k=0; k < PALETTE_SIZE; k++)
+        {
+            double   pos = (double(k) / (PALETTE_SIZE - 1)) * (map.count - 1);
+            uint32_t seg = (pos >= map.count - 1) ? map.count - 2 : uint32_t(pos);
+            double   t   = pos - seg;
+
+            const rgb_t& a = map.stops[seg];
+            const rgb_t& b = map.stops[seg + 1];
+            lut[(k * 3) + 0] = flatten(lerp(a.r, b.r, t) + 0.5);
+            lut[(k * 3) + 1] = flatten(lerp(a.g, b.g, t) + 0.5);
+            lut[(k * 3) + 2] = flatten(lerp(a.b, b.b, t) + 0.5);
+        }
+
+        inside[0] = flatten(map.inside.r);
+        inside[1] = flatten(map.inside.g);
+        inside[2] = flatten(map.inside.b);
+    }
+
+
+    void Palette::apply(const float* v, size_t n, uint8_t* out) const
+    {
+        for(size_t k=0; k < n; k++)
+        {
+            const uint8_t* c = color(v[k]);
+
+            *out++ = c[0];
+            *out++ = c[1];
+            *out++ = c[2];
+        }
     }
-    */
     
     
     /*
@@ -43,4 +111,3 @@ namespace colors
 }
 
 // end
-
@@ -1,10 +1,9 @@
 /*
  * complex.cpp
- * 
- * All Complex class logic and such goes here
- * if the DGMP macro is enabled (if libgmp is on the system)
- * then use those #if macros to create GMP-specific code
- * using the mpf_t type
+ *
+ * Complex<T> lives entirely in its header, so only the GMP
+ * code is left here: if the DGMP macro is enabled (if libgmp
+ * is on the system) MpCmp and its pool are built on mpf_t
  */
 
 #include <iostream>
@@ -38,151 +37,153 @@
  */
 
 
+#ifdef DGMP
 /*
- * No-value constructor
+ * Pool slots are initialized once at the default precision
  */
-Cmp::Cmp()
+MpfPool::MpfPool()
 {
-    // null value
-    real = 0.0;
-    imag = 0.0;
+    prec = mpf_get_default_prec();
+    for(uint32_t k=0; k < MPF_POOL_SIZE; k++)
+        mpf_init(slots[k]);
 }
 
 
-/*
- * Constructor setting both properties to the arg
- */
-Cmp::Cmp(double value)
+MpfPool::~MpfPool()
 {
-    real = value;
-    imag = value;
+    for(uint32_t k=0; k < MPF_POOL_SIZE; k++)
+        mpf_clear(slots[k]);
 }
 
+
 /*
- * Constructor for two values
+ * The calling thread's pool, re-initialized only if the
+ * default precision changed since it was last used
  */
-Cmp::Cmp(double r, double i)
+MpfPool& MpfPool::local()
 {
-    real = r;
-    imag = i;
+    static thread_local MpfPool pool;
+
+    mp_bitcnt_t want = mpf_get_default_prec();
+    if(pool.prec != want)
+    {
+        for(uint32_t k=0; k < MPF_POOL_SIZE; k++)
+            mpf_set_prec(pool.slots[k], want);
+        pool.prec = want;
+    }
+    return pool;
 }
 
-/*
- * Destructor, does nothing for native version
- * No heap allocs are made with the double version of Cmp
- */
-Cmp::~Cmp(){}
-
 
-void Cmp::add(const Cmp& other)
+mpf_t& MpfPool::get(uint32_t k)
 {
-    real = real + other.real;
-    imag = imag + other.imag;
+    return slots[k];
 }
 
 
-void Cmp::sub(const Cmp& other)
+MpCmp::MpCmp()
 {
-    real = real - other.real;
-    imag = imag - other.imag;
+    mpf_init(real);
+    mpf_init(imag);
 }
 
 
-void Cmp::mul(const Cmp& other)
+MpCmp::MpCmp(double r, double i)
 {
-    // store one num temporarily to avoid affecting the other
-    double r = (real * other.real) - (imag * other.imag);
-    imag     = (imag * other.real) + (real * other.imag);
-    real     = r;
+    mpf_init_set_d(real, r);
+    mpf_init_set_d(imag, i);
 }
 
 
-void Cmp::div(const Cmp& other)
+MpCmp::~MpCmp()
 {
-    // store one side again to avoid conflicts
-    double d = (other.real*other.real) + (other.imag*other.imag);
-    double r = ((real*other.real)+(imag*other.imag))/d;
-    imag     = ((imag*other.real)-(real*other.imag))/d;
-    real     = r;
+    mpf_clear(real);
+    mpf_clear(imag);
 }
 
-/*
- * Adds a double to the object's real value
- * (in these cases we assume the given double
- * can only be considered a Real value)
- */
-void Cmp::add(double value)
+
+void MpCmp::set(double r, double i)
 {
-    real = real + value; 
+    mpf_set_d(real, r);
+    mpf_set_d(imag, i);
 }
 
-/*
- * Subs a double from the object's real value
- */
-void Cmp::sub(double value)
+
+void MpCmp::set(const MpCmp& other)
 {
-    real = real - value;
+    mpf_set(real, other.real);
+    mpf_set(imag, other.imag);
 }
 
 
 /*
- * Multiplies both properties by a scalar
+ * Parse both parts from decimal strings, false on bad input
  */
-void Cmp::mul(double scalar)
+bool MpCmp::set(const char* r, const char* i)
 {
-    real = real * scalar;
-    imag = imag * scalar;
+    return mpf_set_str(real, r, 10) == 0 && mpf_set_str(imag, i, 10) == 0;
 }
 
 
-/*
- * Divides both properties by a scalar
- */
-void Cmp::div(double scalar)
+void MpCmp::add(const MpCmp& other)
 {
-    real = real / scalar;
-    imag = imag / scalar;
+    mpf_add(real, real, other.real);
+    mpf_add(imag, imag, other.imag);
 }
 
-void Cmp::neg()
+
+void MpCmp::sub(const MpCmp& other)
 {
-    real = -real;
-    imag = -imag;
+    mpf_sub(real, real, other.real);
+    mpf_sub(imag, imag, other.imag);
 }
 
 
 /*
- * Complex conjugate (invert)
+ * Products go into pool temporaries first so that z.mul(z)
+ * is safe without allocating a copy of z
  */
-Cmp Cmp::conjugate()
+void MpCmp::mul(const MpCmp& other)
 {
-    Cmp a;
-    a.real = real * (-1.0);
-    a.imag = imag * (-1.0);
-    return a;
+    MpfPool& p = MpfPool::local();
+    mpf_t& rr = p.get(0);
+    mpf_t& ii = p.get(1);
+    mpf_t& ri = p.get(2);
+    mpf_t& ir = p.get(3);
+
+    mpf_mul(rr, real, other.real);
+    mpf_mul(ii, imag, other.imag);
+    mpf_mul(ri, real, other.imag);
+    mpf_mul(ir, imag, other.real);
+    mpf_sub(real, rr, ii);
+    mpf_add(imag, ir, ri);
 }
 
-/*
- * Length2 method (real^2 + imag^2)
- * This is cheaper to do since it doesn't
- * involve calculating square roots
- */
-#ifdef DGMP
-#else
-double Cmp::length2()
+
+void MpCmp::neg()
 {
-    return (real*real) + (imag*imag);
+    mpf_neg(real, real);
+    mpf_neg(imag, imag);
 }
-#endif
 
 
 /*
- * Debug output method using iostream
+ * Writes real^2 + imag^2 to the exterior mpf_t
  */
-std::ostream& operator<<(std::ostream& fout, const Cmp& a)
+void MpCmp::length2(mpf_t* out) const
 {
-    fout << "Complex(" << a.real << ", " << a.imag << ")";
+    mpf_t& t = MpfPool::local().get(0);
+    mpf_mul(t, imag, imag);
+    mpf_mul(*out, real, real);
+    mpf_add(*out, *out, t);
+}
+
+
+std::ostream& operator<<(std::ostream& fout, const MpCmp& a)
+{
+    fout << "Complex(" << mpf_get_d(a.real) << ", " << mpf_get_d(a.imag) << ")";
     return fout;
 }
+#endif
 
 // end
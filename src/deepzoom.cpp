@@ -0,0 +1,305 @@
+/*
+ * deepzoom.cpp
+ *
+ * Perturbation iteration with series approximation.
+ *
+ * With Z_n the reference orbit at the center C and z_n = Z_n + d_n
+ * the orbit of a pixel at C + dc, the pixel obeys
+ *
+ *     d_{n+1} = 2 Z_n d_n + d_n^2 + dc
+ *
+ * which only involves small numbers and is safe in double precision
+ * as long as dc is representable (zooms up to ~1e300). Glitches are
+ * avoided by rebasing: when |z| drops below |d|, or the reference
+ * orbit has escaped, the pixel continues from d = z against Z_0.
+ *
+ * The series d_n ~ A_n dc + B_n dc^2 + C_n dc^3 is iterated along
+ * with the reference and used to jump every pixel straight to the
+ * first iteration where it stops being accurate.
+ */
+
+#include <iostream>
+#include <cmath>
+#include <string>
+
+#include "include/complex.h"
+#include "include/deepzoom.h"
+#include "include/rendering.h"
+
+// the cubic term must stay this small next to the linear one
+// for the series to be trusted
+#define SA_TOLERANCE   1e-12
+
+// probes must agree with the series to this relative error
+#define SA_PROBE_TOL   1e-6
+
+namespace deep
+{
+    /*
+     * Bits of mantissa the reference orbit needs: enough to resolve
+     * one pixel at this zoom, plus a safety margin for the orbit
+     */
+    uint32_t precision_bits(double zoom)
+    {
+        double bits = std::log2(std::max(zoom, 1.0)) + 96.0;
+        return uint32_t(bits);
+    }
+
+
+    /*
+     * Compute Z_0..Z_len at the center, stopping once it escapes;
+     * false if the center doesn't parse
+     */
+    static bool reference_orbit(const opts::Settings& s, std::vector<double>& zr, std::vector<double>& zi)
+    {
+        std::string re = render::center_str(s.real_str, s.init_real);
+        std::string im = render::center_str(s.imag_str, s.init_imag);
+
+#ifdef DGMP
+        mpf_set_default_prec(precision_bits(s.zoom));
+
+        MpCmp c, x(0.0, 0.0);
+        if(!c.set(re.c_str(), im.c_str()))
+        {
+            std::cerr << "Error: cannot parse the center " << re << ", " << im << std::endl;
+            return false;
+        }
+
+        for(uint32_t n=0; n <= s.max_iters; n++)
+        {
+            double dr = mpf_get_d(x.real);
+            double di = mpf_get_d(x.imag);
+            zr.push_back(dr);
+            zi.push_back(di);
+            if((dr * dr) + (di * di) >= M_BREAKOUT)
+                break;
+
+            x.mul(x);
+            x.add(c);
+        }
+#else
+        // without GMP the reference is only as good as a long double
+        if(precision_bits(s.zoom) > 64 + 96)
+            std::cerr << "Warning: built without GMP, the reference orbit"
+                      << " is limited to long double precision" << std::endl;
+
+        long double cr = strtold(re.c_str(), NULL);
+        long double ci = strtold(im.c_str(), NULL);
+        long double xr = 0.0, xi = 0.0;
+
+        for(uint32_t n=0; n <= s.max_iters; n++)
+        {
+            zr.push_back(double(xr));
+            zi.push_back(double(xi));
+            if((xr * xr) + (xi * xi) >= M_BREAKOUT)
+                break;
+
+            long double r = (xr * xr) - (xi * xi) + cr;
+            xi = (2.0L * xr * xi) + ci;
+            xr = r;
+        }
+#endif
+        return true;
+    }
+
+
+    /*
+     * Perturbation iteration of one pixel, carrying on the orbit
+     * `at` (iteration n, delta d against reference index m) until
+     * it escapes, reaches the iteration limit or n reaches `stop`.
+     * The orbit is left where it stopped, together with whether a
+     * rebase happened, for probing and for continuation files.
+     */
+    static double perturb(const Reference& ref, double dcr, double dci,
+                          resume::orbit_t& at, uint32_t stop, bool* rebased)
+    {
+        uint32_t n    = at.n;
+        uint32_t m    = at.m;
+        double   dr   = at.zr;
+        double   di   = at.zi;
+        uint32_t last = ref.zr.size() - 1;
+        *rebased = false;
+
+        at.state = ORBIT_RUNNING;
+        for(;;)
+        {
+            double zr = ref.zr[m] + dr;
+            double zi = ref.zi[m] + di;
+            double l2 = (zr * zr) + (zi * zi);
+
+            if(l2 >= M_BREAKOUT)
+                at.state = ORBIT_ESCAPED;
+            if(l2 >= M_BREAKOUT || n == stop || n == ref.limit)
+                break;
+
+            // rebase when the pixel gets closer to zero than its delta,
+            // or when the reference has run out
+            if(m == last || l2 < (dr * dr) + (di * di))
+            {
+                dr = zr;
+                di = zi;
+                m  = 0;
+                *rebased = true;
+            }
+
+            double Zr = ref.zr[m], Zi = ref.zi[m];
+            double nr = 2.0 * ((Zr * dr) - (Zi * di)) + ((dr * dr) - (di * di)) + dcr;
+            double ni = 2.0 * ((Zr * di) + (Zi * dr)) + (2.0 * dr * di) + dci;
+            dr = nr;
+            di = ni;
+            m++;
+            n++;
+        }
+
+        simd::ran += n - at.n;
+        at.n  = n;
+        at.m  = m;
+        at.zr = dr;
+        at.zi = di;
+        return (at.state == ORBIT_ESCAPED) ? double(n) : ref.limit + 1.0;
+    }
+
+
+    /*
+     * Evaluate the series at the scaled offset u
+     */
+    static void series(const Reference& ref, double ur, double ui, double* dr, double* di)
+    {
+        double u2r = (ur * ur) - (ui * ui), u2i = 2.0 * ur * ui;
+        double u3r = (u2r * ur) - (u2i * ui), u3i = (u2r * ui) + (u2i * ur);
+        *dr = (ref.ar * ur  - ref.ai * ui ) + (ref.br * u2r - ref.bi * u2i) + (ref.cr * u3r - ref.ci * u3i);
+        *di = (ref.ar * ui  + ref.ai * ur ) + (ref.br * u2i + ref.bi * u2r) + (ref.cr * u3i + ref.ci * u3r);
+    }
+
+
+    /*
+     * Iterate the series coefficients along the reference, scaled by
+     * powers of the radius (a = A r, b = B r^2, c = C r^3) so nothing
+     * overflows. Runs `target` steps, or with `check` set stops early
+     * at the first step where the cubic term grows too large.
+     */
+    static uint32_t advance(Reference& ref, uint32_t target, bool check)
+    {
+        double a_r = 0, a_i = 0, b_r = 0, b_i = 0, c_r = 0, c_i = 0;
+        uint32_t n = 0;
+
+        for(; n < target; n++)
+        {
+            double Zr = ref.zr[n], Zi = ref.zi[n];
+            double na_r = 2.0 * ((Zr * a_r) - (Zi * a_i)) + ref.radius;
+            double na_i = 2.0 * ((Zr * a_i) + (Zi * a_r));
+            double nb_r = 2.0 * ((Zr * b_r) - (Zi * b_i)) + ((a_r * a_r) - (a_i * a_i));
+            double nb_i = 2.0 * ((Zr * b_i) + (Zi * b_r)) + (2.0 * a_r * a_i);
+            double nc_r = 2.0 * ((Zr * c_r) - (Zi * c_i)) + 2.0 * ((a_r * b_r) - (a_i * b_i));
+            double nc_i = 2.0 * ((Zr * c_i) + (Zi * c_r)) + 2.0 * ((a_r * b_i) + (a_i * b_r));
+
+            if(check && !(std::hypot(nc_r, nc_i) <= SA_TOLERANCE * std::hypot(na_r, na_i)))
+                break;
+
+            a_r = na_r; a_i = na_i;
+            b_r = nb_r; b_i = nb_i;
+            c_r = nc_r; c_i = nc_i;
+        }
+
+        ref.ar = a_r; ref.ai = a_i;
+        ref.br = b_r; ref.bi = b_i;
+        ref.cr = c_r; ref.ci = c_i;
+        return n;
+    }
+
+
+    Reference::Reference(const opts::Settings& s)
+    {
+        limit = s.max_iters;
+        ok    = reference_orbit(s, zr, zi);
+        if(!ok)
+            return;
+
+        // the farthest pixel from the center bounds |dc|
+        radius = std::sqrt((s.span_x * s.span_x) + (s.span_y * s.span_y));
+        skip   = advance(*this, zr.size() - 1, true);
+
+        // check the skip against probes on the edges of the view:
+        // each must still be un-escaped, un-rebased and agree with
+        // the series; otherwise fall back to a shorter skip
+        const double px[9] = {-1, 0, 1, -1, 1, -1, 0, 1, 0};
+        const double py[9] = {-1, -1, -1, 0, 0, 1, 1, 1, 0};
+
+        while(skip > 0)
+        {
+            bool ok = true;
+            for(int p=0; p < 9 && ok; p++)
+            {
+                double dcr = px[p] * s.span_x, dci = py[p] * s.span_y;
+                double sr, si;
+                bool   rebased;
+
+                resume::orbit_t e = {0.0, 0.0, 0, 0, ORBIT_RUNNING, 0};
+                perturb(*this, dcr, dci, e, skip, &rebased);
+                if(e.n < skip || rebased)
+                {
+                    ok = false;
+                    break;
+                }
+
+                series(*this, dcr / radius, dci / radius, &sr, &si);
+                double err = std::hypot(sr - e.zr, si - e.zi);
+                if(!(err <= SA_PROBE_TOL * std::hypot(e.zr, e.zi)))
+                    ok = false;
+            }
+            if(ok)
+                break;
+
+            skip = advance(*this, skip / 2, false);
+        }
+    }
+
+
+    /*
+     * Escape count of the pixel at dc from the center
+     */
+    double Reference::iterate(double dcr, double dci) const
+    {
+        resume::orbit_t at = {0.0, 0.0, 0, 0, ORBIT_RUNNING, 0};
+        return resume(dcr, dci, at);
+    }
+
+
+    /*
+     * Carry on the pixel at dc from where its orbit was left; a
+     * fresh orbit first jumps ahead on the series
+     */
+    double Reference::resume(double dcr, double dci, resume::orbit_t& at) const
+    {
+        bool rebased;
+
+        if(at.n == 0 && skip > 0)
+        {
+            series(*this, dcr / radius, dci / radius, &at.zr, &at.zi);
+            at.n = skip;
+            at.m = skip;
+        }
+
+        return perturb(*this, dcr, dci, at, UINT32_MAX, &rebased);
+    }
+
+
+    /*
+     * Batch interface matching render::BatchFunc, where the points
+     * are offsets from the view center
+     */
+    void iterate(const Reference& ref, const double* dcr, const double* dci, uint32_t n, double* out)
+    {
+        for(uint32_t k=0; k < n; k++)
+            out[k] = ref.iterate(dcr[k], dci[k]);
+    }
+
+
+    void resume(const Reference& ref, const double* dcr, const double* dci, uint32_t n, resume::orbit_t* orb)
+    {
+        for(uint32_t k=0; k < n; k++)
+            ref.resume(dcr[k], dci[k], orb[k]);
+    }
+}
+
+// end
@@ -0,0 +1,641 @@
+/*
+ * expr.cpp
+ *
+ * Parsing, constant folding and batched evaluation of formulas.
+ *
+ * Grammar (usual precedence, ^ is right associative and binds
+ * tighter than unary minus):
+ *
+ *     expr  := term  (('+' | '-') term)*
+ *     term  := unary (('*' | '/') unary)*
+ *     unary := ('-' | '+') unary | power
+ *     power := atom ('^' unary)?
+ *     atom  := number | z | c | i | pi | name '(' expr ')' | '(' expr ')'
+ */
+
+#include <iostream>
+#include <sstream>
+#include <cmath>
+#include <complex>
+#include <cctype>
+#include <cstdlib>
+#include <algorithm>
+
+#include "include/expr.h"
+#include "include/rendering.h"
+
+// registers are 16 bit indices in the bytecode, with the top
+// bit marking constants while compiling
+#define EXPR_MAX_REGS  32767
+
+namespace expr
+{
+    const uint32_t FUNCTION_COUNT = 10;
+
+    const FunctionInfo all[] =
+    {
+        {"sin",  OP_SIN},
+        {"cos",  OP_COS},
+        {"tan",  OP_TAN},
+        {"sinh", OP_SINH},
+        {"cosh", OP_COSH},
+        {"exp",  OP_EXP},
+        {"log",  OP_LOG},
+        {"sqrt", OP_SQRT},
+        {"conj", OP_CONJ},
+        {"abs",  OP_ABS},
+    };
+
+
+    /*
+     * Scalar complex operations shared by constant folding and
+     * the lane loops. Multiplication and division round the same
+     * way as Complex<T>::mul and div, so "z^2+c" gives the same
+     * counts as the built-in kernel.
+     */
+    static inline void c_mul(double ar, double ai, double br, double bi, double& r, double& i)
+    {
+        r = (ar * br) - (ai * bi);
+        i = (ai * br) + (ar * bi);
+    }
+
+    static inline void c_div(double ar, double ai, double br, double bi, double& r, double& i)
+    {
+        double d = (br * br) + (bi * bi);
+        r = ((ar * br) + (ai * bi)) / d;
+        i = ((ai * br) - (ar * bi)) / d;
+    }
+
+    // z^n for n >= 1 by squaring, from the highest set bit down
+    static inline void c_powi(double ar, double ai, int32_t n, double& r, double& i)
+    {
+        int32_t top = 31 - __builtin_clz(uint32_t(n));
+        double  xr  = ar, xi = ai;
+        for(int32_t b=top-1; b >= 0; b--)
+        {
+            c_mul(xr, xi, xr, xi, xr, xi);
+            if((n >> b) & 1)
+                c_mul(xr, xi, ar, ai, xr, xi);
+        }
+        r = xr;
+        i = xi;
+    }
+
+    static inline void c_exp(double ar, double ai, double& r, double& i)
+    {
+        double m = std::exp(ar);
+        r = m * std::cos(ai);
+        i = m * std::sin(ai);
+    }
+
+    static inline void c_log(double ar, double ai, double& r, double& i)
+    {
+        r = std::log(std::hypot(ar, ai));
+        i = std::atan2(ai, ar);
+    }
+
+    static inline void c_pow(double ar, double ai, double br, double bi, double& r, double& i)
+    {
+        if(ar == 0.0 && ai == 0.0)
+        {
+            r = 0.0;
+            i = 0.0;
+            return;
+        }
+        double lr, li, er, ei;
+        c_log(ar, ai, lr, li);
+        c_mul(br, bi, lr, li, er, ei);
+        c_exp(er, ei, r, i);
+    }
+
+    static inline void c_sin(double ar, double ai, double& r, double& i)
+    {
+        r = std::sin(ar) * std::cosh(ai);
+        i = std::cos(ar) * std::sinh(ai);
+    }
+
+    static inline void c_cos(double ar, double ai, double& r, double& i)
+    {
+        r =  std::cos(ar) * std::cosh(ai);
+        i = -std::sin(ar) * std::sinh(ai);
+    }
+
+    static inline void c_sinh(double ar, double ai, double& r, double& i)
+    {
+        r = std::sinh(ar) * std::cos(ai);
+        i = std::cosh(ar) * std::sin(ai);
+    }
+
+    static inline void c_cosh(double ar, double ai, double& r, double& i)
+    {
+        r = std::cosh(ar) * std::cos(ai);
+        i = std::sinh(ar) * std::sin(ai);
+    }
+
+    static inline void c_sqrt(double ar, double ai, double& r, double& i)
+    {
+        std::complex<double> s = std::sqrt(std::complex<double>(ar, ai));
+        r = s.real();
+        i = s.imag();
+    }
+
+
+    /*
+     * Apply one operation to scalars
+     */
+    static void apply(uint8_t op, int32_t n, double ar, double ai, double br, double bi, double& r, double& i)
+    {
+        double sr, si, cr, ci;
+        switch(op)
+        {
+        case OP_ADD:  r = ar + br; i = ai + bi;        break;
+        case OP_SUB:  r = ar - br; i = ai - bi;        break;
+        case OP_MUL:  c_mul(ar, ai, br, bi, r, i);     break;
+        case OP_DIV:  c_div(ar, ai, br, bi, r, i);     break;
+        case OP_NEG:  r = -ar;     i = -ai;            break;
+        case OP_POWI: c_powi(ar, ai, n, r, i);         break;
+        case OP_POW:  c_pow(ar, ai, br, bi, r, i);     break;
+        case OP_SIN:  c_sin(ar, ai, r, i);             break;
+        case OP_COS:  c_cos(ar, ai, r, i);             break;
+        case OP_TAN:
+            c_sin(ar, ai, sr, si);
+            c_cos(ar, ai, cr, ci);
+            c_div(sr, si, cr, ci, r, i);
+            break;
+        case OP_SINH: c_sinh(ar, ai, r, i);            break;
+        case OP_COSH: c_cosh(ar, ai, r, i);            break;
+        case OP_EXP:  c_exp(ar, ai, r, i);             break;
+        case OP_LOG:  c_log(ar, ai, r, i);             break;
+        case OP_SQRT: c_sqrt(ar, ai, r, i);            break;
+        case OP_CONJ: r = ar;      i = -ai;            break;
+        case OP_ABS:  r = std::hypot(ar, ai); i = 0.0; break;
+        }
+    }
+
+
+    /*
+     * An operand while compiling: either a value known at compile
+     * time or a register holding one value per lane
+     */
+    typedef struct operand_t
+    {
+        bool     konst;
+        double   re, im;
+        uint16_t reg;
+    } operand_t;
+
+
+    /*
+     * Recursive descent parser emitting bytecode as it goes.
+     * Operations on constants are folded instead of emitted.
+     */
+    class Compiler
+    {
+    private:
+        const std::string& src;
+        size_t             pos;
+        Program&           prog;
+        std::string        error;
+
+        // registers of the constants, emitted after parsing
+        std::vector<operand_t> konsts;
+        uint32_t               temps;
+
+        operand_t value(double re, double im)
+        {
+            return operand_t{true, re, im, 0};
+        }
+
+        operand_t reg(uint16_t r)
+        {
+            return operand_t{false, 0.0, 0.0, r};
+        }
+
+        void skip()
+        {
+            while(pos < src.size() && isspace((unsigned char)src[pos]))
+                pos++;
+        }
+
+        bool accept(char ch)
+        {
+            skip();
+            if(pos < src.size() && src[pos] == ch)
+            {
+                pos++;
+                return true;
+            }
+            return false;
+        }
+
+        bool fail(const std::string& what)
+        {
+            if(error.empty())
+            {
+                std::ostringstream e;
+                e << what << " at position " << (pos + 1);
+                error = e.str();
+            }
+            return false;
+        }
+
+        // the register an operand lives in, spilling constants
+        uint16_t place(const operand_t& o)
+        {
+            if(!o.konst)
+                return o.reg;
+            konsts.push_back(o);
+            return uint16_t(konsts.size() - 1);
+        }
+
+        operand_t emit(uint8_t op, const operand_t& a, const operand_t& b, int32_t n = 0)
+        {
+            if(a.konst && b.konst)
+            {
+                double r, i;
+                apply(op, n, a.re, a.im, b.re, b.im, r, i);
+                return value(r, i);
+            }
+
+            // constant registers are numbered after parsing, so
+            // their indices are marked with the top bit until then
+            instr_t in;
+            in.op  = op;
+            in.dst = uint16_t(temps++);
+            in.a   = a.konst ? uint16_t(0x8000 | place(a)) : a.reg;
+            in.b   = b.konst ? uint16_t(0x8000 | place(b)) : b.reg;
+            in.n   = n;
+            prog.code.push_back(in);
+            return reg(in.dst);
+        }
+
+        // one-argument operations ignore b, pass a twice
+        operand_t unary_op(uint8_t op, const operand_t& a, int32_t n = 0)
+        {
+            return emit(op, a, a, n);
+        }
+
+        bool expr(operand_t& out)
+        {
+            if(!term(out))
+                return false;
+            for(;;)
+            {
+                operand_t rhs;
+                if(accept('+'))
+                {
+                    if(!term(rhs))
+                        return false;
+                    out = emit(OP_ADD, out, rhs);
+                }
+                else if(accept('-'))
+                {
+                    if(!term(rhs))
+                        return false;
+                    out = emit(OP_SUB, out, rhs);
+                }
+                else
+                    return true;
+            }
+        }
+
+        bool term(operand_t& out)
+        {
+            if(!unary(out))
+                return false;
+            for(;;)
+            {
+                operand_t rhs;
+                if(accept('*'))
+                {
+                    if(!unary(rhs))
+                        return false;
+                    out = emit(OP_MUL, out, rhs);
+                }
+                else if(accept('/'))
+                {
+                    if(!unary(rhs))
+                        return false;
+                    out = emit(OP_DIV, out, rhs);
+                }
+                else
+                    return true;
+            }
+        }
+
+        bool unary(operand_t& out)
+        {
+            if(accept('-'))
+            {
+                if(!unary(out))
+                    return false;
+                out = unary_op(OP_NEG, out);
+                return true;
+            }
+            if(accept('+'))
+                return unary(out);
+            return power(out);
+        }
+
+        bool power(operand_t& out)
+        {
+            if(!atom(out))
+                return false;
+            if(!accept('^'))
+                return true;
+
+            operand_t e;
+            if(!unary(e))
+                return false;
+
+            // small integer exponents are unrolled into squarings
+            if(e.konst && e.im == 0.0 && e.re == std::floor(e.re) && std::fabs(e.re) <= 64.0)
+            {
+                int32_t n = int32_t(e.re);
+                if(n == 0)
+                {
+                    out = value(1.0, 0.0);
+                    return true;
+                }
+                operand_t p = (std::abs(n) == 1) ? out : unary_op(OP_POWI, out, std::abs(n));
+                out = (n < 0) ? emit(OP_DIV, value(1.0, 0.0), p) : p;
+                return true;
+            }
+
+            out = emit(OP_POW, out, e);
+            return true;
+        }
+
+        bool atom(operand_t& out)
+        {
+            skip();
+            if(pos >= src.size())
+                return fail("unexpected end of expression");
+
+            char ch = src[pos];
+            if(isdigit((unsigned char)ch) || ch == '.')
+            {
+                const char* start = src.c_str() + pos;
+                char*       end   = NULL;
+                double      v     = strtod(start, &end);
+                if(end == start)
+                    return fail("bad number");
+                pos += end - start;
+                out  = value(v, 0.0);
+                return true;
+            }
+
+            if(ch == '(')
+            {
+                pos++;
+                if(!expr(out))
+                    return false;
+                if(!accept(')'))
+                    return fail("expected ')'");
+                return true;
+            }
+
+            if(!isalpha((unsigned char)ch))
+                return fail(std::string("unexpected '") + ch + "'");
+
+            size_t start = pos;
+            while(pos < src.size() && isalnum((unsigned char)src[pos]))
+                pos++;
+            std::string name = src.substr(start, pos - start);
+
+            if(name == "z")
+                out = reg(0);
+            else if(name == "c")
+                out = reg(1);
+            else if(name == "i")
+                out = value(0.0, 1.0);
+            else if(name == "pi")
+                out = value(M_PI, 0.0);
+            else
+            {
+                for(uint32_t f=0; f < FUNCTION_COUNT; f++)
+                {
+                    if(name != all[f].name)
+                        continue;
+                    if(!accept('('))
+                        return fail("expected '(' after " + name);
+                    operand_t arg;
+                    if(!expr(arg))
+                        return false;
+                    if(!accept(')'))
+                        return fail("expected ')'");
+                    out = unary_op(all[f].op, arg);
+                    return true;
+                }
+                pos = start;
+                return fail("unknown name '" + name + "'");
+            }
+            return true;
+        }
+
+    public:
+        Compiler(const std::string& s, Program& p)
+            : src(s), pos(0), prog(p), temps(2) {}
+
+        bool run(std::string& err)
+        {
+            operand_t out;
+            bool ok = expr(out);
+            skip();
+            if(ok && pos != src.size())
+                ok = fail(std::string("unexpected '") + src[pos] + "'");
+            if(!ok)
+            {
+                err = error;
+                return false;
+            }
+
+            // a formula that folded down to a constant still needs
+            // an instruction to land in a register
+            if(out.konst)
+            {
+                uint16_t k = uint16_t(0x8000 | place(out));
+                prog.code.push_back(instr_t{OP_ADD, uint16_t(temps++), k, uint16_t(0x8000 | place(value(0.0, 0.0))), 0});
+                out = reg(prog.code.back().dst);
+            }
+
+            if(temps + konsts.size() > EXPR_MAX_REGS)
+            {
+                err = "expression is too long";
+                return false;
+            }
+
+            // constants take registers 2..k+1, temporaries follow
+            uint32_t k = konsts.size();
+            prog.regs = temps + k;
+            prog.kr.assign(prog.regs, 0.0);
+            prog.ki.assign(prog.regs, 0.0);
+            for(uint32_t j=0; j < k; j++)
+            {
+                prog.kr[2 + j] = konsts[j].re;
+                prog.ki[2 + j] = konsts[j].im;
+            }
+
+            auto fix = [k](uint16_t r) -> uint16_t
+            {
+                if(r & 0x8000)
+                    return uint16_t(2 + (r & 0x7fff));
+                return (r >= 2) ? uint16_t(r + k) : r;
+            };
+            for(size_t j=0; j < prog.code.size(); j++)
+            {
+                prog.code[j].dst = fix(prog.code[j].dst);
+                prog.code[j].a   = fix(prog.code[j].a);
+                prog.code[j].b   = fix(prog.code[j].b);
+            }
+            prog.result = fix(out.reg);
+            return true;
+        }
+    };
+
+
+    bool compile(const std::string& src, Program& prog, std::string& error)
+    {
+        prog = Program();
+        Compiler comp(src, prog);
+        return comp.run(error);
+    }
+
+
+    Program::Program()
+        : regs(2), result(0)
+    {
+    }
+
+
+    /*
+     * Run every instruction over the first m lanes of the
+     * register file (real parts then imaginary parts per register)
+     */
+    static void run(const Program& p, double* file, uint32_t m)
+    {
+        for(size_t j=0; j < p.code.size(); j++)
+        {
+            const instr_t& in = p.code[j];
+            double* dr = file + (2 * in.dst) * EXPR_LANES;
+            double* di = dr + EXPR_LANES;
+            const double* ar = file + (2 * in.a) * EXPR_LANES;
+            const double* ai = ar + EXPR_LANES;
+            const double* br = file + (2 * in.b) * EXPR_LANES;
+            const double* bi = br + EXPR_LANES;
+
+            // the cheap operations get their own loops so they vectorize
+            switch(in.op)
+            {
+            case OP_ADD:
+                for(uint32_t l=0; l < m; l++)
+                {
+                    dr[l] = ar[l] + br[l];
+                    di[l] = ai[l] + bi[l];
+                }
+                break;
+            case OP_SUB:
+                for(uint32_t l=0; l < m; l++)
+                {
+                    dr[l] = ar[l] - br[l];
+                    di[l] = ai[l] - bi[l];
+                }
+                break;
+            case OP_MUL:
+                for(uint32_t l=0; l < m; l++)
+                    c_mul(ar[l], ai[l], br[l], bi[l], dr[l], di[l]);
+                break;
+            case OP_POWI:
+                for(uint32_t l=0; l < m; l++)
+                    c_powi(ar[l], ai[l], in.n, dr[l], di[l]);
+                break;
+            default:
+                for(uint32_t l=0; l < m; l++)
+                    apply(in.op, in.n, ar[l], ai[l], br[l], bi[l], dr[l], di[l]);
+                break;
+            }
+        }
+    }
+
+
+    /*
+     * Iterate the batch EXPR_LANES points at a time. All lanes of a
+     * block are on the same iteration, so escaped lanes are simply
+     * compacted out and the block shrinks until it's empty.
+     */
+    void Program::iterate(const Cmp& c, const double* zr, const double* zi,
+                          uint32_t n, double* out, double breakout, uint32_t limit) const
+    {
+        static thread_local std::vector<double> file;
+        file.resize(size_t(regs) * 2 * EXPR_LANES);
+
+        double*  r0r = file.data();
+        double*  r0i = r0r + EXPR_LANES;
+        double*  r1r = r0i + EXPR_LANES;
+        double*  r1i = r1r + EXPR_LANES;
+        uint32_t idx[EXPR_LANES];
+
+        // constants are the same in every lane and never move
+        for(uint32_t r=2; r < regs; r++)
+            for(uint32_t l=0; l < EXPR_LANES; l++)
+            {
+                file[(2 * r) * EXPR_LANES + l]     = kr[r];
+                file[(2 * r + 1) * EXPR_LANES + l] = ki[r];
+            }
+
+        for(uint32_t base=0; base < n; base += EXPR_LANES)
+        {
+            uint32_t m = std::min(uint32_t(EXPR_LANES), n - base);
+            for(uint32_t l=0; l < m; l++)
+            {
+                r0r[l] = zr[base + l];
+                r0i[l] = zi[base + l];
+                r1r[l] = c.real;
+                r1i[l] = c.imag;
+                idx[l] = base + l;
+            }
+
+            const double* resr = file.data() + (2 * result) * EXPR_LANES;
+            const double* resi = resr + EXPR_LANES;
+
+            for(uint32_t it=0; m > 0; it++)
+            {
+                // drop the lanes that escaped on this iteration
+                uint32_t kept = 0;
+                for(uint32_t l=0; l < m; l++)
+                {
+                    if((r0r[l] * r0r[l]) + (r0i[l] * r0i[l]) < breakout)
+                    {
+                        r0r[kept] = r0r[l];
+                        r0i[kept] = r0i[l];
+                        r1r[kept] = r1r[l];
+                        r1i[kept] = r1i[l];
+                        idx[kept] = idx[l];
+                        kept++;
+                    }
+                    else
+                        out[idx[l]] = double(it);
+                }
+                m = kept;
+
+                if(it == limit)
+                {
+                    for(uint32_t l=0; l < m; l++)
+                        out[idx[l]] = limit + 1.0;
+                    break;
+                }
+
+                run(*this, file.data(), m);
+                simd::ran += m;
+                if(result != 0)
+                    for(uint32_t l=0; l < m; l++)
+                    {
+                        r0r[l] = resr[l];
+                        r0i[l] = resi[l];
+                    }
+            }
+        }
+    }
+}
+
+// end
@@ -5,36 +5,24 @@
  */
 #include "include/complex.h"
 #include "include/functions.h"
+#include "include/rendering.h"
+#include "include/expr.h"
 
 namespace funcs
 {
-    const uint32_t JFUNC_COUNT = 2;
+    const uint32_t JFUNC_COUNT = 7;
 
-    /*
-     * A basic z^2 + c function
-     */
-    void _z_squared(Cmp& z, const Cmp& c)
-    {
-        z.mul(z);
-        z.add(c);
-    }
-
-
-    /*
-     * A basic z^3 + c function
-     */
-    void _z_cubed(Cmp& z, const Cmp& c)
-    {
-        z.mul(z);
-        z.mul(z);
-        z.add(c);
-    }
-
-    // defines all functions available for Julia Set rendering
+    // defines all functions available for Julia Set rendering,
+    // each entry is its own instance of the iteration loop
     const JuliaFunc all[] =
     {
-        {"z^2+c", &_z_squared},
-        {"z^3+c",   &_z_cubed},
+        {"z^2+c", 2, &render::iterate_j<ZPow<2>>},
+        {"z^3+c", 3, &render::iterate_j<ZPow<3>>},
+        {"z^4+c", 4, &render::iterate_j<ZPow<4>>},
+        {"z^5+c", 5, &render::iterate_j<ZPow<5>>},
+        {"z^6+c", 6, &render::iterate_j<ZPow<6>>},
+        {"z^7+c", 7, &render::iterate_j<ZPow<7>>},
+        {"z^8+c", 8, &render::iterate_j<ZPow<8>>},
     };
 
 
@@ -48,6 +36,12 @@ namespace funcs
         for(uint32_t j=0; j < JFUNC_COUNT; j++)
             std::cout << "  * " << all[j].name << std::endl;
 
+        std::cout << "  * any expression in z and c, e.g. \"z^3 - 0.5*z + c\"" << std::endl
+                  << "    using + - * / ^ ( ), i, pi and";
+        for(uint32_t f=0; f < expr::FUNCTION_COUNT; f++)
+            std::cout << " " << expr::all[f].name << "()";
+        std::cout << std::endl;
+
         std::cout << std::endl;
     }
 }
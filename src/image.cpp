@@ -0,0 +1,467 @@
+/*
+ * image.cpp
+ *
+ * PPM (P6) and PNG writers built on raw file descriptor writes.
+ * Rows are passed straight to write(2) in blocks, skipping the
+ * formatted-insertion path of iostreams entirely.
+ *
+ * The PNG writer splits the image into chunks of whole rows. Each
+ * one is filtered and deflated as a raw deflate block sequence
+ * ending in a sync flush (the last one in a final block), so the
+ * pieces concatenate into one valid zlib stream. A chunk also gets
+ * the rows just before it: the row above its first row for the
+ * filters, and up to a window's worth of the previous chunk's
+ * filtered bytes as its deflate dictionary, which makes it compress
+ * as if the stream had never been split. The stream's Adler-32 is
+ * put together from the chunks' with adler32_combine.
+ */
+
+#include <iostream>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+#ifdef DZLIB
+#include <zlib.h>
+#endif
+#include "include/image.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+// largest single write(2) we issue, some platforms choke on >2GB
+#define MAX_WRITE  (1u << 30)
+
+namespace image
+{
+    /*
+     * Open the output file, or duplicate the given descriptor
+     * so closing the sink leaves the caller's copy open
+     */
+    ImageSink::ImageSink(const std::string& p, uint32_t w, uint32_t h, int out)
+    {
+        path         = p;
+        width        = w;
+        height       = h;
+        rows_written = 0;
+        bytes        = 0;
+        failed       = false;
+
+        if(out >= 0)
+            fd = ::dup(out);
+        else
+            fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+        if(fd < 0)
+        {
+            std::cerr << "Error: cannot open " << path << ": " << strerror(errno) << std::endl;
+            failed = true;
+        }
+    }
+
+
+    ImageSink::~ImageSink()
+    {
+        ImageSink::close();
+    }
+
+
+    /*
+     * Write everything, retrying short writes
+     */
+    void ImageSink::put(const uint8_t* data, size_t len)
+    {
+        while(len > 0 && !failed)
+        {
+            size_t  chunk = (len > MAX_WRITE) ? MAX_WRITE : len;
+            ssize_t n     = ::write(fd, data, chunk);
+            if(n < 0)
+            {
+                if(errno == EINTR)
+                    continue;
+                std::cerr << "Error: writing " << path << ": " << strerror(errno) << std::endl;
+                failed = true;
+                return;
+            }
+            data  += n;
+            len   -= n;
+            bytes += n;
+        }
+    }
+
+
+    /*
+     * Close the file, returns false if anything went wrong
+     * or the image was left incomplete
+     */
+    bool ImageSink::close()
+    {
+        if(fd >= 0)
+        {
+            if(::close(fd) != 0)
+                failed = true;
+            fd = -1;
+
+            if(!failed && rows_written != height)
+            {
+                std::cerr << "Error: " << path << " is incomplete ("
+                          << rows_written << "/" << height << " rows)" << std::endl;
+                failed = true;
+            }
+        }
+        return !failed;
+    }
+
+
+    bool ImageSink::ok() const
+    {
+        return !failed;
+    }
+
+
+    uint64_t ImageSink::bytes_written() const
+    {
+        return bytes;
+    }
+
+
+    const std::string& ImageSink::name() const
+    {
+        return path;
+    }
+
+
+    /*
+     * Write the PPM header;
+     * the comment line is written as-is after a '#'
+     */
+    PpmSink::PpmSink(const std::string& p, uint32_t w, uint32_t h, const std::string& comment, int out)
+        : ImageSink(p, w, h, out)
+    {
+        std::ostringstream hdr;
+        hdr << "P6\n";
+        hdr << "#" << comment << "\n";
+        hdr << width << " " << height;
+        hdr << "\n255\n";
+
+        std::string s = hdr.str();
+        put((const uint8_t*)s.data(), s.size());
+    }
+
+
+    void PpmSink::write_rows(const uint8_t* data, uint32_t rows)
+    {
+        if(failed)
+            return;
+        put(data, size_t(width) * 3 * rows);
+        rows_written += rows;
+    }
+
+
+#ifdef DZLIB
+    static void put_be32(uint8_t* p, uint32_t v)
+    {
+        p[0] = uint8_t(v >> 24);
+        p[1] = uint8_t(v >> 16);
+        p[2] = uint8_t(v >> 8);
+        p[3] = uint8_t(v);
+    }
+
+
+    /*
+     * Write the signature, the header and the comment
+     */
+    PngSink::PngSink(const std::string& p, uint32_t w, uint32_t h, const std::string& comment,
+                     pool::ThreadPool& pool, int out)
+        : ImageSink(p, w, h, out), tp(pool)
+    {
+        size_t line = (size_t(width) * 3) + 1;
+        chunk_rows  = std::max<size_t>(1, PNG_CHUNK_BYTES / line);
+        context     = ((PNG_WINDOW + line - 1) / line) + 1;
+        carried     = 0;
+        queued      = 0;
+        adler       = adler32(0, Z_NULL, 0);
+
+        static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+        put(signature, 8);
+
+        // 8 bit RGB, deflate, adaptive filters, no interlacing
+        uint8_t ihdr[13] = {0};
+        put_be32(ihdr, width);
+        put_be32(ihdr + 4, height);
+        ihdr[8] = 8;
+        ihdr[9] = 2;
+        put_chunk("IHDR", ihdr, 13);
+
+        std::string text = std::string("Comment") + '\0' + comment;
+        put_chunk("tEXt", (const uint8_t*)text.data(), text.size());
+    }
+
+
+    PngSink::~PngSink()
+    {
+        close();
+    }
+
+
+    void PngSink::put_chunk(const char* type, const uint8_t* data, size_t len)
+    {
+        uint8_t head[8], tail[4];
+        put_be32(head, len);
+        memcpy(head + 4, type, 4);
+
+        uLong crc = crc32(0, Z_NULL, 0);
+        crc = crc32(crc, head + 4, 4);
+        if(len > 0)
+            crc = crc32(crc, data, len);
+        put_be32(tail, crc);
+
+        put(head, 8);
+        put(data, len);
+        put(tail, 4);
+    }
+
+
+    /*
+     * The filtered form of one row: the filter type byte, then
+     * the bytes under the filter with the smallest sum of absolute
+     * (signed) values, the usual heuristic for what deflates best
+     */
+    static void filter_row(const uint8_t* row, const uint8_t* up, size_t n, uint8_t* out, uint8_t* scratch)
+    {
+        uint64_t best = UINT64_MAX;
+
+        for(uint8_t type=0; type < 5; type++)
+        {
+            uint8_t* f   = scratch;
+            uint64_t sum = 0;
+            for(size_t k=0; k < n; k++)
+            {
+                int a = (k >= 3) ? row[k - 3] : 0;
+                int b = up[k];
+                int c = (k >= 3) ? up[k - 3] : 0;
+                int x = row[k];
+
+                int pred = 0;
+                if(type == 1)
+                    pred = a;
+                else if(type == 2)
+                    pred = b;
+                else if(type == 3)
+                    pred = (a + b) >> 1;
+                else if(type == 4)
+                {
+                    int pa = abs(b - c), pb = abs(a - c), pc = abs(a + b - 2 * c);
+                    pred = (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c;
+                }
+
+                f[k] = uint8_t(x - pred);
+                sum += abs(int8_t(f[k]));
+            }
+
+            if(sum < best)
+            {
+                best   = sum;
+                out[0] = type;
+                memcpy(out + 1, f, n);
+            }
+        }
+    }
+
+
+    /*
+     * Filter and deflate one chunk, on a worker
+     */
+    void PngSink::encode(chunk_t& ch, uint32_t width)
+    {
+        size_t n    = size_t(width) * 3;
+        size_t line = n + 1;
+
+        // row y0 only serves as the row above, unless it's the top
+        uint32_t from  = (ch.y0 == 0) ? 0 : ch.y0 + 1;
+        uint32_t total = (ch.first + ch.rows) - from;
+
+        std::vector<uint8_t> filtered(size_t(total) * line);
+        std::vector<uint8_t> zeros(n, 0), scratch(n);
+        for(uint32_t r=0; r < total; r++)
+        {
+            uint32_t       y   = from + r;
+            const uint8_t* row = &ch.raw[size_t(y - ch.y0) * n];
+            const uint8_t* up  = (y == 0) ? zeros.data() : row - n;
+            filter_row(row, up, n, &filtered[size_t(r) * line], scratch.data());
+        }
+
+        const uint8_t* data  = &filtered[size_t(ch.first - from) * line];
+        size_t         len   = size_t(ch.rows) * line;
+        size_t         dict  = std::min<size_t>(size_t(ch.first - from) * line, PNG_WINDOW);
+
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+        if(dict > 0)
+            deflateSetDictionary(&zs, data - dict, dict);
+
+        // room for the IDAT length and type, and the zlib header
+        size_t head = (ch.first == 0) ? 10 : 8;
+        ch.out.resize(head + deflateBound(&zs, len) + 16);
+        if(ch.first == 0)
+        {
+            ch.out[8] = 0x78;
+            ch.out[9] = 0x9c;
+        }
+
+        zs.next_in  = (Bytef*)data;
+        zs.avail_in = len;
+        size_t used = head;
+        int    ret;
+        do
+        {
+            if(used == ch.out.size())
+                ch.out.resize(ch.out.size() * 2);
+            zs.next_out  = &ch.out[used];
+            zs.avail_out = ch.out.size() - used;
+            ret  = deflate(&zs, ch.last ? Z_FINISH : Z_SYNC_FLUSH);
+            used = ch.out.size() - zs.avail_out;
+        }
+        while(zs.avail_out == 0 || (ch.last && ret != Z_STREAM_END));
+        deflateEnd(&zs);
+
+        // wrap it up as a finished IDAT chunk
+        ch.out.resize(used + 4);
+        ch.out.shrink_to_fit();
+        put_be32(&ch.out[0], used - 8);
+        memcpy(&ch.out[4], "IDAT", 4);
+        put_be32(&ch.out[used], crc32(crc32(0, Z_NULL, 0), &ch.out[4], used - 4));
+
+        ch.adler  = adler32(adler32(0, Z_NULL, 0), data, len);
+        ch.length = len;
+        ch.raw.clear();
+        ch.raw.shrink_to_fit();
+    }
+
+
+    /*
+     * Hand the rows in pending to a new chunk, keeping the
+     * last few as the next chunk's context
+     */
+    void PngSink::submit(bool last)
+    {
+        size_t   n    = size_t(width) * 3;
+        uint32_t have = pending.size() / n;
+
+        std::shared_ptr<chunk_t> ch = std::make_shared<chunk_t>();
+        ch->first = queued;
+        ch->rows  = have - carried;
+        ch->y0    = queued - carried;
+        ch->last  = last;
+        ch->raw   = pending;
+        queued   += ch->rows;
+
+        uint32_t keep = std::min(have, context);
+        pending.erase(pending.begin(), pending.end() - (size_t(keep) * n));
+        carried = keep;
+
+        // inflight owns the chunk until it's retired, after its job
+        // is done; the job holding a reference back would keep both
+        // alive for good
+        chunk_t* at = ch.get();
+        uint32_t w  = width;
+        ch->job = tp.submit(1, [at, w](uint32_t, uint32_t)
+        {
+            encode(*at, w);
+        });
+        inflight.push_back(ch);
+
+        if(inflight.size() > tp.size() + 1)
+            retire();
+    }
+
+
+    /*
+     * Wait for the oldest chunk and write it
+     */
+    void PngSink::retire()
+    {
+        std::shared_ptr<chunk_t> ch = inflight.front();
+        inflight.pop_front();
+        tp.wait(ch->job);
+
+        put(ch->out.data(), ch->out.size());
+        adler = adler32_combine(adler, ch->adler, ch->length);
+    }
+
+
+    void PngSink::write_rows(const uint8_t* data, uint32_t rows)
+    {
+        if(failed)
+            return;
+
+        size_t n = size_t(width) * 3;
+        while(rows > 0)
+        {
+            uint32_t fresh = (pending.size() / n) - carried;
+            uint32_t take  = std::min(rows, chunk_rows - fresh);
+
+            pending.insert(pending.end(), data, data + (take * n));
+            data         += take * n;
+            rows         -= take;
+            rows_written += take;
+            fresh        += take;
+
+            if(fresh == chunk_rows || rows_written == height)
+                submit(rows_written == height);
+        }
+    }
+
+
+    /*
+     * Write out the remaining chunks, the stream's checksum
+     * and the end of the image
+     */
+    bool PngSink::close()
+    {
+        if(fd < 0)
+            return !failed;
+
+        while(!inflight.empty())
+            retire();
+
+        if(queued == height)
+        {
+            uint8_t sum[4];
+            put_be32(sum, adler);
+            put_chunk("IDAT", sum, 4);
+            put_chunk("IEND", NULL, 0);
+        }
+        return ImageSink::close();
+    }
+#endif
+
+
+    /*
+     * Pick the writer from the file name
+     */
+    std::unique_ptr<ImageSink> open(const std::string& path, uint32_t w, uint32_t h,
+                                    const std::string& comment, pool::ThreadPool& tp, int out)
+    {
+        std::string ext = path.size() >= 4 ? path.substr(path.size() - 4) : "";
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+        if(ext == ".png")
+        {
+#ifdef DZLIB
+            return std::unique_ptr<ImageSink>(new PngSink(path, w, h, comment, tp, out));
+#else
+            std::cerr << "Error: built without zlib, PNG output is not available" << std::endl;
+            return std::unique_ptr<ImageSink>();
+#endif
+        }
+
+        return std::unique_ptr<ImageSink>(new PpmSink(path, w, h, comment, out));
+    }
+}
+
+// end
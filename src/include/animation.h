@@ -0,0 +1,40 @@
+/*
+ * animation.h
+ *
+ * Zoom sequences: a run of numbered frames from one zoom level to
+ * another around the same center, rendered on a single thread pool.
+ * When a frame's sample grid shares positions with the frame before
+ * it, the counts at those positions are copied over instead of
+ * being iterated again. With --exp-map the frames are instead
+ * resampled from one log-polar strip iterated once for the whole run,
+ * when the run is long enough for that to pay off.
+ */
+#ifndef _ANIMATION_H
+#define _ANIMATION_H
+
+#include <stdint.h>
+#include <string>
+
+#include "opts.h"
+#include "threadpool.h"
+
+// the exponential map is only used when the frames hold this many
+// times as many pixels as it has samples: a sample of the strip
+// costs more than a pixel and resampling a frame isn't free
+#define EXPMAP_BREAK_EVEN  4.0
+
+// most memory, in megabytes, kept from frame to frame (the counts
+// frame reuse copies from, the exponential map's ring and lookup
+// tables); frames that would need more are rendered on their own
+#define ANIM_MEMORY_MB     256
+
+namespace anim
+{
+    double      frame_zoom(const opts::Settings&, uint32_t);
+    std::string frame_name(const std::string&, uint32_t);
+
+    int mandelbrot(opts::Settings&, pool::ThreadPool&);
+}
+
+#endif
+// end
@@ -0,0 +1,63 @@
+/*
+ * cache.h
+ *
+ * An on-disk cache of raw escape counts, one file per tile. A tile
+ * is addressed by a hash of everything its counts depend on (the
+ * numeric path, the fill strategy, the kernel flags, the iteration
+ * limit and the exact bits of its sample grid), so the same tile of
+ * the same view is only ever iterated once. The cache is kept under
+ * a size limit by evicting the least recently used tiles.
+ */
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include <stdint.h>
+#include <string>
+#include <atomic>
+#include <mutex>
+
+// default size limit of a cache directory, in megabytes
+#define CACHE_DEFAULT_MB  256
+
+// the directory is scanned for tiles to evict whenever this
+// share of the limit has been stored since the last scan
+#define CACHE_TRIM_SHARE  8
+
+namespace cache
+{
+    uint64_t fnv1a(const std::string&);
+
+    class TileCache
+    {
+    private:
+        std::string dir;
+        uint64_t    limit;
+        bool        usable;
+        bool        verbose;
+
+        std::atomic<uint64_t> hits, misses;
+
+        // bytes stored since the last scan, and who's scanning
+        std::atomic<uint64_t> added;
+        std::mutex            scanning;
+
+        std::string path(const std::string&) const;
+        void evict();
+
+    public:
+        TileCache(const std::string&, uint64_t, bool);
+        ~TileCache();
+
+        TileCache(const TileCache&) = delete;
+        TileCache& operator=(const TileCache&) = delete;
+
+        bool ok() const;
+
+        // counts of the tile with this key, false on a miss
+        bool load(const std::string&, double*, uint32_t);
+        void store(const std::string&, const double*, uint32_t);
+    };
+}
+
+#endif
+// end
@@ -8,10 +8,15 @@
 #define _COLORS_H
 
 #include <stdint.h>
+#include <stddef.h>
 #include <cmath>
 
 #define COLORMAP_COUNT  3
 
+// entries of a palette LUT; 16 per unit of the default 255 iteration
+// limit so whole counts land exactly on an entry
+#define PALETTE_SIZE    4081
+
 namespace colors
 {
     
@@ -26,12 +31,52 @@ namespace colors
     } rgb_t;
 
 
+    /*
+     * A color map: evenly spaced stops from the fastest escape
+     * to the slowest, and the color of points that never escape
+     */
+    typedef struct colormap_t
+    {
+        const char*  name;
+        const rgb_t* stops;
+        uint32_t     count;
+        rgb_t        inside;
+    } colormap_t;
+
+
     // All of the colors available to use
-    //extern colormap_t all_colormaps[COLORMAP_COUNT];
+    extern const colormap_t all[COLORMAP_COUNT];
+
+
+    /*
+     * A color map sampled into a lookup table. Values are counts
+     * normalized to [0, 1] by the iteration limit; anything above
+     * 1 never escaped and gets the inside color.
+     */
+    class Palette
+    {
+    private:
+        uint8_t lut[PALETTE_SIZE * 3];
+        uint8_t inside[3];
+
+    public:
+        Palette(const colormap_t&);
+
+        // the RGB bytes of one normalized count
+        inline const uint8_t* color(float v) const
+        {
+            if(v > 1.0f)
+                return inside;
+            return &lut[size_t(lrintf(v * (PALETTE_SIZE - 1))) * 3];
+        }
+
+        // RGB bytes of n normalized counts
+        void apply(const float*, size_t, uint8_t*) const;
+    };
     
     
     // basic functions
-    //void     print_color_info();
+    void     print_all();
     double   lerp(double, double, double);
     uint8_t  flatten(double);
 
@@ -4,57 +4,165 @@
  * Because std::complex isn't meant for GMP's mpf_t types,
  * we will have to roll a custom class that supports mpf_t ops
  * The DGMP macro will inform us whether libgmp is supported
- * in the compiler
- */ 
+ * in the compiler; when it is, MpCmp is the arbitrary precision
+ * counterpart of the header-only Complex<T> template
+ */
 
 #ifndef _CMP_H
 #define _CMP_H
 
 #include <cmath>     // c math library
 #include <iostream>
+#include <stdint.h>
 
-class Cmp
+#ifdef DGMP
+#include <gmp.h>
+
+// number of scratch mpf_t's each thread keeps around
+#define MPF_POOL_SIZE  8
+#endif
+
+/*
+ * Complex number over any arithmetic type T (float, double,
+ * long double, DDouble). Everything is defined here in the
+ * header so the hot loops inline the arithmetic without LTO.
+ * Operations mutate the object in place, like MpCmp's do.
+ */
+template<typename T>
+class Complex
+{
+public:
+    T real, imag;
+
+    // inits
+    constexpr Complex() : real(0.0), imag(0.0) {}
+    constexpr Complex(T value) : real(value), imag(value) {}
+    constexpr Complex(T r, T i) : real(r), imag(i) {}
+
+    // math operations
+    // (a lone scalar counts as a real value for add/sub)
+    constexpr void add(T value) { real = real + value; }
+    constexpr void sub(T value) { real = real - value; }
+
+    constexpr void mul(T scalar)
+    {
+        real = real * scalar;
+        imag = imag * scalar;
+    }
+
+    constexpr void div(T scalar)
+    {
+        real = real / scalar;
+        imag = imag / scalar;
+    }
+
+    constexpr void add(const Complex& other)
+    {
+        real = real + other.real;
+        imag = imag + other.imag;
+    }
+
+    constexpr void sub(const Complex& other)
+    {
+        real = real - other.real;
+        imag = imag - other.imag;
+    }
+
+    constexpr void mul(const Complex& other)
+    {
+        // store one num temporarily to avoid affecting the other
+        T r  = (real * other.real) - (imag * other.imag);
+        imag = (imag * other.real) + (real * other.imag);
+        real = r;
+    }
+
+    constexpr void div(const Complex& other)
+    {
+        // store one side again to avoid conflicts
+        T d  = (other.real * other.real) + (other.imag * other.imag);
+        T r  = ((real * other.real) + (imag * other.imag)) / d;
+        imag = ((imag * other.real) - (real * other.imag)) / d;
+        real = r;
+    }
+
+    constexpr void neg()
+    {
+        real = -real;
+        imag = -imag;
+    }
+
+    // methods
+    constexpr Complex conjugate() const { return Complex(real, -imag); }
+
+    // real^2 + imag^2, cheaper than the modulus (no square root)
+    constexpr T length2() const { return (real * real) + (imag * imag); }
+
+    // debug
+    friend std::ostream& operator<<(std::ostream& fout, const Complex& a)
+    {
+        fout << "Complex(" << a.real << ", " << a.imag << ")";
+        return fout;
+    }
+};
+
+// the double precision complex type used by most of the program
+typedef Complex<double> Cmp;
+
+
+#ifdef DGMP
+/*
+ * Per-thread pool of preinitialized mpf_t temporaries.
+ * Arithmetic grabs its scratch values from here so the
+ * iteration loop never has to init/clear an mpf_t.
+ * The pool follows GMP's default precision and is only
+ * re-initialized when that changes.
+ */
+class MpfPool
 {
 private:
-    void _calc_abs();
+    mpf_t         slots[MPF_POOL_SIZE];
+    mp_bitcnt_t   prec;
 
 public:
+    MpfPool();
+    ~MpfPool();
+
+    static MpfPool& local();
+    mpf_t&          get(uint32_t);
+};
 
-#ifdef DGMP
-    mpf_t real, imag, abs_value, _tmp;
-#else
-    double real, imag, abs_value;
-#endif
 
-    // inits / destructs
-    Cmp();
-    Cmp(double);
-    Cmp(double, double);
-    ~Cmp();
-
-    // math operations 
-    void add(double);
-    void sub(double);
-    void mul(double);
-    void div(double);
-    void add(const Cmp&);
-    void sub(const Cmp&);
-    void mul(const Cmp&);
-    void div(const Cmp&);
+class MpCmp
+{
+public:
+    mpf_t real, imag;
+
+    // inits / destructs (at the current default precision)
+    MpCmp();
+    MpCmp(double, double);
+    ~MpCmp();
+
+    MpCmp(const MpCmp&) = delete;
+    MpCmp& operator=(const MpCmp&) = delete;
+
+    // setters
+    void set(double, double);
+    void set(const MpCmp&);
+    bool set(const char*, const char*);
+
+    // math operations, results are written into this object
+    void add(const MpCmp&);
+    void sub(const MpCmp&);
+    void mul(const MpCmp&);
     void neg();
 
     // methods
-    Cmp  conjugate();
-
-#ifdef DGMP
-    void   length2(mpf_t*);
-#else
-    double length2();
-#endif
+    void   length2(mpf_t*) const;
 
     // debug
-    friend std::ostream& operator<<(std::ostream&, const Cmp&); 
+    friend std::ostream& operator<<(std::ostream&, const MpCmp&);
 };
+#endif
 
 #endif // end include header
 
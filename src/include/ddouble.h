@@ -0,0 +1,193 @@
+/*
+ * ddouble.h
+ *
+ * Double-double arithmetic: a value is the unevaluated sum of two
+ * doubles hi + lo with |lo| <= ulp(hi)/2, which gives ~106 bits of
+ * mantissa at a fraction of the cost of GMP. Products use Dekker's
+ * split instead of an FMA since the build keeps fp-contract off.
+ *
+ * Everything is inline so the kernels templated on the numeric
+ * type compile down to straight-line double arithmetic.
+ */
+#ifndef _DDOUBLE_H
+#define _DDOUBLE_H
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+class DDouble
+{
+private:
+    // s + e == a + b exactly
+    static inline void two_sum(double a, double b, double& s, double& e)
+    {
+        s = a + b;
+        double bb = s - a;
+        e = (a - (s - bb)) + (b - bb);
+    }
+
+    // same as two_sum when |a| >= |b|
+    static inline void quick_two_sum(double a, double b, double& s, double& e)
+    {
+        s = a + b;
+        e = b - (s - a);
+    }
+
+    // p + e == a * b exactly
+    static inline void two_prod(double a, double b, double& p, double& e)
+    {
+        const double split = 134217729.0; // 2^27 + 1
+        double t  = split * a;
+        double ah = t - (t - a);
+        double al = a - ah;
+        t = split * b;
+        double bh = t - (t - b);
+        double bl = b - bh;
+
+        p = a * b;
+        e = (((ah * bh) - p) + (ah * bl) + (al * bh)) + (al * bl);
+    }
+
+public:
+    double hi, lo;
+
+    constexpr DDouble() : hi(0.0), lo(0.0) {}
+    constexpr DDouble(double h) : hi(h), lo(0.0) {}
+    constexpr DDouble(double h, double l) : hi(h), lo(l) {}
+
+    friend inline DDouble operator+(const DDouble& a, const DDouble& b)
+    {
+        double s, e, t, f;
+        two_sum(a.hi, b.hi, s, e);
+        two_sum(a.lo, b.lo, t, f);
+        e += t;
+        quick_two_sum(s, e, s, e);
+        e += f;
+        quick_two_sum(s, e, s, e);
+        return DDouble(s, e);
+    }
+
+    friend inline DDouble operator-(const DDouble& a)
+    {
+        return DDouble(-a.hi, -a.lo);
+    }
+
+    friend inline DDouble operator-(const DDouble& a, const DDouble& b)
+    {
+        return a + (-b);
+    }
+
+    friend inline DDouble operator*(const DDouble& a, const DDouble& b)
+    {
+        double p, e;
+        two_prod(a.hi, b.hi, p, e);
+        e += (a.hi * b.lo) + (a.lo * b.hi);
+        quick_two_sum(p, e, p, e);
+        return DDouble(p, e);
+    }
+
+    // quotient by a plain double, refined with two correction
+    // steps (only used to scale parsed decimals)
+    friend inline DDouble operator/(const DDouble& a, double b)
+    {
+        double q1 = a.hi / b;
+        double p, e;
+        two_prod(q1, b, p, e);
+        DDouble r = a - DDouble(p, e);
+        double q2 = r.hi / b;
+        two_prod(q2, b, p, e);
+        r = r - DDouble(p, e);
+        double q3 = r.hi / b;
+
+        double s, t;
+        quick_two_sum(q1, q2, s, t);
+        return DDouble(s, t) + DDouble(q3);
+    }
+
+    // long division, one double of quotient at a time
+    friend inline DDouble operator/(const DDouble& a, const DDouble& b)
+    {
+        double  q1 = a.hi / b.hi;
+        DDouble r  = a - (b * DDouble(q1));
+        double  q2 = r.hi / b.hi;
+        r = r - (b * DDouble(q2));
+        double  q3 = r.hi / b.hi;
+
+        double s, t;
+        quick_two_sum(q1, q2, s, t);
+        return DDouble(s, t) + DDouble(q3);
+    }
+
+    friend inline bool operator<(const DDouble& a, double b)
+    {
+        return a.hi < b || (a.hi == b && a.lo < 0.0);
+    }
+
+    friend inline bool operator==(const DDouble& a, const DDouble& b)
+    {
+        return a.hi == b.hi && a.lo == b.lo;
+    }
+
+    friend std::ostream& operator<<(std::ostream& fout, const DDouble& a)
+    {
+        fout << a.hi << (a.lo < 0.0 ? "" : "+") << a.lo;
+        return fout;
+    }
+
+    /*
+     * Parse a decimal string ("-1.25e-3" style) without going through
+     * a double first, so digits past the 17th aren't lost
+     */
+    static bool parse(const std::string& str, DDouble& out)
+    {
+        size_t  k    = 0;
+        bool    neg  = false;
+        bool    any  = false;
+        int     exp  = 0;
+        DDouble v;
+
+        if(k < str.size() && (str[k] == '-' || str[k] == '+'))
+            neg = str[k++] == '-';
+
+        for(bool frac = false; k < str.size(); k++)
+        {
+            char ch = str[k];
+            if(ch == '.' && !frac)
+                frac = true;
+            else if(ch >= '0' && ch <= '9')
+            {
+                v   = (v * DDouble(10.0)) + DDouble(double(ch - '0'));
+                exp -= frac ? 1 : 0;
+                any = true;
+            }
+            else
+                break;
+        }
+
+        if(k < str.size() && (str[k] == 'e' || str[k] == 'E'))
+        {
+            char* end = NULL;
+            long  e   = strtol(str.c_str() + k + 1, &end, 10);
+            if(end == str.c_str() + k + 1)
+                return false;
+            exp += int(e);
+            k    = end - str.c_str();
+        }
+
+        if(!any || k != str.size())
+            return false;
+
+        for(; exp > 0; exp--)
+            v = v * DDouble(10.0);
+        for(; exp < 0; exp++)
+            v = v / 10.0;
+
+        out = neg ? -v : v;
+        return true;
+    }
+};
+
+#endif
+// end
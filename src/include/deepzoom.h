@@ -0,0 +1,60 @@
+/*
+ * deepzoom.h
+ *
+ * Perturbation-theory renderer for zooms far past what a double
+ * can resolve. A single reference orbit is computed at the view
+ * center in high precision; every pixel is then iterated in double
+ * precision as a small offset (delta) from that orbit. A truncated
+ * series approximation skips the iterations all pixels share.
+ */
+#ifndef _DEEPZOOM_H
+#define _DEEPZOOM_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "opts.h"
+#include "resume.h"
+
+namespace deep
+{
+    /*
+     * The reference orbit Z_0..Z_len rounded to doubles, together
+     * with the series approximation used to skip ahead
+     */
+    class Reference
+    {
+    public:
+        std::vector<double> zr, zi;
+
+        // iteration limit the orbit was computed to
+        uint32_t limit;
+
+        // false when the center didn't parse and there's no orbit
+        bool ok;
+
+        // scaled series coefficients at the skip point: the delta
+        // after `skip` iterations is a*u + b*u^2 + c*u^3, u = dc/radius
+        uint32_t skip;
+        double   radius;
+        double   ar, ai, br, bi, cr, ci;
+
+        Reference(const opts::Settings&);
+
+        // escape count of the pixel at offset dc from the center
+        double iterate(double, double) const;
+
+        // the same, carrying on from an orbit left by an earlier
+        // render (a fresh orbit starts at n = 0), updating it
+        double resume(double, double, resume::orbit_t&) const;
+    };
+
+    // precision in bits needed for the reference at a zoom level
+    uint32_t precision_bits(double);
+
+    void iterate(const Reference&, const double*, const double*, uint32_t, double*);
+    void resume(const Reference&, const double*, const double*, uint32_t, resume::orbit_t*);
+}
+
+#endif
+// end
@@ -0,0 +1,77 @@
+/*
+ * expr.h
+ *
+ * A small compiler for user-defined Julia formulas in z and c,
+ * e.g. "z^3 - 0.5*z + c" or "sin(z)*c". The expression is parsed
+ * once at startup into register-based bytecode; each instruction
+ * then runs over a whole block of pixels at a time, so the cost
+ * of dispatching it is shared by every lane in the block.
+ */
+#ifndef _EXPR_H
+#define _EXPR_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "complex.h"
+
+// pixels evaluated together by each instruction
+#define EXPR_LANES  64
+
+namespace expr
+{
+    // bytecode operations, all on complex registers
+    enum
+    {
+        OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_NEG,
+        OP_POWI, OP_POW,
+        OP_SIN, OP_COS, OP_TAN, OP_SINH, OP_COSH,
+        OP_EXP, OP_LOG, OP_SQRT, OP_CONJ, OP_ABS,
+    };
+
+    /*
+     * One instruction: dst = op(a, b), n is the exponent of POWI
+     */
+    typedef struct instr_t
+    {
+        uint8_t  op;
+        uint16_t dst, a, b;
+        int32_t  n;
+    } instr_t;
+
+    typedef struct FunctionInfo
+    {
+        const char* name;
+        uint8_t     op;
+    } FunctionInfo;
+
+    extern const uint32_t     FUNCTION_COUNT;
+    extern const FunctionInfo all[];
+
+    /*
+     * A compiled formula. Register 0 holds z, register 1 holds c,
+     * then come the constants and one register per instruction.
+     */
+    class Program
+    {
+    public:
+        std::vector<instr_t> code;
+        std::vector<double>  kr, ki;    // values of the constant registers
+        uint32_t             regs;
+        uint32_t             result;
+
+        Program();
+
+        // escape counts of n starting points under the constant c up
+        // to the breakout and iteration limit, the same semantics as
+        // render::iterate_j
+        void iterate(const Cmp&, const double*, const double*, uint32_t, double*, double, uint32_t) const;
+    };
+
+    // parse an expression, on failure the error names the position
+    bool compile(const std::string&, Program&, std::string&);
+}
+
+#endif
+// end
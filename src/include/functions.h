@@ -1,37 +1,77 @@
 /*
  * functions.h
  *
- * Describes the function signatures used for computing julia sets
- * and contains the array header for function pointers
+ * Describes the formulas used for computing julia sets as
+ * compile-time kernels, and the table the program picks one from
  */
 #ifndef _FUNCTIONS_H
 #define _FUNCTIONS_H
 
 #include "complex.h"
 
-#ifdef DGMP
-#else
-
 namespace funcs
 {
     extern const uint32_t JFUNC_COUNT;
 
-    typedef void (*JFunc_t)(Cmp&, const Cmp&);
+    // Computes the escape counts of n starting points z (given as
+    // separate real and imaginary arrays) under the constant c up
+    // to the iteration limit, with the formula compiled into the loop
+    typedef void (*JBatch_t)(const Cmp&, const double*, const double*, uint32_t, double*, uint32_t);
 
     typedef struct JuliaFunc
     {
-        const char*   name;
-        const JFunc_t func;
+        const char*    name;
+        const uint32_t power;
+        const JBatch_t batch;
     } JuliaFunc;
 
-    void _z_squared(Cmp& z, const Cmp& c);
-    void _z_cubed(Cmp& z, const Cmp& c);
+
+    /*
+     * z^N by repeated squaring, unrolled at compile time:
+     * z^N = (z^(N/2))^2, times z once more when N is odd
+     */
+    template<uint32_t N>
+    struct Power
+    {
+        static_assert(N >= 1, "powers start at 1");
+
+        template<typename T>
+        static inline void apply(Complex<T>& z)
+        {
+            Complex<T> base = z;
+            Power<N / 2>::apply(z);
+            z.mul(z);
+            if(N & 1)
+                z.mul(base);
+        }
+    };
+
+    template<>
+    struct Power<1>
+    {
+        template<typename T>
+        static inline void apply(Complex<T>&) {}
+    };
+
+
+    /*
+     * The z^N + c family (Multibrot Julia sets)
+     */
+    template<uint32_t N>
+    struct ZPow
+    {
+        template<typename T>
+        static inline void step(Complex<T>& z, const Complex<T>& c)
+        {
+            Power<N>::apply(z);
+            z.add(c);
+        }
+    };
 
     void print_all();
 
     extern const JuliaFunc all[];
 }
-#endif
 
 
 #endif
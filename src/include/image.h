@@ -0,0 +1,130 @@
+/*
+ * image.h
+ *
+ * Output image writers. A sink owns the output file for the
+ * lifetime of a render and accepts whole rows of pixels at a
+ * time, which it hands to the OS in large unformatted writes.
+ * The format follows the file name: PPM by default, PNG for
+ * names ending in .png when built with zlib. A sink can also be
+ * handed an open descriptor (a socket, say) to write to instead,
+ * the name then only labels it.
+ */
+#ifndef _IMAGE_H
+#define _IMAGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <memory>
+#include <deque>
+#include <vector>
+
+#include "threadpool.h"
+
+// uncompressed bytes (filter byte included) per PNG deflate job
+#define PNG_CHUNK_BYTES  (256u * 1024u)
+
+// deflate window, the most history a chunk can refer back to
+#define PNG_WINDOW       32768u
+
+namespace image
+{
+    class ImageSink
+    {
+    protected:
+        int      fd;
+        bool     failed;
+        uint32_t width, height;
+        uint32_t rows_written;
+        uint64_t bytes;
+        std::string path;
+
+        // opens the file, or takes a copy of the descriptor when
+        // one is given; the format writes its own header
+        ImageSink(const std::string&, uint32_t, uint32_t, int);
+        void put(const uint8_t*, size_t);
+
+    public:
+        virtual ~ImageSink();
+
+        // sinks own a file descriptor, so they can't be copied
+        ImageSink(const ImageSink&) = delete;
+        ImageSink& operator=(const ImageSink&) = delete;
+
+        bool ok() const;
+        virtual bool close();
+        uint64_t bytes_written() const;
+        const std::string& name() const;
+
+        // write `rows` full-width RGB rows stored back to back
+        virtual void write_rows(const uint8_t*, uint32_t) = 0;
+    };
+
+
+    /*
+     * Binary PPM (P6), rows go straight to the file
+     */
+    class PpmSink : public ImageSink
+    {
+    public:
+        PpmSink(const std::string&, uint32_t, uint32_t, const std::string&, int = -1);
+        void write_rows(const uint8_t*, uint32_t);
+    };
+
+
+#ifdef DZLIB
+    /*
+     * PNG written the way pigz writes gzip: rows are gathered into
+     * chunks that are filtered and deflated on the pool, each with
+     * the end of the previous chunk as its dictionary, and written
+     * out in order as one zlib stream.
+     */
+    class PngSink : public ImageSink
+    {
+    private:
+        typedef struct chunk_t
+        {
+            std::vector<uint8_t> raw;       // context rows, then the chunk's rows
+            uint32_t             y0;        // image row of raw's first row
+            uint32_t             first;     // image row the chunk starts at
+            uint32_t             rows;
+            bool                 last;
+            std::vector<uint8_t> out;       // finished IDAT chunk
+            uint32_t             adler;     // of the chunk's filtered bytes
+            size_t               length;    // filtered bytes
+            pool::JobRef         job;
+        } chunk_t;
+
+        pool::ThreadPool&                    tp;
+        uint32_t                             chunk_rows;
+        uint32_t                             context;   // rows a chunk needs before it
+        uint32_t                             carried;   // of those, at the front of pending
+        uint32_t                             adler;
+        std::vector<uint8_t>                 pending;   // rows not yet in a chunk
+        uint32_t                             queued;    // rows handed to chunks
+        std::deque<std::shared_ptr<chunk_t>> inflight;
+
+        void put_chunk(const char*, const uint8_t*, size_t);
+        void submit(bool);
+        void retire();
+        static void encode(chunk_t&, uint32_t);
+
+    public:
+        PngSink(const std::string&, uint32_t, uint32_t, const std::string&, pool::ThreadPool&, int = -1);
+        ~PngSink();
+
+        bool close();
+        void write_rows(const uint8_t*, uint32_t);
+    };
+#endif
+
+
+    // open a sink of the format the file name asks for, writing to
+    // the descriptor if one is given, NULL when that format isn't
+    // available
+    std::unique_ptr<ImageSink> open(const std::string&, uint32_t, uint32_t,
+                                    const std::string&, pool::ThreadPool&, int = -1);
+}
+
+#endif
+// end
@@ -0,0 +1,150 @@
+/*
+ * iterfile.h
+ *
+ * Iteration files: the per-pixel counts of a render before they
+ * were colored, for recoloring and post-processing. The layout is
+ * made to be mapped rather than read:
+ *
+ *   header     ITER_HEADER_SIZE bytes, an iter_header_t
+ *   index      one iter_tile_t per tile, in row-major tile order
+ *   payload    the tiles, each one row-major and clipped at the
+ *              right and bottom edges of the image
+ *
+ * Values are normalized floats (escaping points in [0, 1], the
+ * inside above 1) or whole uint32 counts, in host byte order. A
+ * tile may be run-length coded as (uint32 run, 4 byte value) pairs
+ * when that's smaller. Any rectangle can be read by touching only
+ * the tiles under it, so cropping a huge frame costs as much as
+ * the crop.
+ */
+#ifndef _ITERFILE_H
+#define _ITERFILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#define ITER_MAGIC        "MITR"
+#define ITER_VERSION      2
+#define ITER_HEADER_SIZE  1024
+
+// payload types
+#define ITER_FLOAT32      0
+#define ITER_UINT32       1
+
+// flags of a tile in the index
+#define ITER_TILE_RLE     1
+
+namespace iterfile
+{
+    typedef struct iter_header_t
+    {
+        char     magic[4];
+        uint32_t version;
+        uint32_t width, height;
+        uint32_t tile;          // edge length of the square tiles
+        uint32_t type;          // ITER_FLOAT32 or ITER_UINT32
+        uint32_t max_iters;
+        uint32_t tiles;         // entries in the index
+        uint64_t index;         // file offset of the index
+        double   center_re, center_im;
+        double   zoom;
+        double   inc_re, inc_im;
+        char     real[96];      // the center exactly as given
+        char     imag[96];
+        char     formula[128];
+        char     comment[128];  // comment line of the image
+    } iter_header_t;
+
+    static_assert(sizeof(iter_header_t) <= ITER_HEADER_SIZE, "iteration file header too large");
+
+    typedef struct iter_tile_t
+    {
+        uint64_t offset;
+        uint32_t bytes;
+        uint32_t flags;
+    } iter_tile_t;
+
+    typedef struct FormatInfo
+    {
+        const char* name;
+        uint32_t    type;
+        bool        rle;
+    } FormatInfo;
+
+    extern const uint32_t   FORMAT_COUNT;
+    extern const FormatInfo all[];
+
+    void print_all();
+
+    // copy a string into a fixed header field, always terminated
+    void set_field(char*, size_t, const std::string&);
+
+
+    /*
+     * Writes the normalized counts of a render as they come out
+     * of it, a tile row at a time; the index is filled in on close
+     */
+    class Writer
+    {
+    private:
+        int      fd;
+        bool     failed;
+        bool     rle;
+        uint32_t rows_written;
+        uint64_t offset;
+        iter_header_t            info;
+        std::vector<iter_tile_t> index;
+        std::vector<float>       pending;   // rows of the unfinished tile row
+        std::string              path;
+
+        void put(const void*, size_t);
+        void flush(uint32_t);
+
+    public:
+        Writer(const std::string&, const iter_header_t&, bool);
+        ~Writer();
+
+        Writer(const Writer&) = delete;
+        Writer& operator=(const Writer&) = delete;
+
+        bool ok() const;
+        bool close();
+        uint64_t bytes_written() const;
+
+        // append `rows` full-width rows of normalized counts
+        void write_rows(const float*, uint32_t);
+    };
+
+
+    /*
+     * A mapped iteration file
+     */
+    class Reader
+    {
+    private:
+        const uint8_t*       base;
+        size_t               length;
+        const iter_header_t* info;
+        const iter_tile_t*   index;
+        std::string          path;
+
+    public:
+        Reader(const std::string&);
+        ~Reader();
+
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+        bool ok() const;
+        const iter_header_t& header() const;
+
+        // normalized counts of the rectangle (x, y, w, h) into rows
+        // of `stride` floats, false when it's outside the image
+        bool read_rect(uint32_t, uint32_t, uint32_t, uint32_t, float*, size_t) const;
+    };
+}
+
+#endif
+// end
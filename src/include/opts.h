@@ -12,6 +12,8 @@
 #include <getopt.h>
 #include <math.h>
 #include <string.h>
+#include <string>
+#include <memory>
 
 // local includes
 #include "resolutions.h"
@@ -22,11 +24,27 @@
 #define DEFAULT_ZOOM           0.5
 #define DEFAULT_RE            -0.7
 #define DEFAULT_IM             0.0
+#define DEFAULT_BAND           64
+#define DEFAULT_ITERS          255
+
+// the Julia constant when none is given
+#define DEFAULT_CR            -0.8
+#define DEFAULT_CI             0.156
 
 // define macros for random value creation
 #define RAND_ZOOM_HIGH        10.0
 #define RANDOM(LOW, HIGH) (LOW + (rand() * (HIGH - LOW)))
 
+namespace stats
+{
+    class Report;
+}
+
+namespace cache
+{
+    class TileCache;
+}
+
 
 namespace opts
 {
@@ -50,20 +68,116 @@ namespace opts
     void print_mandel_info();
     void print_julia_info();
 
+    // whether a center coordinate reads the same in every tier
+    bool decimal(const std::string&);
+
     class Settings
     {
     public:
         // resolution and filename
-        // char* fname;
+        // (an empty fname means the program's default output)
+        std::string fname;
         const reso::rect_t* res;
 
         // program flags
         uint8_t verbose,   random;
 
+        // worker threads used to render (0 picks one per core)
+        // and the height of each streamed band (0 is the whole image)
+        uint32_t threads, band_height;
+
+        // index into strategy::all used to fill in each tile
+        uint32_t strategy;
+
+        // KERNEL_* fast exits enabled for the Mandelbrot kernel
+        uint32_t kernel_flags;
+
+        // index into funcs::all of the Julia formula, or
+        // a user expression in z and c that replaces it
+        uint32_t    function;
+        std::string formula;
+
         // initial real/imag/zoom values
         // real/imag is the center of the fractal
         double init_real, init_imag, zoom;
 
+        // the center exactly as typed, for high precision renders
+        // (empty when the defaults were used)
+        std::string real_str, imag_str;
+
+        // render with perturbation theory around the center
+        uint8_t deep;
+
+        // PRECISION_* tier to iterate in (AUTO picks from the view)
+        uint32_t precision;
+
+        // animation: number of frames (0 renders a single image)
+        // and the zoom of the last one (0 doubles every frame)
+        uint32_t frames;
+        double   zoom_end;
+
+        // resample every frame from one exponential map (log-polar
+        // strip) around the center instead of rendering each one
+        uint8_t  exp_map;
+
+        // directory of the on-disk tile cache (empty disables it)
+        // and its size limit in megabytes
+        std::string cache_dir;
+        uint32_t    cache_mb;
+
+        // the cache kept open across renders by the server, each
+        // render opens its own when it's empty
+        std::shared_ptr<cache::TileCache> tiles;
+
+        // index into colors::all, where to save the normalized
+        // counts of the render, and an iteration file to color
+        // instead of rendering anything
+        uint32_t    colormap;
+        std::string iter_file;
+        std::string recolor;
+
+        // index into iterfile::all of the saved file's layout, and the
+        // rectangle of the saved file to recolor (crop_w 0 is all of it)
+        uint32_t iter_format;
+        uint32_t crop_x, crop_y, crop_w, crop_h;
+
+        // extra samples for each edge pixel (0 turns supersampling
+        // off) and the index into aa::all of the filter combining them
+        uint32_t supersample;
+        uint32_t filter;
+
+        // iterations before a point counts as inside, and the
+        // continuation file the render carries on from and leaves
+        // its unescaped orbits in (empty to start from scratch)
+        uint32_t    max_iters;
+        std::string resume;
+
+        // STATS_* format of the statistics report, and the report
+        // the program's renders are tallied in (NULL when it's off)
+        uint32_t       stats_format;
+        stats::Report* stats;
+
+        // count hardware events of every phase in the report
+        uint8_t counters;
+
+        // render in coarse to fine passes, rewriting the image after
+        // each one, and stop once the budget in milliseconds of
+        // iterating is spent (0 is no limit)
+        uint8_t  progressive;
+        uint32_t budget_ms;
+
+        // serve renders on this localhost port or Unix socket path
+        // instead of rendering once (empty for a single render)
+        std::string serve;
+
+        // a descriptor to stream the image to rather than creating
+        // fname, which then only names it and picks the format
+        // (-1 writes the file)
+        int output_fd;
+
+        // what is being rendered, recorded in iteration files
+        std::string label;
+
         // dimensional spacing values
         // these values determine the range we will render
         double span_x,     span_y;
@@ -81,6 +195,7 @@ namespace opts
         double  seed_cr, seed_ci;
 
         Settings(uint8_t, uint8_t, double, double, double, const reso::rect_t*);
+        void set_zoom(double);
         void display_info();
     };
 
@@ -0,0 +1,61 @@
+/*
+ * perfcount.h
+ *
+ * Hardware performance counters through Linux perf_event_open, for
+ * telling a kernel bound by arithmetic from one stalled on branches
+ * or memory. Every thread that takes a sample opens its own group of
+ * counters on first use, counting only itself in user space; samples
+ * are running totals, so a phase costs the difference of two reads.
+ *
+ * Counters are often missing: no PMU in a VM, perf_event_paranoid
+ * too strict, an event the CPU doesn't have. Events that can't be
+ * opened read as zero and are left out of reports; with none at all
+ * the program carries on with times only.
+ */
+#ifndef _PERFCOUNT_H
+#define _PERFCOUNT_H
+
+#include <stdint.h>
+
+// the events, in the order they're opened (the first that
+// opens leads the group)
+#define PERF_CYCLES        0
+#define PERF_INSTRUCTIONS  1
+#define PERF_BRANCH_MISSES 2
+#define PERF_L1D_MISSES    3
+#define PERF_LLC_MISSES    4
+#define PERF_EVENTS        5
+
+namespace perf
+{
+    typedef struct EventInfo
+    {
+        const char* name;
+        uint32_t    type;       // perf_event_attr type and config
+        uint64_t    config;
+    } EventInfo;
+
+    extern const EventInfo all[];
+
+    /*
+     * Running totals of this thread's events
+     */
+    typedef struct sample_t
+    {
+        uint64_t value[PERF_EVENTS];
+    } sample_t;
+
+    // turn counting on, checking which events this machine has;
+    // false (after a warning) when it has none of them
+    bool start();
+
+    // whether start() found any events, and which (1 << PERF_*)
+    bool     enabled();
+    uint32_t available();
+
+    // the calling thread's totals, all zero when counting is off
+    void read(sample_t&);
+}
+
+#endif
+// end
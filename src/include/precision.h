@@ -0,0 +1,44 @@
+/*
+ * precision.h
+ *
+ * The ladder of numeric types a render can iterate in, from the
+ * cheapest to the most precise. By default the lowest tier whose
+ * mantissa still resolves a pixel at the view's coordinates is
+ * picked; each tier has its own compile-time specialized kernel.
+ */
+#ifndef _PRECISION_H
+#define _PRECISION_H
+
+#include <stdint.h>
+
+#include "opts.h"
+
+// tiers of the ladder, in order of cost (indices into precision::all)
+#define PRECISION_AUTO    0
+#define PRECISION_FLOAT   1
+#define PRECISION_DOUBLE  2
+#define PRECISION_DD      3
+#define PRECISION_MP      4
+
+// bits of the mantissa kept free of rounding noise from the
+// orbit, a tier is only used when a pixel spans at least
+// 2^PRECISION_MARGIN of its ulps
+#define PRECISION_MARGIN  14
+
+namespace precision
+{
+    typedef struct PrecisionInfo
+    {
+        const char* name;
+        uint32_t    bits;   // mantissa bits, 0 when unbounded
+    } PrecisionInfo;
+
+    extern const uint32_t      PRECISION_COUNT;
+    extern const PrecisionInfo all[];
+
+    uint32_t choose(const opts::Settings&);
+    void     print_all();
+}
+
+#endif
+// end
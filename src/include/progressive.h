@@ -0,0 +1,53 @@
+/*
+ * progressive.h
+ *
+ * Coarse to fine rendering for quick previews. The frame is iterated
+ * in the seven interleaved passes of Adam7: one pixel in 64 first,
+ * then the gaps of the 8x8 grid are halved pass by pass until every
+ * pixel is in, and no pixel is ever iterated twice. After each pass
+ * the image is written out whole, every missing pixel taking the
+ * value of the nearest one above and to the left already computed,
+ * so the output file sharpens as the render goes on.
+ *
+ * With a time budget the render stops where the deadline finds it
+ * and the last image written is the best one it got to. The first
+ * pass always finishes, so there's always a whole image. The budget
+ * is iterating time, writing the images in between doesn't count.
+ */
+#ifndef _PROGRESSIVE_H
+#define _PROGRESSIVE_H
+
+#include <stdint.h>
+
+#include "opts.h"
+#include "rendering.h"
+#include "threadpool.h"
+
+#define PROGRESSIVE_PASSES   7
+
+// most samples of a row iterated as one work item, the
+// granularity the deadline is checked at
+#define PROGRESSIVE_SEGMENT  256
+
+namespace progressive
+{
+    /*
+     * The pixels a pass iterates, and the grid that has a
+     * computed pixel at every point once it's done
+     */
+    typedef struct pass_t
+    {
+        uint32_t x0, y0;        // first pixel
+        uint32_t dx, dy;        // steps between its pixels
+        uint32_t gx, gy;        // grid spacing after the pass
+    } pass_t;
+
+    extern const pass_t passes[PROGRESSIVE_PASSES];
+
+    // render the frame of `s` in passes, iterating points of the
+    // plane laid out by `grid` through the kernel
+    int render(opts::Settings&, const opts::Settings&, const render::BatchFunc&, pool::ThreadPool&);
+}
+
+#endif
+// end
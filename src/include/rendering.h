@@ -2,24 +2,183 @@
 #define _RENDERING_H
 
 #include <iostream>
-#include <fstream>
+#include <string>
 #include <functional>
+#include <vector>
+#include <algorithm>
 
 #include "complex.h"
+#include "ddouble.h"
 #include "opts.h"
 #include "functions.h"
+#include "threadpool.h"
+#include "simd.h"
+#include "resume.h"
+#include "iterfile.h"
+
+// constants to use
+// Julia has a higher breakout range than Mandel
+#define M_BREAKOUT 4.0
+#define J_BREAKOUT 100.0
+#define LOG2       0.6931471805599453
+
+// the highest iteration limit: float lanes and the normalized
+// float buffers hold whole counts exactly up to 2^24, and the
+// inside is counted as the limit plus one
+#define ITERS_LIMIT ((1u << 24) - 2)
+
+// edge length of the square tiles handed to the thread pool
+#define TILE_SIZE  64
 
 namespace render
 {
     // A julia function represented as a Lambda type
     typedef std::function<Cmp(Cmp&, const Cmp&)> JFunc;
 
-    
-    std::ofstream* create_image(std::string, opts::Settings&);
-    double iterate_m(Cmp&, const Cmp&);
-    double iterate_j(Cmp&, const Cmp&, const funcs::JFunc_t&);
+    /*
+     * A rectangular region of the output image
+     */
+    typedef struct tile_t
+    {
+        uint32_t x, y;
+        uint32_t w, h;
+    } tile_t;
+
+    // Fills in the normalized counts of one tile; the pointer is the
+    // tile's top left pixel and the stride is the length of a frame row.
+    // With supersampling on, the tile also gets its corner of the band's
+    // overlay (RGB and a flag byte per pixel): colors it sets there
+    // replace the palette's for those pixels. It's NULL otherwise.
+    typedef std::function<void(const tile_t&, float*, uint8_t*, size_t)> TileFunc;
+
+    // Computes the escape counts of n points of the plane
+    // given as separate real and imaginary arrays
+    typedef std::function<void(const double*, const double*, uint32_t, double*)> BatchFunc;
+
+    // Carries on iterating n points of the plane from the orbits
+    // they were left in, up to the render's iteration limit
+    typedef std::function<void(const double*, const double*, uint32_t, resume::orbit_t*)> ResumeFunc;
+
+    std::vector<tile_t> make_tiles(uint32_t, uint32_t, uint32_t);
+    int render_bands(opts::Settings&, const TileFunc&, pool::ThreadPool&);
+    TileFunc shade(const opts::Settings&, const BatchFunc&, const std::string&,
+                   const ResumeFunc& = ResumeFunc());
+    int draw(opts::Settings&, pool::ThreadPool&, const opts::Settings&, const BatchFunc&,
+             const std::string&, const ResumeFunc& = ResumeFunc());
+    void store_tile(const tile_t&, const double*, float*, size_t, uint32_t);
+    BatchFunc mandel_batch(uint32_t, uint32_t, uint32_t);
+    ResumeFunc mandel_resume(uint32_t, uint32_t, uint32_t);
+    BatchFunc offset_batch(const opts::Settings&, uint32_t);
+
+    /*
+     * The leading double of a value, for tests that only need
+     * to be as precise as a double
+     */
+    template<typename T>
+    inline double lead(const T& v)       { return double(v); }
+    inline double lead(const DDouble& v) { return v.hi; }
+
+
+    /*
+     * Iterate a given point z with constant C
+     * to create the Mandelbrot set (z^2 + c)
+     * The flags enable the same fast exits as simd::iterate_m
+     * (only valid when z starts at zero)
+     */
+    template<typename T>
+    inline double iterate_m(Complex<T>& z, const Complex<T>& c, uint32_t limit, uint32_t flags = 0)
+    {
+        double count = 0.0;
+
+        if(flags & KERNEL_CARDIOID)
+        {
+            double xq = lead(c.real) - 0.25;
+            double y2 = lead(c.imag) * lead(c.imag);
+            double q  = (xq * xq) + y2;
+            double xb = lead(c.real) + 1.0;
+            if((q * (q + xq)) < (y2 * 0.25) || ((xb * xb) + y2) < 0.0625)
+                return limit + 1.0;
+        }
+
+        Complex<T> saved = z;
+        uint32_t   check = 1;
+
+        while(z.length2() < M_BREAKOUT && count++ < limit)
+        {
+            z.mul(z);
+            z.add(c);
+
+            // Brent cycle detection, an exact repeat never escapes
+            if(flags & KERNEL_PERIODIC)
+            {
+                if(z.real == saved.real && z.imag == saved.imag)
+                {
+                    simd::ran += uint64_t(count);
+                    return limit + 1.0;
+                }
+                if(uint32_t(count) == check)
+                {
+                    saved = z;
+                    check <<= 1;
+                }
+            }
+        }
+
+        simd::ran += uint64_t(std::min(count, double(limit)));
+        return count;
+    }
+
+
+    /*
+     * Iterate a given z-point with constant C
+     * and a Julia formula F (one of funcs::ZPow)
+     */
+    template<typename F, typename T>
+    inline double iterate_j(Complex<T>& z, const Complex<T>& c, uint32_t limit)
+    {
+        double count = 0.0;
+
+        while(z.length2() < J_BREAKOUT && count++ < limit)
+        {
+            F::step(z, c);
+        }
+
+        simd::ran += uint64_t(std::min(count, double(limit)));
+        return count;
+    }
+
+
+    /*
+     * A batch of Julia points under formula F, matching
+     * funcs::JBatch_t so the table can hold one per formula
+     */
+    template<typename F>
+    void iterate_j(const Cmp& c, const double* zr, const double* zi, uint32_t n, double* out, uint32_t limit)
+    {
+        for(uint32_t k=0; k < n; k++)
+        {
+            Cmp z(zr[k], zi[k]);
+            out[k] = iterate_j<F>(z, c, limit);
+        }
+    }
+
+
+    std::string image_comment(const opts::Settings&);
+    std::string center_str(const std::string&, double);
+    iterfile::iter_header_t iter_header(const opts::Settings&, uint32_t);
+#ifdef DGMP
+    double iterate_m(MpCmp&, const MpCmp&, uint32_t);
+    double iterate_j(MpCmp&, const MpCmp&, uint32_t, uint32_t);
+#endif
+    opts::Settings centered(const opts::Settings&);
     int mandelbrot(opts::Settings&);
+    int mandelbrot_frame(opts::Settings&, pool::ThreadPool&);
+    int mandelbrot_deep(opts::Settings&, pool::ThreadPool&);
+    int mandelbrot_dd(opts::Settings&, pool::ThreadPool&);
+    int mandelbrot_gmp(opts::Settings&, pool::ThreadPool&);
     int julia(opts::Settings&);
+    int julia_frame(opts::Settings&, pool::ThreadPool&);
+    int recolor(opts::Settings&, pool::ThreadPool&);
 }
 
 #endif
@@ -0,0 +1,155 @@
+/*
+ * resume.h
+ *
+ * Continuation files: the state of every pixel at the end of a
+ * render, so a later render of the same view at a higher iteration
+ * limit only carries on the pixels that hadn't escaped yet instead
+ * of starting the frame over. The layout follows the render:
+ *
+ *   header     RESUME_HEADER_SIZE bytes, a resume_header_t
+ *   payload    the tiles in the order they finished, each one a
+ *              code per pixel (row-major, padded to 8 bytes)
+ *              followed by an orbit_t for every pixel still
+ *              running, in pixel order
+ *   index      one resume_tile_t per tile
+ *
+ * A pixel's code is its escape count, or RESUME_INSIDE when it was
+ * proven never to escape, or RESUME_RUNNING when it's bounded so
+ * far and has an orbit to carry on from.
+ */
+#ifndef _RESUME_H
+#define _RESUME_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+
+#define RESUME_MAGIC        "MRES"
+#define RESUME_VERSION      1
+#define RESUME_HEADER_SIZE  1024
+
+// pixel codes above any escape count
+#define RESUME_RUNNING      0xfffffffeu
+#define RESUME_INSIDE       0xffffffffu
+
+// states of an orbit
+#define ORBIT_RUNNING       0   // bounded so far, can carry on
+#define ORBIT_ESCAPED       1
+#define ORBIT_INSIDE        2   // proven never to escape
+
+namespace resume
+{
+    /*
+     * Where one pixel's iteration stands
+     */
+    typedef struct orbit_t
+    {
+        double   zr, zi;    // z after n iterations, or the delta
+                            // from the reference for perturbation
+        uint32_t n;         // iterations done, the escape count once escaped
+        uint32_t m;         // perturbation: index into the reference orbit
+        uint32_t state;     // ORBIT_*
+        uint32_t pad;
+    } orbit_t;
+
+    typedef struct resume_header_t
+    {
+        char     magic[4];
+        uint32_t version;
+        uint32_t width, height;
+        uint32_t band;          // band height the tiles were cut with
+        uint32_t limit;         // iteration limit the pixels were left at
+        uint32_t tiles;         // entries in the index
+        uint32_t running;       // pixels still running
+        uint64_t index;         // file offset of the index
+        uint64_t view_hash;     // of the whole view description
+        char     view[512];     // the start of it, for messages
+    } resume_header_t;
+
+    static_assert(sizeof(resume_header_t) <= RESUME_HEADER_SIZE, "continuation file header too large");
+
+    typedef struct resume_tile_t
+    {
+        uint32_t x, y, w, h;
+        uint32_t running;       // orbits after the codes
+        uint32_t pad;
+        uint64_t offset;
+    } resume_tile_t;
+
+    // a header for the view described by the string
+    resume_header_t header(const std::string&, uint32_t, uint32_t, uint32_t, uint32_t);
+
+
+    /*
+     * Collects tiles from every worker as they finish. The file
+     * is written next to its final name and only moved over it
+     * once every tile is in, so an interrupted render leaves the
+     * previous file untouched.
+     */
+    class Writer
+    {
+    private:
+        int         fd;
+        bool        failed;
+        bool        verbose;
+        uint32_t    expected;
+        uint64_t    offset;
+        std::string path, part;
+        std::mutex  lock;
+        resume_header_t            info;
+        std::vector<resume_tile_t> index;
+
+        void put(const void*, size_t);
+
+    public:
+        Writer(const std::string&, const resume_header_t&, uint32_t, bool);
+        ~Writer();
+
+        Writer(const Writer&) = delete;
+        Writer& operator=(const Writer&) = delete;
+
+        bool ok() const;
+        bool close();
+        uint64_t bytes_written() const;
+
+        // add the finished tile (x, y, w, h): its pixel codes
+        // and the orbits of its running pixels
+        void put_tile(uint32_t, uint32_t, uint32_t, uint32_t,
+                      const uint32_t*, const orbit_t*, uint32_t);
+    };
+
+
+    /*
+     * A mapped continuation file
+     */
+    class Reader
+    {
+    private:
+        const uint8_t*         base;
+        size_t                 length;
+        const resume_header_t* info;
+        std::string            path;
+        std::unordered_map<uint64_t, const resume_tile_t*> tiles;
+
+    public:
+        Reader(const std::string&);
+        ~Reader();
+
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+        bool ok() const;
+        const resume_header_t& header() const;
+
+        // the codes and orbits of the tile (x, y, w, h),
+        // false when the file doesn't hold that tile
+        bool tile(uint32_t, uint32_t, uint32_t, uint32_t,
+                  const uint32_t**, const orbit_t**) const;
+    };
+}
+
+#endif
+// end
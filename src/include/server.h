@@ -0,0 +1,58 @@
+/*
+ * server.h
+ *
+ * A long running render server for --serve. The process keeps one
+ * thread pool (and the tile cache, when one is set) warm across
+ * renders and takes requests as HTTP/1.0 GETs, on a localhost port
+ * or on a Unix socket:
+ *
+ *   GET /mandelbrot?re=-0.743&im=0.131&zoom=200&size=720p&iters=1000
+ *   GET /julia?c=-0.4,0.6&function=z^3%2Bc&format=png
+ *
+ * Anything a request leaves out comes from the server's own command
+ * line. Each request gets a thread of its own that streams the image
+ * back band by band as it's rendered, with no file in between. The
+ * renders share the pool, and since each one only keeps a window of
+ * bands queued the workers take turns between them: a big render
+ * that started first can't hold back a small one.
+ */
+#ifndef _SERVER_H
+#define _SERVER_H
+
+#include <stdint.h>
+
+#include "opts.h"
+
+// requests rendered at once, any more are turned away with a 503
+#define SERVER_CLIENTS   16
+
+// longest request line and headers, in bytes
+#define SERVER_HEAD      8192
+
+// seconds a client gets to send its request, and that a write
+// to it may block before the render is given up
+#define SERVER_TIMEOUT   10
+
+namespace server
+{
+    /*
+     * A query parameter of a render request
+     */
+    typedef struct ParamInfo
+    {
+        const char* name;
+        const char* help;
+    } ParamInfo;
+
+    extern const uint32_t  PARAM_COUNT;
+    extern const ParamInfo params[];
+
+    void print_all();
+
+    // serve renders until interrupted, on the address in the
+    // settings, which also hold every request's defaults
+    int run(opts::Settings&);
+}
+
+#endif
+// end
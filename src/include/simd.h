@@ -0,0 +1,49 @@
+/*
+ * simd.h
+ *
+ * Vectorized escape-time kernels. A batch of points is iterated
+ * several lanes at a time (2 for SSE2, 4 for AVX2, 8 for AVX-512,
+ * twice as many with float lanes);
+ * lanes are masked out as they escape and the widest instruction
+ * set the CPU supports is picked once at runtime.
+ */
+#ifndef _SIMD_H
+#define _SIMD_H
+
+#include <stdint.h>
+
+#include "resume.h"
+
+// fast exits for the Mandelbrot kernel, or'd together
+// CARDIOID skips points inside the main cardioid and period-2 bulb
+// PERIODIC stops iterating orbits that have settled into a cycle
+#define KERNEL_CARDIOID   1
+#define KERNEL_PERIODIC   2
+
+namespace simd
+{
+    // Iterates z^2 + c from z = 0 for n points (cr[i], ci[i]) up to
+    // the limit (the last argument) and stores the escape counts,
+    // matching render::iterate_m exactly
+    typedef void (*MandelRow_t)(const double*, const double*, uint32_t, double*, uint32_t, uint32_t);
+
+    // Carries on n running orbits of z^2 + c up to the limit,
+    // updating each one in place
+    typedef void (*ResumeRow_t)(const double*, const double*, uint32_t, resume::orbit_t*, uint32_t, uint32_t);
+
+    void        iterate_m(const double*, const double*, uint32_t, double*, uint32_t, uint32_t);
+    void        resume_m(const double*, const double*, uint32_t, resume::orbit_t*, uint32_t, uint32_t);
+
+    // the same iterations with float lanes, twice as wide
+    // (only accurate for views a float can resolve)
+    void        iterate_mf(const double*, const double*, uint32_t, double*, uint32_t, uint32_t);
+    void        resume_mf(const double*, const double*, uint32_t, resume::orbit_t*, uint32_t, uint32_t);
+    const char* isa_name();
+
+    // iterations the kernels have run on the calling thread; points
+    // settled by a fast exit without iterating add nothing
+    extern thread_local uint64_t ran;
+}
+
+#endif
+// end
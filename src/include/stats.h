@@ -0,0 +1,159 @@
+/*
+ * stats.h
+ *
+ * Render statistics for --stats: where the time of a render went,
+ * phase by phase and thread by thread, and what its pixels cost.
+ * Counters are tallied once per tile or band and summed with
+ * relaxed atomics, a few operations per pixel next to hundreds of
+ * iterations, so they're cheap enough to leave on. The report is
+ * printed when the last render of the program is done. With
+ * hardware counters on, each phase also gets the events counted
+ * on the threads that ran it.
+ */
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <memory>
+
+#include "perfcount.h"
+
+// report formats
+#define STATS_OFF      0
+#define STATS_TABLE    1
+#define STATS_JSON     2
+
+// phases of a render
+#define PHASE_SETUP    0    // reference orbits, caches and output files
+#define PHASE_COMPUTE  1    // tile functions, summed over the workers
+#define PHASE_WAIT     2    // the writer waiting for bands to finish
+#define PHASE_COLOR    3
+#define PHASE_OUTPUT   4
+#define PHASE_COUNT    5
+
+// histogram buckets of escape counts, [2^b, 2^(b+1)) up to 2^24
+#define STATS_BUCKETS  25
+
+namespace stats
+{
+    typedef struct FormatInfo
+    {
+        const char* name;
+        uint32_t    format;
+    } FormatInfo;
+
+    extern const uint32_t   FORMAT_COUNT;
+    extern const FormatInfo all[];
+
+    void print_all();
+
+    // seconds on a monotonic clock, and of CPU used by this thread
+    double wall();
+    double cpu();
+
+    /*
+     * Where the calling thread stands, a phase costs the
+     * difference of two of these
+     */
+    typedef struct stamp_t
+    {
+        double         wall, cpu;
+        uint64_t       ran;
+        perf::sample_t events;
+    } stamp_t;
+
+    stamp_t now();
+
+    typedef struct tile_stat_t
+    {
+        uint32_t frame;
+        uint32_t x, y, w, h;
+        uint64_t iterations;
+        double   seconds;
+    } tile_stat_t;
+
+
+    /*
+     * The counters of every render in the program
+     */
+    class Report
+    {
+    private:
+        uint32_t format;
+        uint32_t threads;
+        double   start_wall, start_cpu;
+
+        std::atomic<uint64_t> wall_ns[PHASE_COUNT], cpu_ns[PHASE_COUNT];
+        std::atomic<uint64_t> counted[PHASE_COUNT][PERF_EVENTS];
+        std::atomic<uint64_t> escaped, inside, iterations;
+        std::atomic<uint64_t> histogram[STATS_BUCKETS];
+        std::unique_ptr<std::atomic<uint64_t>[]> busy;
+
+        // open phases of the main thread
+        stamp_t marks[PHASE_COUNT];
+        bool    opened[PHASE_COUNT];
+
+        std::mutex                                     lock;
+        std::vector<tile_stat_t>                       tiles;
+        std::vector<std::pair<std::string, uint64_t>>  files;
+
+        void print_table();
+        void print_counters();
+        void print_json();
+
+    public:
+        std::atomic<uint32_t> frames;
+
+        Report(uint32_t, uint32_t);
+        ~Report();
+
+        Report(const Report&) = delete;
+        Report& operator=(const Report&) = delete;
+
+        // a phase spanning several functions on the main thread
+        void begin(uint32_t);
+        void end(uint32_t);
+
+        // add the cost of a phase since the stamp
+        void add(uint32_t, const stamp_t&);
+
+        // tally a finished tile of normalized counts (x, y, w, h,
+        // rows of `stride` floats, the limit), rendered by worker
+        // `id` since the stamp; its iterations are the ones the
+        // kernels ran, not the sum of the counts
+        void tile(uint32_t, uint32_t, uint32_t, uint32_t, uint32_t,
+                  const float*, size_t, uint32_t, const stamp_t&);
+
+        // bytes that went into a file of the given kind
+        void wrote(const std::string&, uint64_t);
+
+        // iterations run so far; a report in STATS_OFF only counts,
+        // for callers that read it themselves
+        uint64_t ran() const;
+    };
+
+
+    /*
+     * Adds the time until it goes out of scope to a phase,
+     * does nothing without a report
+     */
+    class Timer
+    {
+    private:
+        Report*  report;
+        uint32_t phase;
+        stamp_t  since;
+
+    public:
+        Timer(Report*, uint32_t);
+        ~Timer();
+    };
+}
+
+#endif
+// end
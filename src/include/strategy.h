@@ -0,0 +1,37 @@
+/*
+ * strategy.h
+ *
+ * Strategies for filling in the escape counts of a tile.
+ * `scan` iterates every pixel, `mariani` uses Mariani-Silver
+ * rectangle subdivision to skip regions with a uniform border.
+ */
+#ifndef _STRATEGY_H
+#define _STRATEGY_H
+
+#include "opts.h"
+#include "rendering.h"
+
+namespace strategy
+{
+    // signature shared by all strategies; counts are stored
+    // row-major with a stride of the tile's width
+    typedef void (*Strategy_t)(const opts::Settings&, const render::tile_t&,
+                               const render::BatchFunc&, double*);
+
+    typedef struct StrategyInfo
+    {
+        const char*      name;
+        const Strategy_t func;
+    } StrategyInfo;
+
+    extern const uint32_t     STRATEGY_COUNT;
+    extern const StrategyInfo all[];
+
+    void scan(const opts::Settings&, const render::tile_t&, const render::BatchFunc&, double*);
+    void mariani(const opts::Settings&, const render::tile_t&, const render::BatchFunc&, double*);
+
+    void print_all();
+}
+
+#endif
+// end
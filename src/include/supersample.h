@@ -0,0 +1,63 @@
+/*
+ * supersample.h
+ *
+ * Adaptive antialiasing. A tile is first rendered at one sample
+ * per pixel; pixels whose color stands out from any of their eight
+ * neighbors are on an edge and get extra jittered samples, which
+ * are colored and combined through a reconstruction filter. Flat
+ * regions, which are most of any image, cost nothing extra.
+ */
+#ifndef _SUPERSAMPLE_H
+#define _SUPERSAMPLE_H
+
+#include <stdint.h>
+#include <atomic>
+
+#include "opts.h"
+#include "colors.h"
+#include "rendering.h"
+
+// summed RGB difference from a neighbor that marks an edge pixel
+#define AA_CONTRAST  32
+
+namespace aa
+{
+    // weight of a sample at (dx, dy) pixels from the pixel's center
+    typedef double (*Weight_t)(double, double);
+
+    typedef struct FilterInfo
+    {
+        const char*    name;
+        double         radius;  // samples are spread over [-radius, radius]^2
+        const Weight_t weight;
+    } FilterInfo;
+
+    extern const uint32_t   FILTER_COUNT;
+    extern const FilterInfo all[];
+
+    double box(double, double);
+    double gaussian(double, double);
+    void   print_all();
+
+    /*
+     * Pixels seen and pixels refined over a render,
+     * reported when the last tile function lets go of it
+     */
+    class Tally
+    {
+    public:
+        std::atomic<uint64_t> pixels, edges;
+        bool                  verbose;
+
+        Tally(bool);
+        ~Tally();
+    };
+
+    // refine the edge pixels of a tile whose 1 sample per pixel
+    // counts are done, writing their colors to the overlay
+    void refine(const opts::Settings&, const render::tile_t&, const render::BatchFunc&,
+                const double*, const colors::Palette&, uint8_t*, size_t, Tally&);
+}
+
+#endif
+// end
@@ -0,0 +1,87 @@
+/*
+ * threadpool.h
+ *
+ * A small work-stealing thread pool used to spread the rendering
+ * of tiles across every core on the machine. Each worker owns a
+ * deque of work items; it pops from the front of its own deque and
+ * steals from the back of the others when it runs dry.
+ */
+#ifndef _THREADPOOL_H
+#define _THREADPOOL_H
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace pool
+{
+    // A task receives the index of the work item and the id of the
+    // worker executing it (useful for per-thread scratch buffers)
+    typedef std::function<void(uint32_t, uint32_t)> Task;
+
+    /*
+     * A batch of work items submitted as one unit.
+     * The submitter holds on to the Job and waits on it.
+     */
+    class Job
+    {
+    public:
+        Task                    task;
+        std::atomic<uint32_t>   remaining;
+        std::mutex              lock;
+        std::condition_variable done;
+
+        Job(const Task&, uint32_t);
+    };
+
+    typedef std::shared_ptr<Job> JobRef;
+
+    /*
+     * One unit of work sitting in a worker's deque
+     */
+    typedef struct item_t
+    {
+        JobRef   job;
+        uint32_t index;
+    } item_t;
+
+    class ThreadPool
+    {
+    private:
+        uint32_t                         nthreads;
+        std::vector<std::thread>         workers;
+        std::vector<std::deque<item_t>>  queues;
+        std::vector<std::mutex*>         qlocks;
+
+        // global sleep/wake state for idle workers
+        std::mutex                       idle_lock;
+        std::condition_variable          wake;
+        uint64_t                         pending;
+        bool                             stopping;
+
+        bool take(uint32_t, item_t&);
+        void work(uint32_t);
+
+    public:
+        ThreadPool(uint32_t);
+        ~ThreadPool();
+
+        uint32_t size() const;
+
+        // asynchronous submit/wait pair, and a blocking shorthand
+        JobRef submit(uint32_t, const Task&);
+        void   wait(const JobRef&);
+        void   run(uint32_t, const Task&);
+    };
+
+    uint32_t default_threads();
+}
+
+#endif
+// end
@@ -0,0 +1,393 @@
+/*
+ * iterfile.cpp
+ *
+ * Writing and mapping iteration files. The writer only ever holds
+ * one row of tiles: rows arrive from the renderer in order, and
+ * once a tile row is complete its tiles are coded and appended.
+ * The index sits right after the header at a size known up front,
+ * so it's reserved on open and written in place on close.
+ */
+
+#include <iostream>
+#include <cmath>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "include/iterfile.h"
+
+namespace iterfile
+{
+    const FormatInfo all[] =
+    {
+        {"float",      ITER_FLOAT32, false},
+        {"uint32",     ITER_UINT32,  false},
+        {"float-rle",  ITER_FLOAT32, true},
+        {"uint32-rle", ITER_UINT32,  true},
+    };
+    const uint32_t FORMAT_COUNT = sizeof(all) / sizeof(all[0]);
+
+
+    void print_all()
+    {
+        std::cout << "Iteration file formats available: " << std::endl;
+        for(uint32_t k=0; k < FORMAT_COUNT; k++)
+            std::cout << " -- " << all[k].name << std::endl;
+    }
+
+
+    void set_field(char* field, size_t size, const std::string& value)
+    {
+        memset(field, 0, size);
+        strncpy(field, value.c_str(), size - 1);
+    }
+
+
+    /*
+     * Open the file and reserve the header and index
+     */
+    Writer::Writer(const std::string& p, const iter_header_t& hdr, bool code)
+    {
+        path         = p;
+        info         = hdr;
+        rle          = code;
+        failed       = false;
+        rows_written = 0;
+
+        memcpy(info.magic, ITER_MAGIC, 4);
+        info.version = ITER_VERSION;
+        info.index   = ITER_HEADER_SIZE;
+        info.tiles   = ((info.width + info.tile - 1) / info.tile)
+                     * ((info.height + info.tile - 1) / info.tile);
+
+        index.assign(info.tiles, iter_tile_t{0, 0, 0});
+        pending.reserve(size_t(info.width) * info.tile);
+        offset = info.index + (uint64_t(info.tiles) * sizeof(iter_tile_t));
+
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0)
+        {
+            std::cerr << "Error: cannot open " << path << ": " << strerror(errno) << std::endl;
+            failed = true;
+            return;
+        }
+
+        std::vector<uint8_t> blank(offset, 0);
+        put(blank.data(), blank.size());
+    }
+
+
+    Writer::~Writer()
+    {
+        close();
+    }
+
+
+    /*
+     * Append everything, retrying short writes
+     */
+    void Writer::put(const void* data, size_t len)
+    {
+        const uint8_t* p = (const uint8_t*)data;
+        while(len > 0 && !failed)
+        {
+            ssize_t n = ::write(fd, p, len);
+            if(n < 0)
+            {
+                if(errno == EINTR)
+                    continue;
+                std::cerr << "Error: writing " << path << ": " << strerror(errno) << std::endl;
+                failed = true;
+                return;
+            }
+            p   += n;
+            len -= n;
+        }
+    }
+
+
+    void Writer::write_rows(const float* data, uint32_t rows)
+    {
+        size_t w = info.width;
+
+        while(rows > 0 && !failed)
+        {
+            uint32_t have = pending.size() / w;
+            uint32_t take = std::min(rows, info.tile - have);
+
+            pending.insert(pending.end(), data, data + (w * take));
+            data += w * take;
+            rows -= take;
+            have += take;
+
+            if(have == info.tile || rows_written + have == info.height)
+                flush(have);
+        }
+    }
+
+
+    /*
+     * Code and append the tiles of the pending tile row
+     */
+    void Writer::flush(uint32_t rows)
+    {
+        uint32_t across = (info.width + info.tile - 1) / info.tile;
+        uint32_t first  = (rows_written / info.tile) * across;
+
+        std::vector<uint32_t> raw, coded;
+        for(uint32_t tx=0; tx < across; tx++)
+        {
+            uint32_t x0 = tx * info.tile;
+            uint32_t tw = std::min(info.tile, info.width - x0);
+
+            // the tile's values as stored, bit patterns of either type
+            raw.resize(size_t(tw) * rows);
+            for(uint32_t y=0; y < rows; y++)
+                for(uint32_t x=0; x < tw; x++)
+                {
+                    float    v = pending[(size_t(y) * info.width) + x0 + x];
+                    uint32_t bits;
+                    if(info.type == ITER_UINT32)
+                        bits = (v > 1.0f) ? info.max_iters + 1 : uint32_t(lrintf(v * info.max_iters));
+                    else
+                        memcpy(&bits, &v, 4);
+                    raw[(size_t(y) * tw) + x] = bits;
+                }
+
+            iter_tile_t& e = index[first + tx];
+            e.offset = offset;
+            e.flags  = 0;
+
+            const uint32_t* out   = raw.data();
+            size_t          bytes = raw.size() * 4;
+
+            // runs only when they save space
+            if(rle)
+            {
+                coded.clear();
+                for(size_t k=0; k < raw.size() && coded.size() * 4 < bytes; )
+                {
+                    size_t end = k + 1;
+                    while(end < raw.size() && raw[end] == raw[k])
+                        end++;
+                    coded.push_back(uint32_t(end - k));
+                    coded.push_back(raw[k]);
+                    k = end;
+                }
+                if(coded.size() * 4 < bytes)
+                {
+                    out     = coded.data();
+                    bytes   = coded.size() * 4;
+                    e.flags = ITER_TILE_RLE;
+                }
+            }
+
+            e.bytes = bytes;
+            put(out, bytes);
+            offset += bytes;
+        }
+
+        rows_written += rows;
+        pending.clear();
+    }
+
+
+    /*
+     * Fill in the index and header, returns false if anything
+     * went wrong or the file was left incomplete
+     */
+    bool Writer::close()
+    {
+        if(fd < 0)
+            return !failed;
+
+        if(!failed && rows_written != info.height)
+        {
+            std::cerr << "Error: " << path << " is incomplete ("
+                      << rows_written << "/" << info.height << " rows)" << std::endl;
+            failed = true;
+        }
+
+        if(!failed)
+        {
+            size_t ilen = index.size() * sizeof(iter_tile_t);
+            std::vector<uint8_t> hdr(ITER_HEADER_SIZE, 0);
+            memcpy(hdr.data(), &info, sizeof(info));
+
+            if(::pwrite(fd, hdr.data(), hdr.size(), 0) != ssize_t(hdr.size())
+               || ::pwrite(fd, index.data(), ilen, info.index) != ssize_t(ilen))
+            {
+                std::cerr << "Error: writing " << path << ": " << strerror(errno) << std::endl;
+                failed = true;
+            }
+        }
+
+        if(::close(fd) != 0)
+            failed = true;
+        fd = -1;
+        return !failed;
+    }
+
+
+    bool Writer::ok() const
+    {
+        return !failed;
+    }
+
+
+    uint64_t Writer::bytes_written() const
+    {
+        return offset;
+    }
+
+
+    /*
+     * Map the file and check the header and index fit in it;
+     * tiles are checked as they're read
+     */
+    Reader::Reader(const std::string& p)
+    {
+        path   = p;
+        base   = NULL;
+        length = 0;
+        info   = NULL;
+        index  = NULL;
+
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0)
+        {
+            std::cerr << "Error: cannot open " << path << ": " << strerror(errno) << std::endl;
+            return;
+        }
+
+        struct stat st;
+        if(::fstat(fd, &st) == 0 && size_t(st.st_size) >= ITER_HEADER_SIZE)
+        {
+            void* m = ::mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if(m != MAP_FAILED)
+            {
+                base   = (const uint8_t*)m;
+                length = st.st_size;
+            }
+        }
+        ::close(fd);
+
+        const iter_header_t* h = (const iter_header_t*)base;
+        if(base == NULL || memcmp(h->magic, ITER_MAGIC, 4) != 0 || h->version != ITER_VERSION)
+        {
+            std::cerr << "Error: " << path << " is not an iteration file" << std::endl;
+            return;
+        }
+
+        uint64_t across = (uint64_t(h->width) + h->tile - 1) / std::max(h->tile, 1u);
+        uint64_t down   = (uint64_t(h->height) + h->tile - 1) / std::max(h->tile, 1u);
+        if(h->tile == 0 || h->width == 0 || h->height == 0 || h->tiles != across * down
+           || h->index + (uint64_t(h->tiles) * sizeof(iter_tile_t)) > length)
+        {
+            std::cerr << "Error: " << path << " has a broken header" << std::endl;
+            return;
+        }
+
+        info  = h;
+        index = (const iter_tile_t*)(base + h->index);
+    }
+
+
+    Reader::~Reader()
+    {
+        if(base != NULL)
+            ::munmap((void*)base, length);
+    }
+
+
+    bool Reader::ok() const
+    {
+        return info != NULL;
+    }
+
+
+    const iter_header_t& Reader::header() const
+    {
+        return *info;
+    }
+
+
+    bool Reader::read_rect(uint32_t x, uint32_t y, uint32_t w, uint32_t h, float* out, size_t stride) const
+    {
+        if(info == NULL || w == 0 || h == 0
+           || uint64_t(x) + w > info->width || uint64_t(y) + h > info->height)
+            return false;
+
+        uint32_t ts     = info->tile;
+        uint32_t across = (info->width + ts - 1) / ts;
+
+        std::vector<uint32_t> decoded;
+        for(uint32_t ty = y / ts; ty <= (y + h - 1) / ts; ty++)
+            for(uint32_t tx = x / ts; tx <= (x + w - 1) / ts; tx++)
+            {
+                const iter_tile_t& e = index[(ty * across) + tx];
+
+                uint32_t x0 = tx * ts, y0 = ty * ts;
+                uint32_t tw = std::min(ts, info->width - x0);
+                uint32_t th = std::min(ts, info->height - y0);
+                size_t   n  = size_t(tw) * th;
+
+                if(e.offset + e.bytes > length)
+                {
+                    std::cerr << "Error: " << path << " is truncated" << std::endl;
+                    return false;
+                }
+
+                // raw tiles are read straight from the mapping
+                const uint8_t* src = base + e.offset;
+                if(e.flags & ITER_TILE_RLE)
+                {
+                    decoded.clear();
+                    for(size_t k=0; k + 8 <= e.bytes && decoded.size() < n; k += 8)
+                    {
+                        uint32_t pair[2];
+                        memcpy(pair, src + k, 8);
+                        decoded.insert(decoded.end(), std::min(size_t(pair[0]), n - decoded.size()), pair[1]);
+                    }
+                    if(decoded.size() != n)
+                    {
+                        std::cerr << "Error: " << path << " has a broken tile" << std::endl;
+                        return false;
+                    }
+                    src = (const uint8_t*)decoded.data();
+                }
+                else if(e.bytes != n * 4)
+                {
+                    std::cerr << "Error: " << path << " has a broken tile" << std::endl;
+                    return false;
+                }
+
+                // the part of this tile inside the rectangle
+                uint32_t cx0 = std::max(x, x0), cx1 = std::min(x + w, x0 + tw);
+                uint32_t cy0 = std::max(y, y0), cy1 = std::min(y + h, y0 + th);
+                for(uint32_t py = cy0; py < cy1; py++)
+                {
+                    const uint8_t* row = src + ((size_t(py - y0) * tw) + (cx0 - x0)) * 4;
+                    float*         dst = out + (size_t(py - y) * stride) + (cx0 - x);
+                    uint32_t       cnt = cx1 - cx0;
+
+                    if(info->type == ITER_FLOAT32)
+                        memcpy(dst, row, size_t(cnt) * 4);
+                    else
+                        for(uint32_t k=0; k < cnt; k++)
+                        {
+                            uint32_t v;
+                            memcpy(&v, row + (size_t(k) * 4), 4);
+                            dst[k] = float(double(v) / info->max_iters);
+                        }
+                }
+            }
+
+        return true;
+    }
+}
+
+// end
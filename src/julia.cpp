@@ -15,9 +15,7 @@ int main(int argc, char** argv)
 {
     srand(time(0));
     opts::Settings rs = opts::jparse(argc, argv);
-    render::julia(rs);
-    
-    return 0;
+    return render::julia(rs);
 }
 
 // end
@@ -4,12 +4,12 @@
 #include "include/complex.h"
 #include "include/rendering.h"
 #include "include/opts.h"
+#include "include/server.h"
 
 
 // use GMP soon for ultra precision
 //#include <gmp.h>
 
-#define MAX_ITERS   255.0
 #define THRESHOLD   4.0
 #define LOG2        0.6931471805599453
 
@@ -22,9 +22,9 @@ int main(int argc, char **argv)
     srand(time(0));
     opts::Settings rs = opts::mparse(argc, argv);
 
-    render::mandelbrot(rs);
-
-    return 0;
+    if(!rs.serve.empty())
+        return server::run(rs);
+    return render::mandelbrot(rs);
 }
 
 // end
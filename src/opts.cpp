@@ -1,13 +1,24 @@
 #include <iostream>
+#include <cctype>
 #include "include/opts.h"
 #include "include/resolutions.h"
 #include "include/colors.h"
+#include "include/strategy.h"
+#include "include/simd.h"
+#include "include/precision.h"
+#include "include/functions.h"
+#include "include/expr.h"
+#include "include/cache.h"
+#include "include/iterfile.h"
+#include "include/supersample.h"
+#include "include/stats.h"
+#include "include/progressive.h"
 
 namespace opts
 {
     // adjust these when you add more commands
-    const uint32_t  M_COMMANDS = 10;
-    const uint32_t  J_COMMANDS = 11;
+    const uint32_t  M_COMMANDS = 36;
+    const uint32_t  J_COMMANDS = 29;
     const uint32_t ASCII_LINES = 9;
 
 
@@ -43,16 +54,42 @@ namespace opts
 
     /*
     * getopt_long arguments
-    * 0 - no_arg, 1 - mandatory, 2 - arg required
+    * 0 - no_arg, 1 - required, 2 - optional (only taken as --name=value)
     */
     const struct option mlong_opts[] =
     {
-        {"size",    2,    0, 's'},
-        {"real",    2,    0, 'x'},
-        {"imag",    2,    0, 'y'},
-        {"output",  2,    0, 'o'},
-        {"colors",  2,    0, 'c'},
-        {"zoom",    2,    0, 'z'},
+        {"size",    1,    0, 's'},
+        {"real",    1,    0, 'x'},
+        {"imag",    1,    0, 'y'},
+        {"output",  1,    0, 'o'},
+        {"colors",  1,    0, 'c'},
+        {"zoom",    1,    0, 'z'},
+        {"threads", 1,    0, 't'},
+        {"band",    1,    0, 'b'},
+        {"strategy",1,    0, 'm'},
+        {"no-cardioid", 0, 0, 'K'},
+        {"periodicity", 0, 0, 'P'},
+        {"deep",    0,    0, 'd'},
+        {"gmp",     0,    0, 'g'},
+        {"precision", 1,  0, 'p'},
+        {"frames",  1,    0, 'n'},
+        {"zoom-end", 1,   0, 'e'},
+        {"exp-map", 0,    0, 'L'},
+        {"cache",   1,    0, 'C'},
+        {"cache-size", 1, 0, 'S'},
+        {"save-iters", 1, 0, 'I'},
+        {"recolor", 1,    0, 'R'},
+        {"iter-format", 1, 0, 'F'},
+        {"crop",    1,    0, 'k'},
+        {"supersample", 1, 0, 'A'},
+        {"filter",  1,    0, 'G'},
+        {"iters",   1,    0, 'i'},
+        {"resume",  1,    0, 'u'},
+        {"stats",   1,    0, 'T'},
+        {"counters", 0,   0, 'H'},
+        {"progressive", 0, 0, 'W'},
+        {"budget",  1,    0, 'B'},
+        {"serve",   1,    0, 'D'},
         {"random",  0,    0, 'r'},
         {"verbose", 0,    0, 'v'},
         {"help",    0,    0, 'h'},
@@ -63,15 +100,41 @@ namespace opts
     /*
     * help messages for each command
     */
-    const char* mshort_opts = "s:x:y:o:c:z:vhr";
+    const char* mshort_opts = "s:x:y:o:c:z:t:b:m:p:n:e:C:S:I:R:F:k:A:G:i:u:T:B:D:HWLKPdgvhr";
     const char* moption_help[] =
     {
         "sets the target resolution of the render",
         "sets the initial real value to use",
         "sets the initial imaginary value to use",
         "tell the program what name to use for the output file",
-        "informs the program what color map to use",
+        "color map: grey, fire or ocean (default: grey)",
         "sets the zoom level",
+        "number of render threads (default: one per core)",
+        "rows per streamed band, 0 for the whole image (default: 64)",
+        "how tiles are filled in: scan or mariani (default: scan)",
+        "iterate points inside the main cardioid and period-2 bulb",
+        "stop iterating orbits that repeat exactly (cycle detection)",
+        "deep zoom: perturbation around a high precision reference orbit",
+        "iterate every pixel in arbitrary precision (needs GMP)",
+        "numeric type: auto, float, double, dd or mp (default: auto)",
+        "render a zoom sequence of this many numbered frames",
+        "zoom of the last frame (default: doubles every frame)",
+        "resample the frames from one log-polar strip, for runs over 4x its samples",
+        "directory of an on-disk cache of iterated tiles",
+        "size limit of the tile cache in megabytes (default: 256)",
+        "also save the uncolored iteration counts to this file",
+        "color a saved iteration file instead of rendering",
+        "layout of saved counts: float, uint32, float-rle, uint32-rle",
+        "recolor only the rectangle WxH+X+Y of the iteration file",
+        "extra samples for each pixel on an edge (default: 0, off)",
+        "how edge samples are combined: box or gaussian (default: box)",
+        "iterations before a point counts as inside (default: 255)",
+        "carry on the unescaped pixels saved in this file, then update it",
+        "report time per phase and thread, iterations and bytes: table or json",
+        "add hardware counters (cycles, IPC, cache misses) to the report",
+        "render in coarse to fine passes, rewriting the image after each",
+        "stop a progressive render after this many milliseconds of iterating",
+        "serve renders over HTTP on a localhost port or a Unix socket path",
         "selects random coordinates and magnification",
         "the program will display more text during runtime",
         "shows this help screen",
@@ -81,13 +144,31 @@ namespace opts
 
     const struct option jlong_opts[] =
     {
-        {"size",     2,    0, 's'},
-        {"real",     2,    0, 'x'},
-        {"imag",     2,    0, 'y'},
-        {"output",   2,    0, 'o'},
-        {"colors",   2,    0, 'c'},
-        {"function", 2,    0, 'f'},
-        {"zoom",     2,    0, 'z'},
+        {"size",     1,    0, 's'},
+        {"real",     1,    0, 'x'},
+        {"imag",     1,    0, 'y'},
+        {"output",   1,    0, 'o'},
+        {"colors",   1,    0, 'c'},
+        {"function", 1,    0, 'f'},
+        {"zoom",     1,    0, 'z'},
+        {"threads",  1,    0, 't'},
+        {"band",     1,    0, 'b'},
+        {"strategy", 1,    0, 'm'},
+        {"gmp",      0,    0, 'g'},
+        {"precision", 1,   0, 'p'},
+        {"cache",    1,    0, 'C'},
+        {"cache-size", 1,  0, 'S'},
+        {"save-iters", 1,  0, 'I'},
+        {"recolor",  1,    0, 'R'},
+        {"iter-format", 1, 0, 'F'},
+        {"crop",     1,    0, 'k'},
+        {"supersample", 1, 0, 'A'},
+        {"filter",   1,    0, 'G'},
+        {"iters",    1,    0, 'i'},
+        {"stats",    1,    0, 'T'},
+        {"counters", 0,    0, 'H'},
+        {"progressive", 0, 0, 'W'},
+        {"budget",   1,    0, 'B'},
         {"random",   0,    0, 'r'},
         {"verbose",  0,    0, 'v'},
         {"help",     0,    0, 'h'},
@@ -95,16 +176,34 @@ namespace opts
     };
 
 
-    const char* jshort_opts = "s:x:y:o:c:f:z:vhr";
+    const char* jshort_opts = "s:x:y:o:c:f:z:t:b:m:p:C:S:I:R:F:k:A:G:i:T:B:HWgvhr";
     const char* joption_help[] =
     {
         "sets the target resolution of the output image",
         "sets the initial Constant real value to use",
         "sets the initial Constant imaginary value to use",
         "tells the program what name to use for the output file",
-        "informs the program what color map to use",
-        "sets the Julia function to render",
+        "color map: grey, fire or ocean (default: grey)",
+        "sets the Julia function: z^2+c up to z^8+c, or an expression in z and c",
         "sets the zoom/magnification level",
+        "number of render threads (default: one per core)",
+        "rows per streamed band, 0 for the whole image (default: 64)",
+        "how tiles are filled in: scan or mariani (default: scan)",
+        "iterate every pixel in arbitrary precision (needs GMP)",
+        "numeric type: auto, double or mp (default: auto), float and dd are Mandelbrot only",
+        "directory of an on-disk cache of iterated tiles",
+        "size limit of the tile cache in megabytes (default: 256)",
+        "also save the uncolored iteration counts to this file",
+        "color a saved iteration file instead of rendering",
+        "layout of saved counts: float, uint32, float-rle, uint32-rle",
+        "recolor only the rectangle WxH+X+Y of the iteration file",
+        "extra samples for each pixel on an edge (default: 0, off)",
+        "how edge samples are combined: box or gaussian (default: box)",
+        "iterations before a point counts as inside (default: 255)",
+        "report time per phase and thread, iterations and bytes: table or json",
+        "add hardware counters (cycles, IPC, cache misses) to the report",
+        "render in coarse to fine passes, rewriting the image after each",
+        "stop a progressive render after this many milliseconds of iterating",
         "selects a random Constant variable to use",
         "the program will display more text during runtime",
         "shows this help screen",
@@ -116,6 +215,33 @@ namespace opts
     {
         verbose = v;
         random  = r;
+        threads     = 0;
+        band_height = DEFAULT_BAND;
+        strategy    = 0;
+        kernel_flags = KERNEL_CARDIOID;
+        function     = 0;
+        deep         = 0;
+        precision    = PRECISION_AUTO;
+        frames       = 0;
+        zoom_end     = 0.0;
+        exp_map      = 0;
+        cache_mb     = CACHE_DEFAULT_MB;
+        colormap     = 0;
+        iter_format  = 0;
+        crop_x = crop_y = crop_w = crop_h = 0;
+        supersample  = 0;
+        filter       = 0;
+        max_iters    = DEFAULT_ITERS;
+        stats_format = STATS_OFF;
+        stats        = NULL;
+        counters     = 0;
+        progressive  = 0;
+        budget_ms    = 0;
+        output_fd    = -1;
+        seed_zr      = 0.0;
+        seed_zi      = 0.0;
+        seed_cr      = DEFAULT_CR;
+        seed_ci      = DEFAULT_CI;
 
         // add a random mode here somewhere
         if(!random)
@@ -132,6 +258,17 @@ namespace opts
             zoom      = 1;
         }
         res = out;
+        set_zoom(zoom);
+    }
+
+
+    /*
+     * Recompute the spans, corners and increments of the view
+     * around the same center at a new zoom level
+     */
+    void Settings::set_zoom(double z)
+    {
+        zoom       = z;
         double w   = double(res->width);
         double h   = double(res->height);
         span_x     = ((w/h) * 0.5) * (1.0 / zoom);
@@ -159,6 +296,62 @@ namespace opts
         std::cout << "Bot right:         " << botright_x << "x" <<  botright_y << std::endl;
         std::cout << "Increments:        " <<     inc_re << "x" <<      inc_im << std::endl;
         std::cout << "Magnification:     " <<       zoom <<                       std::endl;
+        std::cout << "Threads:           " <<    threads <<                       std::endl;
+        std::cout << "Band height:       " << band_height <<                      std::endl;
+        std::cout << "Strategy:          " << strategy::all[strategy].name <<     std::endl;
+        std::cout << "Function:          " << (formula.empty() ? funcs::all[function].name : formula) << std::endl;
+        std::cout << "Cardioid test:     " << ((kernel_flags & KERNEL_CARDIOID) ? "on" : "off") << std::endl;
+        std::cout << "Periodicity:       " << ((kernel_flags & KERNEL_PERIODIC) ? "on" : "off") << std::endl;
+        std::cout << "Deep zoom:         " << (deep ? "on" : "off") << std::endl;
+        std::cout << "Precision:         " << precision::all[precision].name << std::endl;
+        if(frames > 0)
+            std::cout << "Animation:         " << frames << " frames to zoom "
+                      << (zoom_end > 0.0 ? zoom_end : zoom * exp2(frames - 1.0)) << std::endl;
+        std::cout << "Iteration limit:   " << max_iters << std::endl;
+        if(!resume.empty())
+            std::cout << "Continuation:      " << resume << std::endl;
+        if(progressive)
+            std::cout << "Progressive:       " << PROGRESSIVE_PASSES << " passes"
+                      << (budget_ms > 0 ? ", " + std::to_string(budget_ms) + " ms budget" : std::string()) << std::endl;
+        std::cout << "Color map:         " << colors::all[colormap].name << std::endl;
+        if(supersample > 0)
+            std::cout << "Supersampling:     " << supersample << " samples per edge pixel, "
+                      << aa::all[filter].name << " filter" << std::endl;
+        if(!cache_dir.empty())
+            std::cout << "Tile cache:        " << cache_dir << " (" << cache_mb << " MB)" << std::endl;
+        std::cout << "Output file:       " <<      fname <<                       std::endl;
+    }
+
+
+    /*
+     * A decimal that strtod, DDouble::parse and GMP all read the
+     * same way: [-]digits[.digits][e[+-]digits], where either side
+     * of the point may be empty but not both
+     */
+    bool decimal(const std::string& v)
+    {
+        size_t k = (!v.empty() && v[0] == '-') ? 1 : 0;
+        size_t digits = 0;
+
+        for(; k < v.size() && isdigit((unsigned char)v[k]); k++)
+            digits++;
+        if(k < v.size() && v[k] == '.')
+            for(k++; k < v.size() && isdigit((unsigned char)v[k]); k++)
+                digits++;
+        if(digits == 0)
+            return false;
+
+        if(k < v.size() && (v[k] == 'e' || v[k] == 'E'))
+        {
+            k++;
+            if(k < v.size() && (v[k] == '-' || v[k] == '+'))
+                k++;
+            size_t at = k;
+            for(; k < v.size() && isdigit((unsigned char)v[k]); k++);
+            if(k == at)
+                return false;
+        }
+        return k == v.size();
     }
 
 
@@ -210,8 +403,33 @@ namespace opts
         double  init_imag     =   DEFAULT_IM;
         double  magnification = DEFAULT_ZOOM; // 0.5 will double the unit rect range
 
-        //char*  fname; //strmcpy to this address from the getopt loop
+        std::string fname;
+        std::string real_str, imag_str;
+        uint8_t     deep          = 0;
+        uint32_t    precision     = PRECISION_AUTO;
         uint32_t selected_reso = 0;
+        uint32_t threads       = 0;
+        uint32_t band_height   = DEFAULT_BAND;
+        uint32_t fill_strategy = 0;
+        uint32_t kernel_flags  = KERNEL_CARDIOID;
+        uint32_t frames        = 0;
+        double   zoom_end      = 0.0;
+        uint8_t  exp_map       = 0;
+        std::string cache_dir;
+        uint32_t    cache_mb   = CACHE_DEFAULT_MB;
+        uint32_t    colormap   = 0;
+        std::string iter_file, recolor;
+        uint32_t    iter_format = 0;
+        uint32_t    crop_x = 0, crop_y = 0, crop_w = 0, crop_h = 0;
+        uint32_t    supersample = 0;
+        uint32_t    filter      = 0;
+        uint32_t    max_iters   = DEFAULT_ITERS;
+        std::string resume;
+        uint32_t    stats_format = STATS_OFF;
+        uint8_t     counters     = 0;
+        uint8_t     progressive  = 0;
+        uint32_t    budget_ms    = 0;
+        std::string serve;
 
         // begin getopts parsing
         while ((c = getopt_long(argc, argv, mshort_opts, mlong_opts, &option_index)) != -1)
@@ -233,6 +451,64 @@ namespace opts
                 random = 1;
                 break;
 
+            case 'd':
+                // deep zoom through perturbation
+                deep = 1;
+                break;
+
+            case 'L':
+                // zoom sequence through an exponential map
+                exp_map = 1;
+                break;
+
+            case 'K':
+                // A/B switch for the cardioid/bulb pre-test
+                kernel_flags &= ~KERNEL_CARDIOID;
+                break;
+
+            case 'P':
+                // A/B switch for periodicity checking
+                kernel_flags |= KERNEL_PERIODIC;
+                break;
+
+            case 'H':
+                // hardware counters in the statistics report
+                counters = 1;
+                break;
+
+            case 'W':
+                // coarse to fine passes
+                progressive = 1;
+                break;
+
+            case 'B':
+                // time budget of a progressive render
+                if(strlen(optarg) == 0)
+                {
+                    std::cerr << "Error: no time budget given" << std::endl;
+                    exit(1);
+                }
+
+                if(atol(optarg) <= 0)
+                {
+                    std::cerr << "Error: negative or invalid time budget given" << std::endl;
+                    exit(1);
+                }
+                budget_ms   = atol(optarg);
+                progressive = 1;
+                break;
+
+            case 'D':
+                // where the render server listens
+                if(optarg == NULL || strlen(optarg) == 0)
+                {
+                    std::cerr << "Error: no port or socket path given" << std::endl;
+                    exit(1);
+                }
+
+                serve = optarg;
+                break;
+
             case 's':
                 // set the resolution rect from ones available
                 if(strlen(optarg) == 0)
@@ -268,8 +544,14 @@ namespace opts
                     exit(1);
                 }
 
-                // set the real (no checking, bad)
-                init_real = atof(optarg);
+                // GMP doesn't take a leading '+', the other tiers do
+                real_str = (optarg[0] == '+') ? optarg + 1 : optarg;
+                if(!decimal(real_str))
+                {
+                    std::cerr << "Error: cannot parse the real value " << optarg << std::endl;
+                    exit(1);
+                }
+                init_real = atof(real_str.c_str());
                 break;
 
             case 'y':
@@ -280,8 +562,13 @@ namespace opts
                     exit(1);
                 }
 
-                // set the imag num (no checking, bad)
-                init_imag = atof(optarg);
+                imag_str = (optarg[0] == '+') ? optarg + 1 : optarg;
+                if(!decimal(imag_str))
+                {
+                    std::cerr << "Error: cannot parse the imaginary value " << optarg << std::endl;
+                    exit(1);
+                }
+                init_imag = atof(imag_str.c_str());
                 break;
 
             case 'z':
@@ -301,154 +588,997 @@ namespace opts
                 }
                 break;
 
-            case 'o':
-                // get the file name and bind it
-                if(!strlen(optarg))
+            case 't':
+                // get the worker thread count (0 means auto)
+                if(strlen(optarg) == 0)
                 {
-                    std::cerr << "Error: no file path supplied" << std::endl;
+                    std::cerr << "Error: no thread count given" << std::endl;
                     exit(1);
                 }
 
-                // TODO: transfer char* to a std::string type
+                if(atoi(optarg) < 0)
+                {
+                    std::cerr << "Error: negative thread count given" << std::endl;
+                    exit(1);
+                }
+                threads = atoi(optarg);
                 break;
-            }
 
-        // Return a new Settings object by value
-        return Settings
-            (
-                verbose, random, init_real,
-                init_imag, magnification, &reso::all[selected_reso]
-            );
-    }
+            case 'b':
+                // get the band height (0 renders the image as one band)
+                if(strlen(optarg) == 0)
+                {
+                    std::cerr << "Error: no band height given" << std::endl;
+                    exit(1);
+                }
 
+                if(atoi(optarg) < 0)
+                {
+                    std::cerr << "Error: negative band height given" << std::endl;
+                    exit(1);
+                }
+                band_height = atoi(optarg);
+                break;
 
-    /*
-     * Julia-specific version of mparse (similar code, different opts)
-     */
-    Settings jparse(int argc, char** argv)
-    {
+            case 'm':
+                // pick the tile strategy by name
+                if(strlen(optarg) == 0)
+                {
+                    std::cerr << "Error: no strategy given" << std::endl;
+                    exit(1);
+                }
 
-        // values used during the getopts phase
-        int      c             =            0;
-        int      found         =            0;
-        int      option_index  =            0;
-        // values to use in the struct (adjusted by the getopts args)
-        uint8_t  verbose       =            0;
-        uint8_t  random        =            0;
-        double   init_real     =   DEFAULT_RE;
-        double   init_imag     =   DEFAULT_IM;
-        double   magnification = DEFAULT_ZOOM; // 0.5 will double the unit rect range
+                found = 0;
+                for(uint32_t si=0; si < strategy::STRATEGY_COUNT; si++)
+                {
+                    if(strcmp(strategy::all[si].name, optarg) == 0)
+                    {
+                        fill_strategy = si;
+                        found = 1;
+                    }
+                }
 
-        //char*  fname; //strmcpy to this address from the getopt loop
-        uint32_t selected_reso = 0;
+                if(!found)
+                {
+                    std::cerr << "Error: given strategy not supported" << std::endl;
+                    strategy::print_all();
+                    exit(1);
+                }
+                break;
 
-        // begin getopts parsing
-        while ((c = getopt_long(argc, argv, mshort_opts, mlong_opts, &option_index)) != -1)
-            switch(c)
-            {
-            case 'v':
-                // verbosity switch
-                verbose = 1;
+            case 'g':
+                // arbitrary precision for every pixel
+#ifndef DGMP
+                std::cerr << "Error: built without GMP support" << std::endl;
+                exit(1);
+#endif
+                precision = PRECISION_MP;
                 break;
 
-            case 'h':
-                // print help and quit
-                print_julia_info();
-                exit(0);
+            case 'p':
+                // pick a rung of the precision ladder by name
+                if(strlen(optarg) == 0)
+                {
+                    std::cerr << "Error: no precision given" << std::endl;
+                    exit(1);
+                }
+
+                found = 0;
+                for(uint32_t pi=0; pi < precision::PRECISION_COUNT; pi++)
+                {
+                    if(strcmp(precision::all[pi].name, optarg) == 0)
+                    {
+                        precision = pi;
+                        found = 1;
+                    }
+                }
+
+                if(!found)
+                {
+                    std::cerr << "Error: given precision not supported" << std::endl;
+                    precision::print_all();
+                    exit(1);
+                }
+#ifndef DGMP
+                if(precision == PRECISION_MP)
+                {
+                    std::cerr << "Error: built without GMP support" << std::endl;
+                    exit(1);
+                }
+#endif
                 break;
 
-            case 'r':
-                // enable random mode
-                random = 1;
+            case 'n':
+                // frame count of a zoom sequence
+                if(strlen(optarg) == 0)
+                {
+                    std::cerr << "Error: no frame count given" << std::endl;
+                    exit(1);
+                }
+
+                if(atoi(optarg) < 0)
+                {
+                    std::cerr << "Error: negative frame count given" << std::endl;
+                    exit(1);
+                }
+                frames = atoi(optarg);
                 break;
 
-            case 's':
-                // set the resolution rect from ones available
+            case 'e':
+                // zoom of the last frame
                 if(strlen(optarg) == 0)
                 {
-                    std::cerr << "No size given" << std::endl;
+                    std::cerr << "Error: no end zoom given" << std::endl;
+                    exit(1);
+                }
+
+                zoom_end = atof(optarg);
+                if(zoom_end <= 0.0)
+                {
+                    std::cerr << "Error: negative or invalid end zoom given" << std::endl;
+                    exit(1);
+                }
+                break;
+
+            case 'c':
+                // pick the color map by name
+                if(strlen(optarg) == 0)
+                {
+                    std::cerr << "Error: no color map given" << std::endl;
                     exit(1);
                 }
 
-                // linear search to find the supplied reso
                 found = 0;
-                for(uint32_t ri=0; ri < RESOLUTION_COUNT; ri++)
+                for(uint32_t ci=0; ci < COLORMAP_COUNT; ci++)
                 {
-                    if(strcmp(reso::all[ri].name, optarg) == 0)
+                    if(strcmp(colors::all[ci].name, optarg) == 0)
                     {
-                        selected_reso = ri;
+                        colormap = ci;
                         found = 1;
                     }
                 }
 
                 if(!found)
                 {
-                    std::cerr << "Error: given resolution not supported" << std::endl;
-                    reso::print_all();
+                    std::cerr << "Error: given color map not supported" << std::endl;
+                    colors::print_all();
                     exit(1);
                 }
                 break;
 
-            case 'x':
-                // take the supplied real value
+            case 'I':
+                // keep the counts for recoloring later
                 if(strlen(optarg) == 0)
                 {
-                    std::cerr << "Error: no real number supplied" << std::endl;
+                    std::cerr << "Error: no iteration file given" << std::endl;
                     exit(1);
                 }
 
-                // set the real (no checking, bad)
-                init_real = atof(optarg);
+                iter_file = optarg;
                 break;
 
-            case 'y':
-                // get the supplied imag value
+            case 'R':
+                // only color an existing iteration file
                 if(strlen(optarg) == 0)
                 {
-                    std::cerr << "Error: no imaginary number supplied" << std::endl;
+                    std::cerr << "Error: no iteration file given" << std::endl;
                     exit(1);
                 }
 
-                // set the imag num (no checking, bad)
-                init_imag = atof(optarg);
+                recolor = optarg;
                 break;
 
-            case 'z':
-                // get the zoom value
+            case 'F':
+                // pick the layout of the iteration file by name
                 if(strlen(optarg) == 0)
                 {
-                    std::cerr << "Error: no zoom value given" << std::endl;
+                    std::cerr << "Error: no iteration file format given" << std::endl;
                     exit(1);
                 }
 
-                
-                // magnification can be checked as to prevent zeroes
-                magnification = atof(optarg);
-                if(magnification <= 0.0)
+                found = 0;
+                for(uint32_t fi=0; fi < iterfile::FORMAT_COUNT; fi++)
                 {
-                    std::cerr << "Error: negative or invalid zoom given" << std::endl;
+                    if(strcmp(iterfile::all[fi].name, optarg) == 0)
+                    {
+                        iter_format = fi;
+                        found = 1;
+                    }
+                }
+
+                if(!found)
+                {
+                    std::cerr << "Error: given iteration file format not supported" << std::endl;
+                    iterfile::print_all();
                     exit(1);
                 }
                 break;
 
-            case 'o':
-                // get the file name and bind it
+            case 'k':
+                // a rectangle of the iteration file, as WxH+X+Y
+                if(sscanf(optarg, "%ux%u+%u+%u", &crop_w, &crop_h, &crop_x, &crop_y) != 4
+                   || crop_w == 0 || crop_h == 0)
+                {
+                    std::cerr << "Error: the crop must be given as WxH+X+Y" << std::endl;
+                    exit(1);
+                }
+                break;
+
+            case 'A':
+                // extra samples on edge pixels
                 if(strlen(optarg) == 0)
                 {
-                    std::cerr << "Error: no file path supplied" << std::endl;
+                    std::cerr << "Error: no sample count given" << std::endl;
                     exit(1);
                 }
 
-                // TODO: transfer char* to a std::string type
+                if(atoi(optarg) < 0)
+                {
+                    std::cerr << "Error: negative sample count given" << std::endl;
+                    exit(1);
+                }
+                supersample = atoi(optarg);
                 break;
-            }
+
+            case 'G':
+                // pick the reconstruction filter by name
+                if(strlen(optarg) == 0)
+                {
+                    std::cerr << "Error: no filter given" << std::endl;
+                    exit(1);
+                }
+
+                found = 0;
+                for(uint32_t gi=0; gi < aa::FILTER_COUNT; gi++)
+                {
+                    if(strcmp(aa::all[gi].name, optarg) == 0)
+                    {
+                        filter = gi;
+                        found = 1;
+                    }
+                }
+
+                if(!found)
+                {
+                    std::cerr << "Error: given filter not supported" << std::endl;
+                    aa::print_all();
+                    exit(1);
+                }
+                break;
+
+            case 'T':
+                // pick the statistics report format by name
+                if(optarg == NULL || strlen(optarg) == 0)
+                {
+                    std::cerr << "Error: no statistics format given" << std::endl;
+                    exit(1);
+                }
+
+                found = 0;
+                for(uint32_t ti=0; ti < stats::FORMAT_COUNT; ti++)
+                {
+                    if(strcmp(stats::all[ti].name, optarg) == 0)
+                    {
+                        stats_format = stats::all[ti].format;
+                        found = 1;
+                    }
+                }
+
+                if(!found)
+                {
+                    std::cerr << "Error: given statistics format not supported" << std::endl;
+                    stats::print_all();
+                    exit(1);
+                }
+                break;
+
+            case 'i':
+                // the iteration limit
+                if(strlen(optarg) == 0)
+                {
+                    std::cerr << "Error: no iteration limit given" << std::endl;
+                    exit(1);
+                }
+
+                if(atol(optarg) <= 0 || atol(optarg) > ITERS_LIMIT)
+                {
+                    std::cerr << "Error: the iteration limit must be between 1 and " << ITERS_LIMIT << std::endl;
+                    exit(1);
+                }
+                max_iters = atol(optarg);
+                break;
+
+            case 'u':
+                // where unescaped orbits are kept between renders
+                if(strlen(optarg) == 0)
+                {
+                    std::cerr << "Error: no continuation file given" << std::endl;
+                    exit(1);
+                }
+
+                resume = optarg;
+                break;
+
+            case 'C':
+                // where iterated tiles are kept between renders
+                if(strlen(optarg) == 0)
+                {
+                    std::cerr << "Error: no cache directory given" << std::endl;
+                    exit(1);
+                }
+
+                cache_dir = optarg;
+                break;
+
+            case 'S':
+                // size limit of the tile cache
+                if(strlen(optarg) == 0)
+                {
+                    std::cerr << "Error: no cache size given" << std::endl;
+                    exit(1);
+                }
+
+                if(atoi(optarg) <= 0)
+                {
+                    std::cerr << "Error: negative or invalid cache size given" << std::endl;
+                    exit(1);
+                }
+                cache_mb = atoi(optarg);
+                break;
+
+            case 'o':
+                // get the file name and bind it
+                if(!strlen(optarg))
+                {
+                    std::cerr << "Error: no file path supplied" << std::endl;
+                    exit(1);
+                }
+
+                fname = optarg;
+                break;
+            }
+
+        if(exp_map && frames == 0)
+        {
+            std::cerr << "Error: the exponential map needs a frame count" << std::endl;
+            exit(1);
+        }
+
+        if(exp_map && supersample > 0)
+        {
+            std::cerr << "Error: frames resampled from the exponential map can't be supersampled" << std::endl;
+            exit(1);
+        }
+
+        if(crop_w > 0 && recolor.empty())
+        {
+            std::cerr << "Error: a crop only applies to --recolor" << std::endl;
+            exit(1);
+        }
+
+        if(!resume.empty() && (frames > 0 || !recolor.empty() || !cache_dir.empty()))
+        {
+            std::cerr << "Error: a continuation file can't be used with frames, --recolor or a cache" << std::endl;
+            exit(1);
+        }
+
+        if(progressive && (frames > 0 || !recolor.empty() || !cache_dir.empty() || !resume.empty() || supersample > 0))
+        {
+            std::cerr << "Error: a progressive render can't be used with frames, --recolor, a cache,"
+                      << " a continuation file or supersampling" << std::endl;
+            exit(1);
+        }
+
+        if(!serve.empty() && (frames > 0 || !recolor.empty() || !resume.empty() || !iter_file.empty()
+                              || progressive || stats_format != STATS_OFF || counters))
+        {
+            std::cerr << "Error: the server can't be used with frames, --recolor, a continuation file,"
+                      << " --save-iters, a progressive render or --stats" << std::endl;
+            exit(1);
+        }
+
+        // Return a new Settings object by value
+        Settings s
+            (
+                verbose, random, init_real,
+                init_imag, magnification, &reso::all[selected_reso]
+            );
+        s.threads     = threads;
+        s.band_height = band_height;
+        s.strategy    = fill_strategy;
+        s.kernel_flags = kernel_flags;
+        s.real_str     = real_str;
+        s.imag_str     = imag_str;
+        s.deep         = deep;
+        s.precision    = precision;
+        s.frames       = frames;
+        s.zoom_end     = zoom_end;
+        s.exp_map      = exp_map;
+        s.cache_dir    = cache_dir;
+        s.cache_mb     = cache_mb;
+        s.colormap     = colormap;
+        s.iter_file    = iter_file;
+        s.recolor      = recolor;
+        s.iter_format  = iter_format;
+        s.crop_x       = crop_x;
+        s.crop_y       = crop_y;
+        s.crop_w       = crop_w;
+        s.crop_h       = crop_h;
+        s.supersample  = supersample;
+        s.filter       = filter;
+        s.max_iters    = max_iters;
+        s.stats_format = stats_format;
+        s.counters     = counters;
+        s.progressive  = progressive;
+        s.budget_ms    = budget_ms;
+        s.serve        = serve;
+        s.resume       = resume;
+        s.fname       = fname;
+        return s;
+    }
+
+
+    /*
+     * Julia-specific version of mparse (similar code, different opts)
+     */
+    Settings jparse(int argc, char** argv)
+    {
+
+        // values used during the getopts phase
+        int      c             =            0;
+        int      found         =            0;
+        int      option_index  =            0;
+        // values to use in the struct (adjusted by the getopts args)
+        uint8_t  verbose       =            0;
+        uint8_t  random        =            0;
+        double   init_real     =   DEFAULT_RE;
+        double   init_imag     =   DEFAULT_IM;
+        double   magnification = DEFAULT_ZOOM; // 0.5 will double the unit rect range
+
+        std::string fname;
+        std::string real_str, imag_str;
+        uint32_t    precision     = PRECISION_AUTO;
+        uint32_t selected_reso = 0;
+        uint32_t threads       = 0;
+        uint32_t band_height   = DEFAULT_BAND;
+        uint32_t fill_strategy = 0;
+        uint32_t function      = 0;
+        std::string formula;
+        std::string cache_dir;
+        uint32_t    cache_mb   = CACHE_DEFAULT_MB;
+        uint32_t    colormap   = 0;
+        std::string iter_file, recolor;
+        uint32_t    iter_format = 0;
+        uint32_t    crop_x = 0, crop_y = 0, crop_w = 0, crop_h = 0;
+        uint32_t    supersample = 0;
+        uint32_t    filter      = 0;
+        uint32_t    max_iters   = DEFAULT_ITERS;
+        uint32_t    stats_format = STATS_OFF;
+        uint8_t     counters     = 0;
+        uint8_t     progressive  = 0;
+        uint32_t    budget_ms    = 0;
+
+        // begin getopts parsing
+        while ((c = getopt_long(argc, argv, jshort_opts, jlong_opts, &option_index)) != -1)
+            switch(c)
+            {
+            case 'v':
+                // verbosity switch
+                verbose = 1;
+                break;
+
+            case 'h':
+                // print help and quit
+                print_julia_info();
+                exit(0);
+                break;
+
+            case 'r':
+                // enable random mode
+                random = 1;
+                break;
+
+            case 'H':
+                // hardware counters in the statistics report
+                counters = 1;
+                break;
+
+            case 'W':
+                // coarse to fine passes
+                progressive = 1;
+                break;
+
+            case 'B':
+                // time budget of a progressive render
+                if(strlen(optarg) == 0)
+                {
+                    std::cerr << "Error: no time budget given" << std::endl;
+                    exit(1);
+                }
+
+                if(atol(optarg) <= 0)
+                {
+                    std::cerr << "Error: negative or invalid time budget given" << std::endl;
+                    exit(1);
+                }
+                budget_ms   = atol(optarg);
+                progressive = 1;
+                break;
+
+            case 's':
+                // set the resolution rect from ones available
+                if(strlen(optarg) == 0)
+                {
+                    std::cerr << "No size given" << std::endl;
+                    exit(1);
+                }
+
+                // linear search to find the supplied reso
+                found = 0;
+                for(uint32_t ri=0; ri < RESOLUTION_COUNT; ri++)
+                {
+                    if(strcmp(reso::all[ri].name, optarg) == 0)
+                    {
+                        selected_reso = ri;
+                        found = 1;
+                    }
+                }
+
+                if(!found)
+                {
+                    std::cerr << "Error: given resolution not supported" << std::endl;
+                    reso::print_all();
+                    exit(1);
+                }
+                break;
+
+            case 'x':
+                // take the supplied real value
+                if(strlen(optarg) == 0)
+                {
+                    std::cerr << "Error: no real number supplied" << std::endl;
+                    exit(1);
+                }
+
+                // GMP doesn't take a leading '+', the other tiers do
+                real_str = (optarg[0] == '+') ? optarg + 1 : optarg;
+                if(!decimal(real_str))
+                {
+                    std::cerr << "Error: cannot parse the real value " << optarg << std::endl;
+                    exit(1);
+                }
+                init_real = atof(real_str.c_str());
+                break;
+
+            case 'y':
+                // get the supplied imag value
+                if(strlen(optarg) == 0)
+                {
+                    std::cerr << "Error: no imaginary number supplied" << std::endl;
+                    exit(1);
+                }
+
+                imag_str = (optarg[0] == '+') ? optarg + 1 : optarg;
+                if(!decimal(imag_str))
+                {
+                    std::cerr << "Error: cannot parse the imaginary value " << optarg << std::endl;
+                    exit(1);
+                }
+                init_imag = atof(imag_str.c_str());
+                break;
+
+            case 'z':
+                // get the zoom value
+                if(strlen(optarg) == 0)
+                {
+                    std::cerr << "Error: no zoom value given" << std::endl;
+                    exit(1);
+                }
+
+                
+                // magnification can be checked as to prevent zeroes
+                magnification = atof(optarg);
+                if(magnification <= 0.0)
+                {
+                    std::cerr << "Error: negative or invalid zoom given" << std::endl;
+                    exit(1);
+                }
+                break;
+
+            case 't':
+                // get the worker thread count (0 means auto)
+                if(strlen(optarg) == 0)
+                {
+                    std::cerr << "Error: no thread count given" << std::endl;
+                    exit(1);
+                }
+
+                if(atoi(optarg) < 0)
+                {
+                    std::cerr << "Error: negative thread count given" << std::endl;
+                    exit(1);
+                }
+                threads = atoi(optarg);
+                break;
+
+            case 'b':
+                // get the band height (0 renders the image as one band)
+                if(strlen(optarg) == 0)
+                {
+                    std::cerr << "Error: no band height given" << std::endl;
+                    exit(1);
+                }
+
+                if(atoi(optarg) < 0)
+                {
+                    std::cerr << "Error: negative band height given" << std::endl;
+                    exit(1);
+                }
+                band_height = atoi(optarg);
+                break;
+
+            case 'm':
+                // pick the tile strategy by name
+                if(strlen(optarg) == 0)
+                {
+                    std::cerr << "Error: no strategy given" << std::endl;
+                    exit(1);
+                }
+
+                found = 0;
+                for(uint32_t si=0; si < strategy::STRATEGY_COUNT; si++)
+                {
+                    if(strcmp(strategy::all[si].name, optarg) == 0)
+                    {
+                        fill_strategy = si;
+                        found = 1;
+                    }
+                }
+
+                if(!found)
+                {
+                    std::cerr << "Error: given strategy not supported" << std::endl;
+                    strategy::print_all();
+                    exit(1);
+                }
+                break;
+
+            case 'g':
+                // arbitrary precision for every pixel
+#ifndef DGMP
+                std::cerr << "Error: built without GMP support" << std::endl;
+                exit(1);
+#endif
+                precision = PRECISION_MP;
+                break;
+
+            case 'p':
+                // pick a rung of the precision ladder by name
+                if(strlen(optarg) == 0)
+                {
+                    std::cerr << "Error: no precision given" << std::endl;
+                    exit(1);
+                }
+
+                found = 0;
+                for(uint32_t pi=0; pi < precision::PRECISION_COUNT; pi++)
+                {
+                    if(strcmp(precision::all[pi].name, optarg) == 0)
+                    {
+                        precision = pi;
+                        found = 1;
+                    }
+                }
+
+                if(!found)
+                {
+                    std::cerr << "Error: given precision not supported" << std::endl;
+                    precision::print_all();
+                    exit(1);
+                }
+
+                // Julia only has double and GMP kernels so far
+                if(precision == PRECISION_FLOAT || precision == PRECISION_DD)
+                {
+                    std::cerr << "Error: Julia sets only iterate in double or mp (or auto)" << std::endl;
+                    exit(1);
+                }
+#ifndef DGMP
+                if(precision == PRECISION_MP)
+                {
+                    std::cerr << "Error: built without GMP support" << std::endl;
+                    exit(1);
+                }
+#endif
+                break;
+
+            case 'f':
+                // pick the Julia formula by name
+                if(strlen(optarg) == 0)
+                {
+                    std::cerr << "Error: no function given" << std::endl;
+                    exit(1);
+                }
+
+                found = 0;
+                for(uint32_t fi=0; fi < funcs::JFUNC_COUNT; fi++)
+                {
+                    if(strcmp(funcs::all[fi].name, optarg) == 0)
+                    {
+                        function = fi;
+                        found = 1;
+                    }
+                }
+
+                // anything else has to compile as an expression
+                formula.clear();
+                if(!found)
+                {
+                    expr::Program prog;
+                    std::string   error;
+                    if(!expr::compile(optarg, prog, error))
+                    {
+                        std::cerr << "Error: bad function '" << optarg << "': " << error << std::endl;
+                        funcs::print_all();
+                        exit(1);
+                    }
+                    formula = optarg;
+                }
+                break;
+
+            case 'c':
+                // pick the color map by name
+                if(strlen(optarg) == 0)
+                {
+                    std::cerr << "Error: no color map given" << std::endl;
+                    exit(1);
+                }
+
+                found = 0;
+                for(uint32_t ci=0; ci < COLORMAP_COUNT; ci++)
+                {
+                    if(strcmp(colors::all[ci].name, optarg) == 0)
+                    {
+                        colormap = ci;
+                        found = 1;
+                    }
+                }
+
+                if(!found)
+                {
+                    std::cerr << "Error: given color map not supported" << std::endl;
+                    colors::print_all();
+                    exit(1);
+                }
+                break;
+
+            case 'I':
+                // keep the counts for recoloring later
+                if(strlen(optarg) == 0)
+                {
+                    std::cerr << "Error: no iteration file given" << std::endl;
+                    exit(1);
+                }
+
+                iter_file = optarg;
+                break;
+
+            case 'R':
+                // only color an existing iteration file
+                if(strlen(optarg) == 0)
+                {
+                    std::cerr << "Error: no iteration file given" << std::endl;
+                    exit(1);
+                }
+
+                recolor = optarg;
+                break;
+
+            case 'F':
+                // pick the layout of the iteration file by name
+                if(strlen(optarg) == 0)
+                {
+                    std::cerr << "Error: no iteration file format given" << std::endl;
+                    exit(1);
+                }
+
+                found = 0;
+                for(uint32_t fi=0; fi < iterfile::FORMAT_COUNT; fi++)
+                {
+                    if(strcmp(iterfile::all[fi].name, optarg) == 0)
+                    {
+                        iter_format = fi;
+                        found = 1;
+                    }
+                }
+
+                if(!found)
+                {
+                    std::cerr << "Error: given iteration file format not supported" << std::endl;
+                    iterfile::print_all();
+                    exit(1);
+                }
+                break;
+
+            case 'k':
+                // a rectangle of the iteration file, as WxH+X+Y
+                if(sscanf(optarg, "%ux%u+%u+%u", &crop_w, &crop_h, &crop_x, &crop_y) != 4
+                   || crop_w == 0 || crop_h == 0)
+                {
+                    std::cerr << "Error: the crop must be given as WxH+X+Y" << std::endl;
+                    exit(1);
+                }
+                break;
+
+            case 'A':
+                // extra samples on edge pixels
+                if(strlen(optarg) == 0)
+                {
+                    std::cerr << "Error: no sample count given" << std::endl;
+                    exit(1);
+                }
+
+                if(atoi(optarg) < 0)
+                {
+                    std::cerr << "Error: negative sample count given" << std::endl;
+                    exit(1);
+                }
+                supersample = atoi(optarg);
+                break;
+
+            case 'G':
+                // pick the reconstruction filter by name
+                if(strlen(optarg) == 0)
+                {
+                    std::cerr << "Error: no filter given" << std::endl;
+                    exit(1);
+                }
+
+                found = 0;
+                for(uint32_t gi=0; gi < aa::FILTER_COUNT; gi++)
+                {
+                    if(strcmp(aa::all[gi].name, optarg) == 0)
+                    {
+                        filter = gi;
+                        found = 1;
+                    }
+                }
+
+                if(!found)
+                {
+                    std::cerr << "Error: given filter not supported" << std::endl;
+                    aa::print_all();
+                    exit(1);
+                }
+                break;
+
+            case 'T':
+                // pick the statistics report format by name
+                if(optarg == NULL || strlen(optarg) == 0)
+                {
+                    std::cerr << "Error: no statistics format given" << std::endl;
+                    exit(1);
+                }
+
+                found = 0;
+                for(uint32_t ti=0; ti < stats::FORMAT_COUNT; ti++)
+                {
+                    if(strcmp(stats::all[ti].name, optarg) == 0)
+                    {
+                        stats_format = stats::all[ti].format;
+                        found = 1;
+                    }
+                }
+
+                if(!found)
+                {
+                    std::cerr << "Error: given statistics format not supported" << std::endl;
+                    stats::print_all();
+                    exit(1);
+                }
+                break;
+
+            case 'i':
+                // the iteration limit
+                if(strlen(optarg) == 0)
+                {
+                    std::cerr << "Error: no iteration limit given" << std::endl;
+                    exit(1);
+                }
+
+                if(atol(optarg) <= 0 || atol(optarg) > ITERS_LIMIT)
+                {
+                    std::cerr << "Error: the iteration limit must be between 1 and " << ITERS_LIMIT << std::endl;
+                    exit(1);
+                }
+                max_iters = atol(optarg);
+                break;
+
+            case 'C':
+                // where iterated tiles are kept between renders
+                if(strlen(optarg) == 0)
+                {
+                    std::cerr << "Error: no cache directory given" << std::endl;
+                    exit(1);
+                }
+
+                cache_dir = optarg;
+                break;
+
+            case 'S':
+                // size limit of the tile cache
+                if(strlen(optarg) == 0)
+                {
+                    std::cerr << "Error: no cache size given" << std::endl;
+                    exit(1);
+                }
+
+                if(atoi(optarg) <= 0)
+                {
+                    std::cerr << "Error: negative or invalid cache size given" << std::endl;
+                    exit(1);
+                }
+                cache_mb = atoi(optarg);
+                break;
+
+            case 'o':
+                // get the file name and bind it
+                if(strlen(optarg) == 0)
+                {
+                    std::cerr << "Error: no file path supplied" << std::endl;
+                    exit(1);
+                }
+
+                fname = optarg;
+                break;
+            }
+
+        if(crop_w > 0 && recolor.empty())
+        {
+            std::cerr << "Error: a crop only applies to --recolor" << std::endl;
+            exit(1);
+        }
+
+        if(progressive && (!recolor.empty() || !cache_dir.empty() || supersample > 0))
+        {
+            std::cerr << "Error: a progressive render can't be used with --recolor, a cache"
+                      << " or supersampling" << std::endl;
+            exit(1);
+        }
 
         // Return a new Settings object by value
-        return Settings
+        Settings s
             (
                 verbose, random, init_real,
                 init_imag, magnification, &reso::all[selected_reso]
             );
+        s.threads     = threads;
+        s.band_height = band_height;
+        s.strategy    = fill_strategy;
+        s.function    = function;
+        s.formula     = formula;
+        s.real_str    = real_str;
+        s.imag_str    = imag_str;
+        s.precision   = precision;
+        s.cache_dir   = cache_dir;
+        s.cache_mb    = cache_mb;
+        s.colormap    = colormap;
+        s.iter_file   = iter_file;
+        s.recolor     = recolor;
+        s.iter_format = iter_format;
+        s.crop_x      = crop_x;
+        s.crop_y      = crop_y;
+        s.crop_w      = crop_w;
+        s.crop_h      = crop_h;
+        s.supersample = supersample;
+        s.filter      = filter;
+        s.max_iters   = max_iters;
+        s.stats_format = stats_format;
+        s.counters     = counters;
+        s.progressive  = progressive;
+        s.budget_ms    = budget_ms;
+        s.fname       = fname;
+        return s;
     }
 }
 
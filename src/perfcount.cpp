@@ -0,0 +1,196 @@
+/*
+ * perfcount.cpp
+ *
+ * Counter groups are read in one call with PERF_FORMAT_GROUP, so
+ * the events of a sample are taken at the same moment. When the
+ * kernel has to multiplex the PMU between groups, totals are scaled
+ * up by the share of the time the group was actually counting.
+ */
+
+#include <iostream>
+#include <atomic>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "include/perfcount.h"
+
+namespace perf
+{
+#ifdef __linux__
+    const EventInfo all[PERF_EVENTS] =
+    {
+        {"cycles",        PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {"instructions",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {"branch misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        {"L1D misses",    PERF_TYPE_HW_CACHE,  PERF_COUNT_HW_CACHE_L1D
+                                            | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                                            | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+        {"LLC misses",    PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    };
+#else
+    const EventInfo all[PERF_EVENTS] =
+    {
+        {"cycles", 0, 0}, {"instructions", 0, 0}, {"branch misses", 0, 0},
+        {"L1D misses", 0, 0}, {"LLC misses", 0, 0},
+    };
+#endif
+
+    // the events start() could open, every thread opens the same
+    static std::atomic<uint32_t> events(0);
+
+
+    /*
+     * A thread's counters, closed when the thread exits
+     */
+    typedef struct group_t
+    {
+        bool     opened;
+        int      leader;
+        int      fd[PERF_EVENTS];
+        uint64_t id[PERF_EVENTS];
+
+        group_t() : opened(false), leader(-1)
+        {
+            for(uint32_t k=0; k < PERF_EVENTS; k++)
+            {
+                fd[k] = -1;
+                id[k] = 0;
+            }
+        }
+
+        ~group_t()
+        {
+            for(uint32_t k=0; k < PERF_EVENTS; k++)
+                if(fd[k] >= 0)
+                    ::close(fd[k]);
+        }
+    } group_t;
+
+    static thread_local group_t mine;
+
+
+    /*
+     * Open the wanted events on the calling thread, returning the
+     * ones that opened and the errno of the last that didn't
+     */
+    static uint32_t open_group(group_t& g, uint32_t want, int& error)
+    {
+        uint32_t got = 0;
+        g.opened = true;
+        error    = 0;
+
+#ifdef __linux__
+        for(uint32_t k=0; k < PERF_EVENTS; k++)
+        {
+            if(!(want & (1u << k)))
+                continue;
+
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size           = sizeof(attr);
+            attr.type           = all[k].type;
+            attr.config         = all[k].config;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv     = 1;
+            attr.read_format    = PERF_FORMAT_GROUP | PERF_FORMAT_ID
+                                | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+            int fd = syscall(SYS_perf_event_open, &attr, 0, -1, g.leader, PERF_FLAG_FD_CLOEXEC);
+            if(fd < 0)
+            {
+                error = errno;
+                continue;
+            }
+            if(ioctl(fd, PERF_EVENT_IOC_ID, &g.id[k]) != 0)
+            {
+                error = errno;
+                ::close(fd);
+                continue;
+            }
+
+            if(g.leader < 0)
+                g.leader = fd;
+            g.fd[k] = fd;
+            got |= 1u << k;
+        }
+#else
+        (void)want;
+        error = ENOSYS;
+#endif
+        return got;
+    }
+
+
+    bool start()
+    {
+        if(events != 0)
+            return true;
+
+        int      error;
+        uint32_t got = open_group(mine, (1u << PERF_EVENTS) - 1, error);
+        if(got == 0)
+        {
+            std::cerr << "Warning: hardware counters are unavailable (" << strerror(error) << ")";
+            if(error == EACCES || error == EPERM)
+                std::cerr << ", see /proc/sys/kernel/perf_event_paranoid";
+            std::cerr << ", reporting times only" << std::endl;
+            return false;
+        }
+
+        for(uint32_t k=0; k < PERF_EVENTS; k++)
+            if(!(got & (1u << k)))
+                std::cerr << "Warning: no " << all[k].name << " counter ("
+                          << strerror(error) << ")" << std::endl;
+        events = got;
+        return true;
+    }
+
+
+    bool enabled()
+    {
+        return events != 0;
+    }
+
+
+    uint32_t available()
+    {
+        return events;
+    }
+
+
+    void read(sample_t& s)
+    {
+        memset(&s, 0, sizeof(s));
+
+        uint32_t want = events.load(std::memory_order_relaxed);
+        if(want == 0)
+            return;
+
+        int error;
+        if(!mine.opened)
+            open_group(mine, want, error);
+        if(mine.leader < 0)
+            return;
+
+        // nr, time enabled, time running, then a value and id per event
+        uint64_t buf[3 + (2 * PERF_EVENTS)];
+        if(::read(mine.leader, buf, sizeof(buf)) < ssize_t(3 * sizeof(uint64_t)))
+            return;
+
+        uint64_t nr = buf[0], enabled = buf[1], running = buf[2];
+        double   scale = (running > 0 && running < enabled) ? double(enabled) / running : 1.0;
+        for(uint64_t i=0; i < nr && i < PERF_EVENTS; i++)
+            for(uint32_t k=0; k < PERF_EVENTS; k++)
+                if(mine.fd[k] >= 0 && mine.id[k] == buf[4 + (2 * i)])
+                    s.value[k] = uint64_t(buf[3 + (2 * i)] * scale);
+    }
+}
+
+// end
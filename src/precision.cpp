@@ -0,0 +1,67 @@
+/*
+ * precision.cpp
+ *
+ * Picking a rung of the precision ladder for a view
+ */
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+
+#include "include/precision.h"
+
+namespace precision
+{
+    const uint32_t PRECISION_COUNT = 5;
+
+    const PrecisionInfo all[] =
+    {
+        {"auto",     0},
+        {"float",   24},
+        {"double",  53},
+        {"dd",     106},
+        {"mp",       0},
+    };
+
+
+    /*
+     * The tier to render a view with: the one asked for on the
+     * command line, or else the cheapest type whose ulp at the
+     * largest coordinate of the view is still far below a pixel
+     */
+    uint32_t choose(const opts::Settings& s)
+    {
+        if(s.precision != PRECISION_AUTO)
+            return s.precision;
+
+        double mag = std::max(std::max(std::fabs(s.topleft_x),  std::fabs(s.botright_x)),
+                              std::max(std::fabs(s.topleft_y),  std::fabs(s.botright_y)));
+        double inc = std::min(s.inc_re, s.inc_im);
+
+        for(uint32_t p=PRECISION_FLOAT; p <= PRECISION_DD; p++)
+            if(inc >= std::ldexp(mag, PRECISION_MARGIN - int(all[p].bits)))
+                return p;
+
+#ifdef DGMP
+        return PRECISION_MP;
+#else
+        return PRECISION_DD;
+#endif
+    }
+
+
+    /*
+     * Prints out all available precision tiers
+     */
+    void print_all()
+    {
+        std::cout << "Available precisions:" << std::endl;
+
+        for(uint32_t p=0; p < PRECISION_COUNT; p++)
+            std::cout << "  * " << all[p].name << std::endl;
+
+        std::cout << std::endl;
+    }
+}
+
+// end
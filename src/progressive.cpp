@@ -0,0 +1,255 @@
+/*
+ * progressive.cpp
+ *
+ * Each pass is handed to the pool as row segments of its pixels, and
+ * a segment started after the deadline returns without iterating
+ * anything. Pixels are computed from their own (x, y) index exactly
+ * as the tile strategies compute them, so once every pass is in the
+ * image is the same one a streamed render makes.
+ *
+ * Snapshots are colored on the pool and the time they take moves the
+ * deadline back. They're written next to the output under a hidden
+ * name and moved over it, so a viewer watching the file never sees
+ * half an image. Outputs that aren't regular files (a pipe,
+ * /dev/null) only get the last one.
+ */
+
+#include <iostream>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <cmath>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "include/progressive.h"
+#include "include/colors.h"
+#include "include/image.h"
+#include "include/iterfile.h"
+#include "include/stats.h"
+
+namespace progressive
+{
+    const pass_t passes[PROGRESSIVE_PASSES] =
+    {
+        {0, 0, 8, 8, 8, 8},
+        {4, 0, 8, 8, 4, 8},
+        {0, 4, 4, 8, 4, 4},
+        {2, 0, 4, 4, 2, 4},
+        {0, 2, 2, 4, 2, 2},
+        {1, 0, 2, 2, 1, 2},
+        {0, 1, 1, 2, 1, 1},
+    };
+
+
+    /*
+     * The frame so far: normalized counts and which pixels hold one
+     */
+    typedef struct frame_t
+    {
+        uint32_t             w, h;
+        std::vector<float>   values;
+        std::vector<uint8_t> have;
+    } frame_t;
+
+
+    // pixels of a pass along one axis of the image
+    static uint32_t steps(uint32_t first, uint32_t step, uint32_t size)
+    {
+        return (first < size) ? ((size - first + step - 1) / step) : 0;
+    }
+
+
+    /*
+     * The value shown at a pixel once pass p is done (or cut short):
+     * that of the grid point covering it on the finest grid that has
+     * it, falling back on coarser grids, down to the first pass's
+     */
+    static float shown(const frame_t& f, uint32_t x, uint32_t y, uint32_t p)
+    {
+        for(uint32_t q=p; q > 0; q--)
+        {
+            size_t k = (size_t(y & ~(passes[q].gy - 1)) * f.w) + (x & ~(passes[q].gx - 1));
+            if(f.have[k])
+                return f.values[k];
+        }
+        return f.values[(size_t(y & ~7u) * f.w) + (x & ~7u)];
+    }
+
+
+    /*
+     * Write the image as it stands after pass p
+     */
+    static bool snapshot(const opts::Settings& s, const frame_t& f, uint32_t p, const std::string& path,
+                         const colors::Palette& palette, pool::ThreadPool& tp)
+    {
+        std::unique_ptr<image::ImageSink> sink = image::open(path, f.w, f.h, render::image_comment(s), tp);
+        if(!sink || !sink->ok())
+            return false;
+
+        uint32_t band = (s.band_height == 0 || s.band_height > f.h) ? f.h : s.band_height;
+        std::vector<float>   row(size_t(f.w) * band);
+        std::vector<uint8_t> rgb(size_t(f.w) * 3 * band);
+
+        for(uint32_t y0=0; y0 < f.h; y0 += band)
+        {
+            uint32_t rows = std::min(band, f.h - y0);
+            {
+                stats::Timer coloring(s.stats, PHASE_COLOR);
+                tp.run(rows, [&](uint32_t y, uint32_t)
+                {
+                    float* at = row.data() + (size_t(y) * f.w);
+                    for(uint32_t x=0; x < f.w; x++)
+                        at[x] = shown(f, x, y0 + y, p);
+                    palette.apply(at, f.w, rgb.data() + (size_t(y) * f.w * 3));
+                });
+            }
+            stats::Timer writing(s.stats, PHASE_OUTPUT);
+            sink->write_rows(rgb.data(), rows);
+        }
+
+        stats::Timer closing(s.stats, PHASE_OUTPUT);
+        bool done = sink->close();
+        if(s.stats)
+            s.stats->wrote("image", sink->bytes_written());
+        return done;
+    }
+
+
+    /*
+     * The hidden name snapshots are written under,
+     * in the output's directory with its extension
+     */
+    static std::string partial_path(const std::string& path)
+    {
+        size_t slash = path.find_last_of('/');
+        size_t at    = (slash == std::string::npos) ? 0 : slash + 1;
+        return path.substr(0, at) + "." + path.substr(at);
+    }
+
+
+    int render(opts::Settings& s, const opts::Settings& grid, const render::BatchFunc& batch, pool::ThreadPool& tp)
+    {
+        frame_t f;
+        f.w = s.res->width;
+        f.h = s.res->height;
+        f.values.assign(size_t(f.w) * f.h, 0.0f);
+        f.have.assign(size_t(f.w) * f.h, 0);
+
+        stats::Report* rep = s.stats;
+        if(rep)
+            rep->end(PHASE_SETUP);
+
+        colors::Palette palette(colors::all[s.colormap]);
+
+        // snapshots replace the output as they're made when it's a file
+        struct stat st;
+        bool        replace = ::stat(s.fname.c_str(), &st) != 0 || S_ISREG(st.st_mode);
+        std::string part    = partial_path(s.fname);
+
+        double   start    = stats::wall();
+        double   deadline = (s.budget_ms > 0) ? start + (s.budget_ms * 1e-3) : HUGE_VAL;
+        uint64_t done     = 0;
+        bool     late     = false;
+
+        for(uint32_t p=0; p < PROGRESSIVE_PASSES && !late; p++)
+        {
+            const pass_t& ps   = passes[p];
+            uint32_t      cols = steps(ps.x0, ps.dx, f.w);
+            uint32_t      rows = steps(ps.y0, ps.dy, f.h);
+            uint32_t      segs = (cols + PROGRESSIVE_SEGMENT - 1) / PROGRESSIVE_SEGMENT;
+
+            std::atomic<bool>     cut(false);
+            std::atomic<uint64_t> got(0);
+            tp.run(rows * segs, [&, p](uint32_t idx, uint32_t)
+            {
+                if(p > 0 && (cut || stats::wall() > deadline))
+                {
+                    cut = true;
+                    return;
+                }
+
+                stats::stamp_t since;
+                if(rep)
+                    since = stats::now();
+
+                double   cr[PROGRESSIVE_SEGMENT], ci[PROGRESSIVE_SEGMENT], counts[PROGRESSIVE_SEGMENT];
+                uint32_t y  = ps.y0 + ((idx / segs) * ps.dy);
+                uint32_t c0 = (idx % segs) * PROGRESSIVE_SEGMENT;
+                uint32_t n  = std::min<uint32_t>(PROGRESSIVE_SEGMENT, cols - c0);
+
+                for(uint32_t k=0; k < n; k++)
+                {
+                    cr[k] = grid.topleft_x + (ps.x0 + ((c0 + k) * ps.dx)) * grid.inc_re;
+                    ci[k] = grid.topleft_y + y * grid.inc_im;
+                }
+                batch(cr, ci, n, counts);
+
+                for(uint32_t k=0; k < n; k++)
+                {
+                    size_t at = (size_t(y) * f.w) + ps.x0 + ((c0 + k) * ps.dx);
+                    f.values[at] = float(counts[k] / s.max_iters);
+                    f.have[at]   = 1;
+                }
+                got += n;
+
+                if(rep)
+                    rep->add(PHASE_COMPUTE, since);
+            });
+
+            late  = cut;
+            done += got;
+            if(s.verbose)
+                std::cout << "Pass " << p + 1 << " of " << PROGRESSIVE_PASSES << ":       "
+                          << (100.0 * done) / (double(f.w) * f.h) << "% of the pixels after "
+                          << llround((stats::wall() - start) * 1e3) << " ms" << std::endl;
+
+            if(!replace && !late && p + 1 < PROGRESSIVE_PASSES)
+                continue;
+
+            double shot = stats::wall();
+            if(!snapshot(s, f, p, replace ? part : s.fname, palette, tp))
+                return 1;
+            if(replace && ::rename(part.c_str(), s.fname.c_str()) != 0)
+            {
+                std::cerr << "Error: cannot move " << part << " to " << s.fname << ": " << strerror(errno) << std::endl;
+                return 1;
+            }
+
+            // writing a whole image can cost more than an early pass,
+            // the budget only counts the time spent iterating
+            deadline += stats::wall() - shot;
+        }
+
+        if(late)
+            std::cerr << "Warning: the time budget ran out, " << s.fname << " holds "
+                      << (100.0 * done) / (double(f.w) * f.h) << "% of the pixels" << std::endl;
+
+        if(!s.iter_file.empty())
+        {
+            if(late)
+                std::cerr << "Warning: the render didn't finish, " << s.iter_file << " was not written" << std::endl;
+            else
+            {
+                stats::Timer writing(rep, PHASE_OUTPUT);
+                const iterfile::FormatInfo& fmt = iterfile::all[s.iter_format];
+                iterfile::Writer iters(s.iter_file, render::iter_header(s, fmt.type), fmt.rle);
+                if(!iters.ok())
+                    return 1;
+                iters.write_rows(f.values.data(), f.h);
+                if(!iters.close())
+                    return 1;
+                if(rep)
+                    rep->wrote("iterations", iters.bytes_written());
+            }
+        }
+
+        if(rep)
+            rep->frames++;
+        return 0;
+    }
+}
+
+// end
@@ -7,123 +7,908 @@
 
 
 #include <iostream>
-#include <fstream>
+#include <sstream>
 #include <vector>
 #include <functional>
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <unistd.h>
 
 #include "include/rendering.h"
 #include "include/complex.h"
 #include "include/opts.h"
 #include "include/functions.h"
-
-// constants to use
-// Julia has a higher breakout range than Mandel
-#define MAX_ITERS  255.0
-#define M_BREAKOUT 4.0
-#define J_BREAKOUT 100.0
-#define LOG2       0.6931471805599453
+#include "include/simd.h"
+#include "include/image.h"
+#include "include/strategy.h"
+#include "include/deepzoom.h"
+#include "include/precision.h"
+#include "include/expr.h"
+#include "include/animation.h"
+#include "include/cache.h"
+#include "include/iterfile.h"
+#include "include/supersample.h"
+#include "include/resume.h"
+#include "include/stats.h"
+#include "include/perfcount.h"
+#include "include/progressive.h"
 
 
 namespace render
 {
     /*
-     * Create an ofstream image object and return the pointer
-     * for us to use in the rendering programs
+     * The comment line stored in the PPM header
      */
-    std::ofstream* create_image(std::string name, opts::Settings& s)
+    std::string image_comment(const opts::Settings& s)
     {
-        std::ofstream* ofs;
-        ofs = new std::ofstream(name, std::ios::out | std::ios::binary);
-        *ofs << "P6\n";
-        *ofs << "#Real: " << s.topleft_x << ", Imag: " << s.topleft_y << "\n";
-        *ofs << s.res->width << " " << s.res->height;
-        *ofs << "\n255\n";
-        return ofs;
+        std::ostringstream c;
+        c << "Real: " << s.topleft_x << ", Imag: " << s.topleft_y;
+        return c.str();
     }
 
 
+#ifdef DGMP
     /*
-     * Iterate a given point z with constant C
-     * to create the Mandelbrot set (z^2 + c)
+     * Arbitrary precision z^2 + c iteration
+     * The breakout test and the scratch values come out of the
+     * thread's mpf_t pool so nothing is allocated per iteration
      */
-    double iterate_m(Cmp& z, const Cmp& c)
+    static double iterate_mp(MpCmp& z, const MpCmp& c, double breakout, uint32_t power, uint32_t limit)
     {
         double count = 0.0;
-#ifdef DGMP
-#else
-        while(z.length2() < M_BREAKOUT && count++ < MAX_ITERS)
+        mpf_t& l2 = MpfPool::local().get(MPF_POOL_SIZE - 1);
+
+        // higher powers multiply by a copy of z, z^2 squares in place
+        MpCmp base;
+
+        z.length2(&l2);
+        while(mpf_cmp_d(l2, breakout) < 0 && count++ < limit)
         {
-            z.mul(z);
+            if(power == 2)
+                z.mul(z);
+            else
+            {
+                base.set(z);
+                for(uint32_t k=1; k < power; k++)
+                    z.mul(base);
+            }
             z.add(c);
+            z.length2(&l2);
         }
-#endif
 
+        simd::ran += uint64_t(std::min(count, double(limit)));
         return count;
     }
 
 
+    double iterate_m(MpCmp& z, const MpCmp& c, uint32_t limit)
+    {
+        return iterate_mp(z, c, M_BREAKOUT, 2, limit);
+    }
+
+
     /*
-     * Iterate a given z-point with constant C
-     * and an assigned Julia set function
+     * z^power + c in arbitrary precision
      */
-    double iterate_j(Cmp& z, const Cmp& c, const funcs::JFunc_t& jf)
+    double iterate_j(MpCmp& z, const MpCmp& c, uint32_t power, uint32_t limit)
     {
-        double count = 0.0;
+        return iterate_mp(z, c, J_BREAKOUT, power, limit);
+    }
+#endif
 
+
+    /*
+     * Tiles for the arbitrary precision path get offsets from the
+     * view center, like the deep zoom path does
+     */
+    opts::Settings centered(const opts::Settings& s)
+    {
+        opts::Settings ds = s;
+        ds.topleft_x = -s.span_x;
+        ds.topleft_y = -s.span_y;
+        ds.inc_re    = (2.0 * s.span_x) / s.res->width;
+        ds.inc_im    = (2.0 * s.span_y) / s.res->height;
+        return ds;
+    }
+
+
+    /*
+     * One coordinate of the center as a decimal string, preferring
+     * the exact text given on the command line
+     */
+    std::string center_str(const std::string& given, double value)
+    {
+        if(!given.empty())
+            return given;
+        std::ostringstream o;
+        o.precision(17);
+        o << value;
+        return o.str();
+    }
+
+
+    /*
+     * The view center at the precision GMP is set to,
+     * false if it doesn't parse
+     */
 #ifdef DGMP
-#else
-        while(z.length2() < J_BREAKOUT && count++ < MAX_ITERS)
+    static bool center_mp(const opts::Settings& s, MpCmp& center)
+    {
+        std::string rs = center_str(s.real_str, s.init_real);
+        std::string is = center_str(s.imag_str, s.init_imag);
+        if(!center.set(rs.c_str(), is.c_str()))
         {
-            jf(z, c);
+            std::cerr << "Error: cannot parse the center " << rs << ", " << is << std::endl;
+            return false;
         }
-        
+        return true;
+    }
 #endif
 
-        return count;
+
+    /*
+     * The view center in double-double, false if it doesn't parse
+     */
+    static bool center_dd(const opts::Settings& s, DDouble& cr, DDouble& ci)
+    {
+        std::string rs = center_str(s.real_str, s.init_real);
+        std::string is = center_str(s.imag_str, s.init_imag);
+        if(!DDouble::parse(rs, cr) || !DDouble::parse(is, ci))
+        {
+            std::cerr << "Error: cannot parse the center " << rs << ", " << is << std::endl;
+            return false;
+        }
+        return true;
     }
 
 
     /*
-     * Main mandelbrot rendering function
-     * Accepts a Settings ref and renders
-     * the Mandelbrot set of f(z) = z^2 + c
+     * The center as it goes into tile cache keys, for paths whose
+     * tiles only hold offsets from it
      */
-    int mandelbrot(opts::Settings& s)
+    static std::string center_key(const opts::Settings& s)
     {
-        s.display_info();
+        return center_str(s.real_str, s.init_real) + "," + center_str(s.imag_str, s.init_imag);
+    }
+
+
+    /*
+     * The fixed header of an iteration file saved from a render
+     */
+    iterfile::iter_header_t iter_header(const opts::Settings& s, uint32_t type)
+    {
+        iterfile::iter_header_t hdr;
+        memset(&hdr, 0, sizeof(hdr));
+
+        hdr.width     = s.res->width;
+        hdr.height    = s.res->height;
+        hdr.tile      = TILE_SIZE;
+        hdr.type      = type;
+        hdr.max_iters = s.max_iters;
+        hdr.center_re = s.init_real;
+        hdr.center_im = s.init_imag;
+        hdr.zoom      = s.zoom;
+        hdr.inc_re    = s.inc_re;
+        hdr.inc_im    = s.inc_im;
+        iterfile::set_field(hdr.real,    sizeof(hdr.real),    center_str(s.real_str, s.init_real));
+        iterfile::set_field(hdr.imag,    sizeof(hdr.imag),    center_str(s.imag_str, s.init_imag));
+        iterfile::set_field(hdr.formula, sizeof(hdr.formula), s.label);
+        iterfile::set_field(hdr.comment, sizeof(hdr.comment), image_comment(s));
+        return hdr;
+    }
+
+
+    /*
+     * Split a w*h image into tiles of at most size*size pixels,
+     * in row-major order (edge tiles are clipped)
+     */
+    std::vector<tile_t> make_tiles(uint32_t w, uint32_t h, uint32_t size)
+    {
+        std::vector<tile_t> tiles;
+        for(uint32_t y=0; y < h; y += size)
+            for(uint32_t x=0; x < w; x += size)
+                tiles.push_back(tile_t{x, y, std::min(size, w - x), std::min(size, h - y)});
+        return tiles;
+    }
+
+
+    /*
+     * Render the frame as a stream of horizontal bands.
+     *
+     * Every band is split into tiles and submitted to the pool as its
+     * own job. Up to threads+1 bands are in flight at once, so bands
+     * can finish out of order, but they're always written to the
+     * image in order and their buffers are recycled afterwards.
+     * Memory use is bounded by band size * (threads + 1) no matter
+     * how large the image is. Each pixel is computed from its own
+     * (x, y) index, so the output doesn't depend on scheduling.
+     *
+     * Tiles only produce normalized counts; a finished band is
+     * colored through the palette as a separate pass when it's
+     * written, and its counts go to the iteration file if one
+     * was asked for.
+     */
+    int render_bands(opts::Settings& s, const TileFunc& tf, pool::ThreadPool& tp)
+    {
+        uint32_t w      = s.res->width;
+        uint32_t h      = s.res->height;
+        uint32_t band   = (s.band_height == 0 || s.band_height > h) ? h : s.band_height;
+        uint32_t nbands = (h + band - 1) / band;
+        size_t   stride = w;
+
+        std::unique_ptr<image::ImageSink> sink = image::open(s.fname, w, h, image_comment(s), tp, s.output_fd);
+        if(!sink || !sink->ok())
+            return 1;
+
+        std::unique_ptr<iterfile::Writer> iters;
+        if(!s.iter_file.empty())
+        {
+            const iterfile::FormatInfo& fmt = iterfile::all[s.iter_format];
+            iters.reset(new iterfile::Writer(s.iter_file, iter_header(s, fmt.type), fmt.rle));
+            if(!iters->ok())
+                return 1;
+        }
+
+        colors::Palette palette(colors::all[s.colormap]);
+        std::vector<uint8_t> rgb(stride * 3 * band);
+
+        uint32_t window = std::min(nbands, tp.size() + 1);
+        stats::Report* rep = s.stats;
+        if(rep)
+            rep->end(PHASE_SETUP);
+
+        // every band in the window has its own buffer and tile list
+        std::vector<std::vector<float>>   buffers(window);
+        std::vector<std::vector<uint8_t>> overlays(window);
+        std::vector<std::vector<tile_t>>  tiles(window);
+        std::deque<pool::JobRef>          inflight;
+
+        // wait for the oldest band, write it and free up its slot
+        uint32_t next = 0;
+        auto retire = [&]()
+        {
+            uint32_t slot = next % window;
+            uint32_t rows = std::min(band, h - next * band);
+            {
+                stats::Timer waiting(rep, PHASE_WAIT);
+                tp.wait(inflight.front());
+                inflight.pop_front();
+            }
+
+            {
+                stats::Timer coloring(rep, PHASE_COLOR);
+                palette.apply(buffers[slot].data(), stride * rows, rgb.data());
+                if(s.supersample > 0)
+                {
+                    const uint8_t* o = overlays[slot].data();
+                    for(size_t k=0; k < stride * rows; k++)
+                        if(o[(k * 4) + 3])
+                            memcpy(&rgb[k * 3], &o[k * 4], 3);
+                }
+            }
+
+            stats::Timer writing(rep, PHASE_OUTPUT);
+            sink->write_rows(rgb.data(), rows);
+            if(iters)
+                iters->write_rows(buffers[slot].data(), rows);
+            next++;
+        };
+
+        // no more bands are started once the output has failed
+        // (a full disk, a client that hung up)
+        for(uint32_t k=0; k < nbands && sink->ok(); k++)
+        {
+            if(inflight.size() == window)
+                retire();
+
+            uint32_t slot = k % window;
+            uint32_t y0   = k * band;
+            uint32_t rows = std::min(band, h - y0);
+
+            buffers[slot].resize(stride * rows);
+            tiles[slot] = make_tiles(w, rows, TILE_SIZE);
+            for(size_t t=0; t < tiles[slot].size(); t++)
+                tiles[slot][t].y += y0;
 
-        uint32_t w = s.res->width;
-        uint32_t h = s.res->height;
-        double init_re = s.topleft_x;
-        double init_im = s.topleft_y;
-        double inc_re  = s.inc_re;
-        double inc_im  = s.inc_im;
-        Cmp z(0, 0), c(init_re, init_im);
-        Cmp xbump(inc_re, 0), ybump(0, inc_im);
-        std::ofstream* ofs = create_image("./mandelbrot.ppm", s);
+            uint8_t* over = NULL;
+            if(s.supersample > 0)
+            {
+                overlays[slot].assign(stride * 4 * rows, 0);
+                over = overlays[slot].data();
+            }
 
-        double i = 0;
-        uint8_t result = 0;
+            float*                     base = buffers[slot].data();
+            const std::vector<tile_t>* list = &tiles[slot];
+            uint32_t                   limit = s.max_iters;
+            inflight.push_back(tp.submit(list->size(), [&tf, base, over, list, y0, stride, rep, limit](uint32_t idx, uint32_t id)
+            {
+                const tile_t& t    = (*list)[idx];
+                size_t        at   = ((t.y - y0) * stride) + t.x;
+                if(!rep)
+                {
+                    tf(t, base + at, over ? over + (at * 4) : NULL, stride);
+                    return;
+                }
 
-        for(uint32_t y=0; y < h; y++)
+                stats::stamp_t since = stats::now();
+                tf(t, base + at, over ? over + (at * 4) : NULL, stride);
+                rep->tile(id, t.x, t.y, t.w, t.h, base + at, stride, limit, since);
+            }));
+        }
+
+        while(!inflight.empty())
+            retire();
+
+        stats::Timer closing(rep, PHASE_OUTPUT);
+        bool done = (!iters || iters->close()) && sink->close();
+        if(rep)
         {
-            for(uint32_t x=0; x < w; x++)
+            rep->wrote("image", sink->bytes_written());
+            if(iters)
+                rep->wrote("iterations", iters->bytes_written());
+            rep->frames++;
+        }
+        return done ? 0 : 1;
+    }
+
+
+    /*
+     * Color a saved iteration file with the selected palette, a
+     * band of rows at a time. With a crop only the tiles under
+     * the cropped rectangle are ever touched.
+     */
+    int recolor(opts::Settings& s, pool::ThreadPool& tp)
+    {
+        iterfile::Reader src(s.recolor);
+        if(!src.ok())
+            return 1;
+
+        const iterfile::iter_header_t& hdr = src.header();
+        uint32_t x0 = 0, y0 = 0, w = hdr.width, h = hdr.height;
+        if(s.crop_w > 0)
+        {
+            if(uint64_t(s.crop_x) + s.crop_w > hdr.width || uint64_t(s.crop_y) + s.crop_h > hdr.height)
             {
-                z.real = 0.0;
-                z.imag = 0.0;
+                std::cerr << "Error: the crop doesn't fit in the " << hdr.width << "x"
+                          << hdr.height << " iteration file" << std::endl;
+                return 1;
+            }
+            x0 = s.crop_x;
+            y0 = s.crop_y;
+            w  = s.crop_w;
+            h  = s.crop_h;
+        }
 
-                i = iterate_m(z, c);
+        uint32_t band = (s.band_height == 0 || s.band_height > h) ? h : s.band_height;
+        if(s.verbose)
+        {
+            std::cout << "Recoloring:        " << s.recolor << " (" << hdr.width << "x" << hdr.height
+                      << ", " << hdr.formula << " at zoom " << hdr.zoom << ")" << std::endl;
+            std::cout << "Region:            " << w << "x" << h << "+" << x0 << "+" << y0
+                      << " with " << colors::all[s.colormap].name << std::endl;
+        }
+
+        std::unique_ptr<image::ImageSink> sink = image::open(s.fname, w, h, hdr.comment, tp);
+        if(!sink || !sink->ok())
+            return 1;
+
+        colors::Palette      palette(colors::all[s.colormap]);
+        std::vector<float>   counts(size_t(w) * band);
+        std::vector<uint8_t> rgb(size_t(w) * 3 * band);
+
+        for(uint32_t y=0; y < h; y += band)
+        {
+            uint32_t rows = std::min(band, h - y);
+            if(!src.read_rect(x0, y0 + y, w, rows, counts.data(), w))
+                return 1;
 
-                result = colors::flatten(i);
-                *ofs << result << result << result;
-                c.add(xbump);
+            {
+                stats::Timer coloring(s.stats, PHASE_COLOR);
+                palette.apply(counts.data(), size_t(w) * rows, rgb.data());
             }
-            c.real = init_re;
-            c.add(ybump);
+            stats::Timer writing(s.stats, PHASE_OUTPUT);
+            sink->write_rows(rgb.data(), rows);
         }
 
-        ofs->close();
-        return 0;
+        stats::Timer closing(s.stats, PHASE_OUTPUT);
+        bool done = sink->close();
+        if(s.stats)
+            s.stats->wrote("image", sink->bytes_written());
+        return done ? 0 : 1;
+    }
+
+
+    /*
+     * Everything a render's pixels depend on but the iteration
+     * limit: what is being iterated, how, and the exact bits of
+     * the grid. Tile cache keys add the limit to it; continuation
+     * files only hold it to check they're resumed on the same view.
+     */
+    static std::string view_key(const opts::Settings& s, const std::string& what)
+    {
+        std::ostringstream k;
+        k << std::hexfloat << what
+          << "|" << strategy::all[s.strategy].name
+          << "|" << s.kernel_flags
+          << "|" << s.topleft_x << "," << s.topleft_y
+          << "|" << s.inc_re << "," << s.inc_im;
+        return k.str();
+    }
+
+
+    /*
+     * The continuation state of a render: the file it was left in
+     * by an earlier render of the view, if any, and the one this
+     * render leaves behind
+     */
+    typedef struct carry_t
+    {
+        std::unique_ptr<resume::Reader> from;
+        std::unique_ptr<resume::Writer> to;
+        std::atomic<uint64_t>           resumed;
+        bool                            verbose;
+        stats::Report*                  stats;
+
+        carry_t() : resumed(0), verbose(false), stats(NULL) {}
+        ~carry_t()
+        {
+            if(to && to->close() && stats)
+                stats->wrote("continuation", to->bytes_written());
+            if(verbose && from)
+                std::cout << "Resumed:           " << resumed << " pixels from "
+                          << from->header().limit << " iterations" << std::endl;
+        }
+    } carry_t;
+
+
+    /*
+     * Open the continuation files of a render, exiting when the
+     * one already there belongs to another view
+     */
+    static std::shared_ptr<carry_t> carry(const opts::Settings& s, const std::string& what)
+    {
+        std::string view = view_key(s, what);
+        uint32_t    w    = s.res->width, h = s.res->height;
+        uint32_t    band = (s.band_height == 0 || s.band_height > h) ? h : s.band_height;
+
+        std::shared_ptr<carry_t> c = std::make_shared<carry_t>();
+        c->verbose = s.verbose;
+        c->stats   = s.stats;
+
+        if(::access(s.resume.c_str(), F_OK) == 0)
+        {
+            c->from.reset(new resume::Reader(s.resume));
+            if(!c->from->ok())
+                exit(1);
+
+            const resume::resume_header_t& hdr = c->from->header();
+            if(hdr.view_hash != cache::fnv1a(view) || hdr.width != w || hdr.height != h)
+            {
+                std::cerr << "Error: " << s.resume << " was saved from another view: " << hdr.view << std::endl;
+                exit(1);
+            }
+            if(hdr.band != band)
+            {
+                std::cerr << "Error: " << s.resume << " was saved with bands of "
+                          << hdr.band << " rows" << std::endl;
+                exit(1);
+            }
+            if(hdr.limit > s.max_iters)
+            {
+                std::cerr << "Error: " << s.resume << " is already at " << hdr.limit
+                          << " iterations, it can only be carried on to a higher limit" << std::endl;
+                exit(1);
+            }
+        }
+
+        // as many tiles as render_bands will cut the frame into
+        uint32_t tiles = 0;
+        for(uint32_t y0=0; y0 < h; y0 += band)
+            tiles += make_tiles(w, std::min(band, h - y0), TILE_SIZE).size();
+
+        c->to.reset(new resume::Writer(s.resume, resume::header(view, w, h, band, s.max_iters), tiles, s.verbose));
+        if(!c->to->ok())
+            exit(1);
+        return c;
+    }
+
+
+    /*
+     * Fill in a tile's counts by carrying on the orbits its pixels
+     * were left in, or from the start for a tile not in the file,
+     * and save where every pixel ended up. Pixels that escaped or
+     * were proven inside before are never touched again.
+     */
+    static void continue_tile(const opts::Settings& s, const tile_t& t, const ResumeFunc& step,
+                              carry_t& c, double* counts)
+    {
+        uint32_t        n = t.w * t.h;
+        const uint32_t* codes = NULL;
+        const resume::orbit_t* saved = NULL;
+        bool            have  = c.from && c.from->tile(t.x, t.y, t.w, t.h, &codes, &saved);
+
+        resume::orbit_t orbits[TILE_SIZE * TILE_SIZE];
+        double          cr[TILE_SIZE * TILE_SIZE], ci[TILE_SIZE * TILE_SIZE];
+        uint32_t        where[TILE_SIZE * TILE_SIZE];
+        uint32_t        out[TILE_SIZE * TILE_SIZE];
+        uint32_t        m = 0, running = 0;
+
+        for(uint32_t k=0; k < n; k++)
+        {
+            if(have && codes[k] != RESUME_RUNNING)
+            {
+                out[k]    = codes[k];
+                counts[k] = (codes[k] == RESUME_INSIDE) ? s.max_iters + 1.0 : double(codes[k]);
+                continue;
+            }
+
+            orbits[m] = have ? *saved++ : resume::orbit_t{0.0, 0.0, 0, 0, ORBIT_RUNNING, 0};
+            cr[m]     = s.topleft_x + (t.x + (k % t.w)) * s.inc_re;
+            ci[m]     = s.topleft_y + (t.y + (k / t.w)) * s.inc_im;
+            where[m]  = k;
+            m++;
+        }
+
+        if(have)
+            c.resumed += m;
+        if(m > 0)
+            step(cr, ci, m, orbits);
+
+        // running orbits are packed to the front in pixel order
+        for(uint32_t j=0; j < m; j++)
+        {
+            const resume::orbit_t& o = orbits[j];
+            uint32_t k = where[j];
+
+            if(o.state == ORBIT_ESCAPED)
+            {
+                out[k]    = o.n;
+                counts[k] = double(o.n);
+                continue;
+            }
+
+            counts[k] = s.max_iters + 1.0;
+            out[k]    = (o.state == ORBIT_INSIDE) ? RESUME_INSIDE : RESUME_RUNNING;
+            if(o.state == ORBIT_RUNNING)
+                orbits[running++] = o;
+        }
+
+        c.to->put_tile(t.x, t.y, t.w, t.h, out, orbits, running);
+    }
+
+
+    /*
+     * Build the tile function for a render: fill in the tile's
+     * counts with the selected strategy, then shade them. `what`
+     * names the formula and numeric path for the tile cache; when
+     * a cache is set, tiles found there aren't iterated at all.
+     * With a continuation file every pixel goes through `step`
+     * instead, so its orbit can be saved. Supersampling then
+     * refines the edges of every tile, cached or not.
+     */
+    TileFunc shade(const opts::Settings& s, const BatchFunc& batch, const std::string& what,
+                   const ResumeFunc& step)
+    {
+        strategy::Strategy_t fill = strategy::all[s.strategy].func;
+
+        // a cache of the render's own trims itself when the last copy
+        // of the tile function goes away at the end of the render
+        std::shared_ptr<cache::TileCache> tc;
+        std::string view;
+        if(!s.cache_dir.empty())
+        {
+            tc   = s.tiles ? s.tiles
+                           : std::make_shared<cache::TileCache>(s.cache_dir, uint64_t(s.cache_mb) << 20, s.verbose);
+            view = view_key(s, what) + "|" + std::to_string(s.max_iters);
+        }
+
+        std::shared_ptr<carry_t> cont;
+        if(!s.resume.empty())
+        {
+            if(!step)
+            {
+                std::cerr << "Error: only float, double and deep zoom renders can be continued" << std::endl;
+                exit(1);
+            }
+            cont = carry(s, what);
+        }
+
+        std::shared_ptr<colors::Palette> palette;
+        std::shared_ptr<aa::Tally>       tally;
+        if(s.supersample > 0)
+        {
+            palette = std::make_shared<colors::Palette>(colors::all[s.colormap]);
+            tally   = std::make_shared<aa::Tally>(s.verbose);
+        }
+
+        return [&s, batch, step, fill, tc, view, cont, palette, tally](const tile_t& t, float* out, uint8_t* over, size_t stride)
+        {
+            double counts[TILE_SIZE * TILE_SIZE];
+            std::string key;
+
+            bool cached = false;
+            if(tc)
+            {
+                key = view + "|" + std::to_string(t.x) + "," + std::to_string(t.y)
+                           + "," + std::to_string(t.w) + "," + std::to_string(t.h);
+                cached = tc->load(key, counts, t.w * t.h);
+            }
+
+            if(cont)
+                continue_tile(s, t, step, *cont, counts);
+            else if(!cached)
+            {
+                fill(s, t, batch, counts);
+                if(tc)
+                    tc->store(key, counts, t.w * t.h);
+            }
+
+            store_tile(t, counts, out, stride, s.max_iters);
+            if(over != NULL && palette)
+                aa::refine(s, t, batch, counts, *palette, over, stride, *tally);
+        };
+    }
+
+
+    /*
+     * Render a frame through a kernel taking points of `grid`:
+     * progressively in passes when asked to, otherwise streamed
+     * in bands of shaded tiles
+     */
+    int draw(opts::Settings& s, pool::ThreadPool& tp, const opts::Settings& grid,
+             const BatchFunc& batch, const std::string& what, const ResumeFunc& step)
+    {
+        if(s.progressive)
+            return progressive::render(s, grid, batch, tp);
+        return render_bands(s, shade(grid, batch, what, step), tp);
+    }
+
+
+    /*
+     * Store a tile's counts normalized by the iteration limit, so
+     * escaping points fall in [0, 1] and the inside is above 1
+     */
+    void store_tile(const tile_t& t, const double* counts, float* out, size_t stride, uint32_t limit)
+    {
+        for(uint32_t y=0; y < t.h; y++)
+        {
+            float* px = out + (y * stride);
+            for(uint32_t x=0; x < t.w; x++)
+                *px++ = float(counts[(y * t.w) + x] / limit);
+        }
+    }
+
+
+    /*
+     * The batch function of the vector kernels, for the float
+     * and double tiers which take absolute plane coordinates
+     */
+    BatchFunc mandel_batch(uint32_t tier, uint32_t flags, uint32_t limit)
+    {
+        if(tier == PRECISION_FLOAT)
+            return [flags, limit](const double* cr, const double* ci, uint32_t n, double* out)
+            {
+                simd::iterate_mf(cr, ci, n, out, flags, limit);
+            };
+
+        return [flags, limit](const double* cr, const double* ci, uint32_t n, double* out)
+        {
+            simd::iterate_m(cr, ci, n, out, flags, limit);
+        };
+    }
+
+
+    /*
+     * The same kernels carrying on saved orbits
+     */
+    ResumeFunc mandel_resume(uint32_t tier, uint32_t flags, uint32_t limit)
+    {
+        if(tier == PRECISION_FLOAT)
+            return [flags, limit](const double* cr, const double* ci, uint32_t n, resume::orbit_t* orb)
+            {
+                simd::resume_mf(cr, ci, n, orb, flags, limit);
+            };
+
+        return [flags, limit](const double* cr, const double* ci, uint32_t n, resume::orbit_t* orb)
+        {
+            simd::resume_m(cr, ci, n, orb, flags, limit);
+        };
+    }
+
+
+    /*
+     * Deep zoom Mandelbrot render. The tiles are fed offsets from
+     * the view center rather than absolute coordinates, which stay
+     * representable at any zoom a double can express.
+     */
+    int mandelbrot_deep(opts::Settings& s, pool::ThreadPool& tp)
+    {
+        deep::Reference ref(s);
+        if(!ref.ok)
+            return 1;
+        if(s.verbose)
+        {
+            std::cout << "Reference orbit:   " << ref.zr.size() - 1 << " iterations, "
+                      << deep::precision_bits(s.zoom) << " bits" << std::endl;
+            std::cout << "Series skip:       " << ref.skip << " iterations" << std::endl;
+        }
+
+        opts::Settings ds = centered(s);
+        return draw(s, tp, ds, [&ref](const double* dcr, const double* dci, uint32_t n, double* out)
+        {
+            deep::iterate(ref, dcr, dci, n, out);
+        }, "mandel deep " + center_key(s), [&ref](const double* dcr, const double* dci, uint32_t n, resume::orbit_t* orb)
+        {
+            deep::resume(ref, dcr, dci, n, orb);
+        });
+    }
+
+
+    /*
+     * The batch function of the double-double and GMP tiers, which
+     * take offsets from the view center: the offsets are added to
+     * the center in the tier's own type before iterating. Empty if
+     * the center doesn't parse.
+     */
+    BatchFunc offset_batch(const opts::Settings& s, uint32_t tier)
+    {
+#ifdef DGMP
+        if(tier == PRECISION_MP)
+        {
+            mpf_set_default_prec(deep::precision_bits(s.zoom));
+
+            std::shared_ptr<MpCmp> center = std::make_shared<MpCmp>();
+            if(!center_mp(s, *center))
+                return BatchFunc();
+
+            uint32_t limit = s.max_iters;
+            return [center, limit](const double* dcr, const double* dci, uint32_t n, double* out)
+            {
+                MpCmp z, c, d;
+                for(uint32_t k=0; k < n; k++)
+                {
+                    d.set(dcr[k], dci[k]);
+                    c.set(*center);
+                    c.add(d);
+                    z.set(0.0, 0.0);
+                    out[k] = iterate_m(z, c, limit);
+                }
+            };
+        }
+#endif
+
+        DDouble cr, ci;
+        if(!center_dd(s, cr, ci))
+            return BatchFunc();
+
+        uint32_t flags = s.kernel_flags;
+        uint32_t limit = s.max_iters;
+        return [cr, ci, flags, limit](const double* dcr, const double* dci, uint32_t n, double* out)
+        {
+            for(uint32_t k=0; k < n; k++)
+            {
+                Complex<DDouble> z(0.0, 0.0);
+                Complex<DDouble> c(cr + DDouble(dcr[k]), ci + DDouble(dci[k]));
+                out[k] = iterate_m(z, c, limit, flags);
+            }
+        };
+    }
+
+
+    /*
+     * Double-double Mandelbrot render, for zooms just past what a
+     * double resolves. Like the GMP path the tiles get offsets from
+     * the center, which are added on in double-double.
+     */
+    int mandelbrot_dd(opts::Settings& s, pool::ThreadPool& tp)
+    {
+        BatchFunc batch = offset_batch(s, PRECISION_DD);
+        if(!batch)
+            return 1;
+
+        opts::Settings ds = centered(s);
+        return draw(s, tp, ds, batch, "mandel dd " + center_key(s));
+    }
+
+
+    /*
+     * Arbitrary precision Mandelbrot render, every pixel is iterated
+     * with MpCmp at a precision that follows the zoom level
+     */
+    int mandelbrot_gmp(opts::Settings& s, pool::ThreadPool& tp)
+    {
+#ifdef DGMP
+        BatchFunc batch = offset_batch(s, PRECISION_MP);
+        if(!batch)
+            return 1;
+
+        opts::Settings ds = centered(s);
+        return draw(s, tp, ds, batch, "mandel mp " + center_key(s));
+#else
+        std::cerr << "Error: built without GMP support" << std::endl;
+        return 1;
+#endif
+    }
+
+
+    /*
+     * Render one Mandelbrot frame with the numeric type its view
+     * needs, on an existing pool
+     */
+    int mandelbrot_frame(opts::Settings& s, pool::ThreadPool& tp)
+    {
+        if(s.stats)
+            s.stats->begin(PHASE_SETUP);
+        if(s.deep)
+            return mandelbrot_deep(s, tp);
+
+        uint32_t tier = precision::choose(s);
+        if(s.verbose)
+            std::cout << "Iterating in:      " << precision::all[tier].name << std::endl;
+
+        if(tier == PRECISION_MP)
+            return mandelbrot_gmp(s, tp);
+        if(tier == PRECISION_DD)
+            return mandelbrot_dd(s, tp);
+
+        // rows of the tile go through the vector kernel
+        return draw(s, tp, s, mandel_batch(tier, s.kernel_flags, s.max_iters),
+                    std::string("mandel ") + precision::all[tier].name,
+                    mandel_resume(tier, s.kernel_flags, s.max_iters));
+    }
+
+
+    /*
+     * The statistics report of the program's renders, if one was
+     * asked for; hardware counters imply one
+     */
+    static std::unique_ptr<stats::Report> open_report(opts::Settings& s)
+    {
+        std::unique_ptr<stats::Report> report;
+        if(s.counters)
+        {
+            perf::start();
+            if(s.stats_format == STATS_OFF)
+                s.stats_format = STATS_TABLE;
+        }
+
+        if(s.stats_format != STATS_OFF)
+        {
+            report.reset(new stats::Report(s.stats_format, s.threads));
+            s.stats = report.get();
+        }
+        return report;
+    }
+
+
+    /*
+     * Main mandelbrot rendering function
+     * Accepts a Settings ref and renders
+     * the Mandelbrot set of f(z) = z^2 + c
+     */
+    int mandelbrot(opts::Settings& s)
+    {
+        if(s.threads == 0)
+            s.threads = pool::default_threads();
+        if(s.fname.empty())
+            s.fname = "./mandelbrot.ppm";
+        s.label = "mandelbrot z^2+c";
+        s.display_info();
+        if(s.verbose)
+            std::cout << "Kernel:            " << simd::isa_name() << std::endl;
+
+        // printed once the pool and every render are done
+        std::unique_ptr<stats::Report> report = open_report(s);
+
+        // one pool serves every frame of an animation
+        pool::ThreadPool tp(s.threads);
+        if(!s.recolor.empty())
+            return recolor(s, tp);
+        if(s.frames > 0)
+            return anim::mandelbrot(s, tp);
+        return mandelbrot_frame(s, tp);
     }
 
 
@@ -134,51 +919,119 @@ namespace render
      */
     int julia(opts::Settings& s)
     {
+        if(s.threads == 0)
+            s.threads = pool::default_threads();
+        if(s.fname.empty())
+            s.fname = "./julia.ppm";
         s.display_info();
-        uint32_t w     = s.res->width;
-        uint32_t h     = s.res->height;
-
-        double init_re = s.topleft_x;
-        double init_im = s.topleft_y;
-        double inc_re  = s.inc_re;
-        double inc_im  = s.inc_im;
-
-        // example constants to use for C
-        double c_re    = -0.8;
-        double c_im    = 0.156;
-        
-        Cmp       z(0, 0);
+
+        std::unique_ptr<stats::Report> report = open_report(s);
+
+        pool::ThreadPool tp(s.threads);
+        if(!s.recolor.empty())
+            return recolor(s, tp);
+        return julia_frame(s, tp);
+    }
+
+
+    /*
+     * Render one Julia frame of the settings' formula and
+     * constant, on an existing pool
+     */
+    int julia_frame(opts::Settings& s, pool::ThreadPool& tp)
+    {
+        if(s.stats)
+            s.stats->begin(PHASE_SETUP);
+
+        double c_re    = s.seed_cr;
+        double c_im    = s.seed_ci;
         const Cmp c(c_re, c_im);
-        Cmp       pos(init_re, init_im);
-        Cmp       xbump(inc_re, 0), ybump(0, inc_im);
 
-        std::ofstream* ofs = create_image("./julia.ppm", s);
+        // the formula's compiled loop, picked once for the whole render
+        const funcs::JuliaFunc* picked = &funcs::all[s.function];
 
-        // pick a function from the pre-defined func pointers
-        const funcs::JuliaFunc* picked = &funcs::all[0];
+        // the formula and constant as they go into tile cache keys
+        std::ostringstream fk;
+        fk << std::hexfloat << (s.formula.empty() ? std::string(picked->name) : s.formula)
+           << " " << c_re << "," << c_im;
+        std::string fkey = fk.str();
+        std::ostringstream label;
+        label << "julia " << (s.formula.empty() ? std::string(picked->name) : s.formula)
+              << ", c = " << c_re << "," << c_im;
+        s.label = label.str();
 
-        double i = 0.0;
-        uint8_t result = 0;
+        // a user formula is compiled to bytecode once up front
+        expr::Program prog;
+        std::string   error;
+        if(!s.formula.empty() && !expr::compile(s.formula, prog, error))
+        {
+            std::cerr << "Error: bad function '" << s.formula << "': " << error << std::endl;
+            return 1;
+        }
 
-        for(uint32_t y=0; y < h; y++)
+        // Julia only has double and GMP kernels so far: float views
+        // run in double and anything deeper goes to GMP
+        uint32_t tier = precision::choose(s);
+        if(s.verbose)
+            std::cout << "Iterating in:      "
+                      << precision::all[(tier >= PRECISION_DD && s.formula.empty()) ? PRECISION_MP : PRECISION_DOUBLE].name << std::endl;
+
+        if(tier >= PRECISION_DD && !s.formula.empty())
         {
-            for(uint32_t x=0; x < w; x++)
+            // the bytecode only runs in double
+            if(s.precision != PRECISION_AUTO)
             {
-                z.real = pos.real;
-                z.imag = pos.imag;
+                std::cerr << "Error: user functions only run in double precision" << std::endl;
+                return 1;
+            }
+            std::cerr << "Warning: user functions run in double precision" << std::endl;
+        }
+        else if(tier >= PRECISION_DD)
+        {
+#ifdef DGMP
+            mpf_set_default_prec(deep::precision_bits(s.zoom));
 
-                i = iterate_j(z, c, picked->func);
+            MpCmp center, mc(c_re, c_im);
+            if(!center_mp(s, center))
+                return 1;
 
-                result = colors::flatten(i);
-                *ofs << result << result << result;
-                pos.add(xbump);
+            opts::Settings ds = centered(s);
+            uint32_t power = picked->power;
+            uint32_t limit = s.max_iters;
+            return draw(s, tp, ds, [&center, &mc, power, limit](const double* dzr, const double* dzi, uint32_t n, double* out)
+            {
+                MpCmp z, d;
+                for(uint32_t k=0; k < n; k++)
+                {
+                    d.set(dzr[k], dzi[k]);
+                    z.set(center);
+                    z.add(d);
+                    out[k] = iterate_j(z, mc, power, limit);
+                }
+            }, "julia mp " + fkey + " " + center_key(s));
+#else
+            if(s.precision != PRECISION_AUTO)
+            {
+                std::cerr << "Error: built without GMP support" << std::endl;
+                return 1;
             }
-            pos.real = init_re;
-            pos.add(ybump);
+            std::cerr << "Warning: built without GMP, the view is"
+                      << " rendered in double precision" << std::endl;
+#endif
         }
 
-        ofs->close();
-        return 0;
+        uint32_t limit = s.max_iters;
+        if(!s.formula.empty())
+            return draw(s, tp, s, [&c, &prog, limit](const double* zr, const double* zi, uint32_t n, double* out)
+            {
+                prog.iterate(c, zr, zi, n, out, J_BREAKOUT, limit);
+            }, "julia double " + fkey);
+
+        funcs::JBatch_t batch = picked->batch;
+        return draw(s, tp, s, [&c, batch, limit](const double* zr, const double* zi, uint32_t n, double* out)
+        {
+            batch(c, zr, zi, n, out, limit);
+        }, "julia double " + fkey);
     }
 }
 
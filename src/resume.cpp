@@ -0,0 +1,287 @@
+/*
+ * resume.cpp
+ *
+ * Writing and mapping continuation files. Tiles arrive from every
+ * worker in whatever order they finish, so the writer appends each
+ * one under a lock and remembers where it went; the index goes at
+ * the end once the tile count is known, and the header is filled
+ * in last.
+ */
+
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "include/resume.h"
+#include "include/cache.h"
+
+namespace resume
+{
+    /*
+     * Bytes of a tile's codes, padded so its orbits stay aligned
+     */
+    static size_t code_bytes(uint32_t w, uint32_t h)
+    {
+        return ((size_t(w) * h + 1) & ~size_t(1)) * sizeof(uint32_t);
+    }
+
+
+    /*
+     * The fixed header for a view, identified by a hash of
+     * everything its pixels depend on
+     */
+    resume_header_t header(const std::string& view, uint32_t width, uint32_t height,
+                           uint32_t band, uint32_t limit)
+    {
+        resume_header_t hdr;
+        memset(&hdr, 0, sizeof(hdr));
+
+        memcpy(hdr.magic, RESUME_MAGIC, 4);
+        hdr.version   = RESUME_VERSION;
+        hdr.width     = width;
+        hdr.height    = height;
+        hdr.band      = band;
+        hdr.limit     = limit;
+        hdr.index     = RESUME_HEADER_SIZE;
+        hdr.view_hash = cache::fnv1a(view);
+        strncpy(hdr.view, view.c_str(), sizeof(hdr.view) - 1);
+        return hdr;
+    }
+
+
+    /*
+     * Open the file under a temporary name and reserve the header
+     */
+    Writer::Writer(const std::string& p, const resume_header_t& hdr, uint32_t tiles, bool v)
+    {
+        path     = p;
+        part     = p + ".part";
+        info     = hdr;
+        expected = tiles;
+        verbose  = v;
+        failed   = false;
+        offset   = RESUME_HEADER_SIZE;
+        index.reserve(tiles);
+
+        fd = ::open(part.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0)
+        {
+            std::cerr << "Error: cannot open " << part << ": " << strerror(errno) << std::endl;
+            failed = true;
+            return;
+        }
+
+        std::vector<uint8_t> blank(RESUME_HEADER_SIZE, 0);
+        put(blank.data(), blank.size());
+    }
+
+
+    Writer::~Writer()
+    {
+        close();
+    }
+
+
+    /*
+     * Append everything, retrying short writes
+     */
+    void Writer::put(const void* data, size_t len)
+    {
+        const uint8_t* p = (const uint8_t*)data;
+        while(len > 0 && !failed)
+        {
+            ssize_t n = ::write(fd, p, len);
+            if(n < 0)
+            {
+                if(errno == EINTR)
+                    continue;
+                std::cerr << "Error: writing " << part << ": " << strerror(errno) << std::endl;
+                failed = true;
+                return;
+            }
+            p   += n;
+            len -= n;
+        }
+    }
+
+
+    void Writer::put_tile(uint32_t x, uint32_t y, uint32_t w, uint32_t h,
+                          const uint32_t* codes, const orbit_t* orbits, uint32_t running)
+    {
+        std::lock_guard<std::mutex> hold(lock);
+        if(failed)
+            return;
+
+        const uint32_t pad = 0;
+        index.push_back(resume_tile_t{x, y, w, h, running, 0, offset});
+        put(codes, size_t(w) * h * sizeof(uint32_t));
+        if((size_t(w) * h) & 1)
+            put(&pad, sizeof(pad));
+        put(orbits, size_t(running) * sizeof(orbit_t));
+        offset += code_bytes(w, h) + (size_t(running) * sizeof(orbit_t));
+        info.running += running;
+    }
+
+
+    /*
+     * Write the index and header and move the file into place,
+     * returns false (leaving any previous file alone) if anything
+     * went wrong or the render didn't finish
+     */
+    bool Writer::close()
+    {
+        std::lock_guard<std::mutex> hold(lock);
+        if(fd < 0)
+            return !failed;
+
+        if(!failed && index.size() != expected)
+        {
+            std::cerr << "Warning: the render didn't finish, " << path << " was not updated" << std::endl;
+            failed = true;
+        }
+
+        if(!failed)
+        {
+            size_t ilen = index.size() * sizeof(resume_tile_t);
+            info.tiles = index.size();
+            info.index = offset;
+
+            std::vector<uint8_t> hdr(RESUME_HEADER_SIZE, 0);
+            memcpy(hdr.data(), &info, sizeof(info));
+
+            if(::pwrite(fd, index.data(), ilen, offset) != ssize_t(ilen)
+               || ::pwrite(fd, hdr.data(), hdr.size(), 0) != ssize_t(hdr.size()))
+            {
+                std::cerr << "Error: writing " << part << ": " << strerror(errno) << std::endl;
+                failed = true;
+            }
+            offset += ilen;
+        }
+
+        if(::close(fd) != 0)
+            failed = true;
+        fd = -1;
+
+        if(!failed && ::rename(part.c_str(), path.c_str()) != 0)
+        {
+            std::cerr << "Error: cannot move " << part << " to " << path << ": " << strerror(errno) << std::endl;
+            failed = true;
+        }
+        if(failed)
+        {
+            ::unlink(part.c_str());
+            return false;
+        }
+
+        if(verbose)
+            std::cout << "Continuation:      " << path << ", " << info.running
+                      << " pixels still running at " << info.limit << " iterations" << std::endl;
+        return true;
+    }
+
+
+    bool Writer::ok() const
+    {
+        return !failed;
+    }
+
+
+    uint64_t Writer::bytes_written() const
+    {
+        return offset;
+    }
+
+
+    /*
+     * Map the file and check the header and index fit in it;
+     * tiles are checked as they're looked up
+     */
+    Reader::Reader(const std::string& p)
+    {
+        path   = p;
+        base   = NULL;
+        length = 0;
+        info   = NULL;
+
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0)
+        {
+            std::cerr << "Error: cannot open " << path << ": " << strerror(errno) << std::endl;
+            return;
+        }
+
+        struct stat st;
+        if(::fstat(fd, &st) == 0 && size_t(st.st_size) >= RESUME_HEADER_SIZE)
+        {
+            void* m = ::mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if(m != MAP_FAILED)
+            {
+                base   = (const uint8_t*)m;
+                length = st.st_size;
+            }
+        }
+        ::close(fd);
+
+        const resume_header_t* h = (const resume_header_t*)base;
+        if(base == NULL || memcmp(h->magic, RESUME_MAGIC, 4) != 0 || h->version != RESUME_VERSION)
+        {
+            std::cerr << "Error: " << path << " is not a continuation file" << std::endl;
+            return;
+        }
+
+        if(h->index < RESUME_HEADER_SIZE || h->index + (uint64_t(h->tiles) * sizeof(resume_tile_t)) > length)
+        {
+            std::cerr << "Error: " << path << " has a broken header" << std::endl;
+            return;
+        }
+
+        const resume_tile_t* list = (const resume_tile_t*)(base + h->index);
+        for(uint32_t k=0; k < h->tiles; k++)
+            tiles[(uint64_t(list[k].x) << 32) | list[k].y] = &list[k];
+        info = h;
+    }
+
+
+    Reader::~Reader()
+    {
+        if(base != NULL)
+            ::munmap((void*)base, length);
+    }
+
+
+    bool Reader::ok() const
+    {
+        return info != NULL;
+    }
+
+
+    const resume_header_t& Reader::header() const
+    {
+        return *info;
+    }
+
+
+    bool Reader::tile(uint32_t x, uint32_t y, uint32_t w, uint32_t h,
+                      const uint32_t** codes, const orbit_t** orbits) const
+    {
+        auto found = tiles.find((uint64_t(x) << 32) | y);
+        if(info == NULL || found == tiles.end())
+            return false;
+
+        const resume_tile_t& e = *found->second;
+        uint64_t bytes = code_bytes(w, h) + (uint64_t(e.running) * sizeof(orbit_t));
+        if(e.w != w || e.h != h || e.offset + bytes > length)
+            return false;
+
+        *codes  = (const uint32_t*)(base + e.offset);
+        *orbits = (const orbit_t*)(base + e.offset + code_bytes(w, h));
+        return true;
+    }
+}
+
+// end
@@ -0,0 +1,765 @@
+/*
+ * server.cpp
+ *
+ * The accept loop hands every connection to a thread of its own,
+ * which reads the request head, builds the render's settings from
+ * the server's and answers with the image. The response head goes
+ * out before the render starts and the image sink writes straight
+ * to the socket, so the first band reaches the client while the
+ * rest are still being iterated. The body ends when the connection
+ * is closed, there is no Content-Length.
+ *
+ * GMP keeps its precision in a process wide default, so renders
+ * that go through it (deep zoom and the arbitrary precision tier)
+ * take turns; everything else runs side by side.
+ */
+
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cmath>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+#include "include/server.h"
+#include "include/rendering.h"
+#include "include/resolutions.h"
+#include "include/colors.h"
+#include "include/functions.h"
+#include "include/precision.h"
+#include "include/expr.h"
+#include "include/stats.h"
+#include "include/cache.h"
+
+namespace server
+{
+    const ParamInfo params[] =
+    {
+        {"re",        "real part of the view center"},
+        {"im",        "imaginary part of the view center"},
+        {"zoom",      "magnification"},
+        {"size",      "output resolution, one of the --size names"},
+        {"iters",     "iterations before a point counts as inside"},
+        {"colors",    "color map: grey, fire or ocean"},
+        {"precision", "numeric type: auto, float, double, dd or mp (julia: auto, double or mp)"},
+        {"deep",      "1 for a perturbation render (mandelbrot only)"},
+        {"function",  "formula name or expression in z and c (julia only)"},
+        {"c",         "the Julia constant as re,im (julia only)"},
+        {"format",    "ppm or png (default: ppm)"},
+    };
+
+    const uint32_t PARAM_COUNT = sizeof(params) / sizeof(params[0]);
+
+
+    /*
+     * The request parameters, also the body of GET /
+     */
+    static std::string listing()
+    {
+        std::ostringstream o;
+        o << "Render requests: GET /mandelbrot?... or GET /julia?..." << std::endl;
+        o << "Parameters available: " << std::endl;
+        for(uint32_t k=0; k < PARAM_COUNT; k++)
+            o << " -- " << std::left << std::setw(10) << params[k].name << params[k].help << std::endl;
+        return o.str();
+    }
+
+
+    void print_all()
+    {
+        std::cout << listing();
+    }
+
+
+    // set by SIGINT and SIGTERM, the accept loop checks it
+    static volatile sig_atomic_t stopping = 0;
+
+    static void on_signal(int)
+    {
+        stopping = 1;
+    }
+
+
+    /*
+     * What the connection threads share
+     */
+    typedef struct state_t
+    {
+        const opts::Settings*   base;
+        pool::ThreadPool*       tp;
+        std::mutex              lock;
+        std::condition_variable idle;
+        uint32_t                clients;
+        uint32_t                served;
+        std::mutex              gmp;
+    } state_t;
+
+
+    /*
+     * Send all of the data, false once the client is gone
+     */
+    static bool send_all(int fd, const std::string& data)
+    {
+        size_t at = 0;
+        while(at < data.size())
+        {
+            ssize_t n = ::send(fd, data.data() + at, data.size() - at, MSG_NOSIGNAL);
+            if(n < 0)
+            {
+                if(errno == EINTR)
+                    continue;
+                return false;
+            }
+            at += n;
+        }
+        return true;
+    }
+
+
+    static const char* reason(int status)
+    {
+        switch(status)
+        {
+        case 200: return "OK";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 503: return "Service Unavailable";
+        default:  return "Internal Server Error";
+        }
+    }
+
+
+    /*
+     * A whole response with a plain text body
+     */
+    static void respond(int fd, int status, const std::string& body)
+    {
+        std::ostringstream r;
+        r << "HTTP/1.0 " << status << " " << reason(status) << "\r\n"
+          << "Content-Type: text/plain\r\n"
+          << "Content-Length: " << body.size() << "\r\n";
+        if(status == 405)
+            r << "Allow: GET\r\n";
+        r << "Connection: close\r\n\r\n" << body;
+        send_all(fd, r.str());
+    }
+
+
+    /*
+     * Read up to the blank line ending the request head,
+     * false if it's too long or the client stalls or leaves
+     */
+    static bool read_head(int fd, std::string& head)
+    {
+        char buf[1024];
+        while(head.find("\r\n\r\n") == std::string::npos && head.find("\n\n") == std::string::npos)
+        {
+            if(head.size() >= SERVER_HEAD)
+                return false;
+
+            ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+            if(n < 0 && errno == EINTR)
+                continue;
+            if(n <= 0)
+                return false;
+            head.append(buf, n);
+        }
+        return true;
+    }
+
+
+    /*
+     * Undo %XX escapes. A '+' is kept as it is rather than read as
+     * a space, so formulas like z^2+c can go in unescaped.
+     */
+    static std::string decode(const std::string& in)
+    {
+        std::string out;
+        for(size_t k=0; k < in.size(); k++)
+        {
+            if(in[k] == '%' && k + 2 < in.size() && isxdigit((unsigned char)in[k + 1]) && isxdigit((unsigned char)in[k + 2]))
+            {
+                out += char(strtol(in.substr(k + 1, 2).c_str(), NULL, 16));
+                k   += 2;
+            }
+            else
+                out += in[k];
+        }
+        return out;
+    }
+
+
+    /*
+     * A finite decimal that the high precision paths can also read
+     */
+    static bool decimal(const std::string& v, double& out)
+    {
+        if(!opts::decimal(v))
+            return false;
+        out = strtod(v.c_str(), NULL);
+        return std::isfinite(out);
+    }
+
+
+    /*
+     * A whole number made of nothing but digits
+     */
+    static bool whole(const std::string& v, uint64_t& out)
+    {
+        if(v.empty() || v.size() > 10 || v.find_first_not_of("0123456789") != std::string::npos)
+            return false;
+        out = strtoull(v.c_str(), NULL, 10);
+        return true;
+    }
+
+
+    /*
+     * Apply one query parameter to the render's settings
+     */
+    static bool apply(const std::string& key, const std::string& val, opts::Settings& s,
+                      bool julia, std::string& format, std::string& error)
+    {
+        double   d = 0.0;
+        uint64_t n = 0;
+
+        if(key == "re" || key == "im")
+        {
+            // GMP doesn't take a leading '+'
+            std::string v = (!val.empty() && val[0] == '+') ? val.substr(1) : val;
+            if(!decimal(v, d))
+            {
+                error = "cannot parse the center value '" + val + "'";
+                return false;
+            }
+            if(key == "re")
+            {
+                s.init_real = d;
+                s.real_str  = v;
+            }
+            else
+            {
+                s.init_imag = d;
+                s.imag_str  = v;
+            }
+            return true;
+        }
+
+        if(key == "zoom")
+        {
+            if(!decimal(val, d) || d <= 0.0)
+            {
+                error = "negative or invalid zoom given";
+                return false;
+            }
+            s.zoom = d;
+            return true;
+        }
+
+        if(key == "iters")
+        {
+            if(!whole(val, n) || n == 0 || n > ITERS_LIMIT)
+            {
+                error = "the iteration limit must be between 1 and " + std::to_string(ITERS_LIMIT);
+                return false;
+            }
+            s.max_iters = n;
+            return true;
+        }
+
+        if(key == "size")
+        {
+            for(uint32_t ri=0; ri < RESOLUTION_COUNT; ri++)
+                if(val == reso::all[ri].name)
+                {
+                    s.res = &reso::all[ri];
+                    return true;
+                }
+            error = "given resolution not supported";
+            return false;
+        }
+
+        if(key == "colors")
+        {
+            for(uint32_t ci=0; ci < COLORMAP_COUNT; ci++)
+                if(val == colors::all[ci].name)
+                {
+                    s.colormap = ci;
+                    return true;
+                }
+            error = "given color map not supported";
+            return false;
+        }
+
+        if(key == "precision")
+        {
+            for(uint32_t pi=0; pi < precision::PRECISION_COUNT; pi++)
+                if(val == precision::all[pi].name)
+                {
+#ifndef DGMP
+                    if(pi == PRECISION_MP)
+                    {
+                        error = "built without GMP support";
+                        return false;
+                    }
+#endif
+                    if(julia && (pi == PRECISION_FLOAT || pi == PRECISION_DD))
+                    {
+                        error = "Julia sets only iterate in double or mp (or auto)";
+                        return false;
+                    }
+                    s.precision = pi;
+                    return true;
+                }
+            error = "given precision not supported";
+            return false;
+        }
+
+        if(key == "deep" && !julia)
+        {
+            if(val != "0" && val != "1")
+            {
+                error = "deep is either 0 or 1";
+                return false;
+            }
+            s.deep = (val == "1");
+            return true;
+        }
+
+        if(key == "function" && julia)
+        {
+            s.formula.clear();
+            for(uint32_t fi=0; fi < funcs::JFUNC_COUNT; fi++)
+                if(val == funcs::all[fi].name)
+                {
+                    s.function = fi;
+                    return true;
+                }
+
+            // anything else has to compile as an expression
+            expr::Program prog;
+            std::string   why;
+            if(!expr::compile(val, prog, why))
+            {
+                error = "bad function '" + val + "': " + why;
+                return false;
+            }
+            s.formula = val;
+            return true;
+        }
+
+        if(key == "c" && julia)
+        {
+            size_t comma = val.find(',');
+            double cr = 0.0, ci = 0.0;
+            if(comma == std::string::npos || !decimal(val.substr(0, comma), cr) || !decimal(val.substr(comma + 1), ci))
+            {
+                error = "the constant must be given as re,im";
+                return false;
+            }
+            s.seed_cr = cr;
+            s.seed_ci = ci;
+            return true;
+        }
+
+        if(key == "format")
+        {
+            if(val != "ppm" && val != "png")
+            {
+                error = "the format is either ppm or png";
+                return false;
+            }
+#ifndef DZLIB
+            if(val == "png")
+            {
+                error = "built without zlib, PNG output is not available";
+                return false;
+            }
+#endif
+            format = val;
+            return true;
+        }
+
+        error = "unknown parameter '" + key + "' for " + (julia ? "/julia" : "/mandelbrot");
+        return false;
+    }
+
+
+    /*
+     * Build the settings of a request target on top of the
+     * server's, returning the HTTP status to answer with
+     */
+    static int parse(const std::string& target, opts::Settings& s, bool& julia,
+                     std::string& format, std::string& error)
+    {
+        size_t      q    = target.find('?');
+        std::string path = decode(target.substr(0, q));
+        if(path == "/mandelbrot")
+            julia = false;
+        else if(path == "/julia")
+            julia = true;
+        else
+        {
+            error = "no such path " + path + ", renders are under /mandelbrot and /julia";
+            return 404;
+        }
+
+        std::string query = (q == std::string::npos) ? "" : target.substr(q + 1);
+        for(size_t at=0; at < query.size(); )
+        {
+            size_t amp = query.find('&', at);
+            if(amp == std::string::npos)
+                amp = query.size();
+            std::string pair = query.substr(at, amp - at);
+            at = amp + 1;
+            if(pair.empty())
+                continue;
+
+            size_t eq = pair.find('=');
+            std::string key = decode(pair.substr(0, eq));
+            std::string val = (eq == std::string::npos) ? "" : decode(pair.substr(eq + 1));
+            if(!apply(key, val, s, julia, format, error))
+                return 400;
+        }
+
+        // the view follows the center, zoom and size given
+        s.set_zoom(s.zoom);
+        return 200;
+    }
+
+
+    /*
+     * Whether the render goes through GMP and its global precision
+     */
+    static bool uses_gmp(const opts::Settings& s, bool julia)
+    {
+#ifdef DGMP
+        uint32_t tier = precision::choose(s);
+        if(julia)
+            return tier >= PRECISION_DD && s.formula.empty();
+        return s.deep || tier == PRECISION_MP;
+#else
+        (void)s;
+        (void)julia;
+        return false;
+#endif
+    }
+
+
+    /*
+     * Answer one request
+     */
+    static void handle(state_t& st, int fd, uint32_t id)
+    {
+        struct timeval tv;
+        tv.tv_sec  = SERVER_TIMEOUT;
+        tv.tv_usec = 0;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+        // a client that stops reading fails the image sink instead of
+        // holding its slot, the GMP lock and shutdown for good
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+        std::string head;
+        if(!read_head(fd, head))
+        {
+            respond(fd, 400, "Error: the request was incomplete or too long\n");
+            return;
+        }
+
+        std::istringstream line(head.substr(0, head.find_first_of("\r\n")));
+        std::string method, target;
+        line >> method >> target;
+
+        if(method != "GET")
+        {
+            respond(fd, 405, "Error: only GET is supported\n");
+            return;
+        }
+        if(target == "/")
+        {
+            respond(fd, 200, listing());
+            return;
+        }
+
+        opts::Settings s = *st.base;
+        bool           julia = false;
+        std::string    format = "ppm";
+        std::string    error;
+        int status = parse(target, s, julia, format, error);
+
+        std::ostringstream log;
+        log << std::left << std::setw(19) << ("Request " + std::to_string(id) + ":") << target << " ";
+        if(status != 200)
+        {
+            respond(fd, status, "Error: " + error + "\n");
+            if(st.base->verbose)
+                std::cout << log.str() << status << ", " << error << std::endl;
+            return;
+        }
+
+        // the sink writes to its own copy of the socket, the name
+        // only shows up in its messages and picks the format
+        s.fname     = "request " + std::to_string(id) + "." + format;
+        s.output_fd = fd;
+        s.verbose   = 0;
+
+        std::ostringstream r;
+        r << "HTTP/1.0 200 OK\r\n"
+          << "Content-Type: " << ((format == "png") ? "image/png" : "image/x-portable-pixmap") << "\r\n"
+          << "Connection: close\r\n\r\n";
+        if(!send_all(fd, r.str()))
+            return;
+
+        double start = stats::wall();
+        int    done;
+        {
+            std::unique_lock<std::mutex> g(st.gmp, std::defer_lock);
+            if(uses_gmp(s, julia))
+                g.lock();
+            done = julia ? render::julia_frame(s, *st.tp) : render::mandelbrot_frame(s, *st.tp);
+        }
+
+        if(st.base->verbose)
+            std::cout << log.str() << (done == 0 ? "200, " : "200, stopped early, ")
+                      << s.res->width << "x" << s.res->height << " in "
+                      << llround((stats::wall() - start) * 1e3) << " ms" << std::endl;
+    }
+
+
+    /*
+     * A connection's thread, the socket is closed once it's answered
+     */
+    static void client(state_t& st, int fd, uint32_t id)
+    {
+        handle(st, fd, id);
+        ::close(fd);
+
+        std::lock_guard<std::mutex> g(st.lock);
+        st.clients--;
+        st.idle.notify_all();
+    }
+
+
+    /*
+     * A port on localhost, given alone or as localhost:PORT
+     */
+    static bool is_port(const std::string& addr, uint16_t& port, bool& bad)
+    {
+        std::string p = addr;
+        if(p.compare(0, 10, "localhost:") == 0)
+            p = p.substr(10);
+        else if(p.find_first_not_of("0123456789") != std::string::npos)
+            return false;
+
+        uint64_t n = 0;
+        bad  = !whole(p, n) || n == 0 || n > 65535;
+        port = uint16_t(n);
+        return true;
+    }
+
+
+    /*
+     * Open the listening socket, a Unix one for anything that isn't
+     * a port. A stale socket left by a server that died is replaced,
+     * a live one is not.
+     */
+    static int listen_on(const std::string& addr, std::string& where, bool& unix_socket)
+    {
+        uint16_t port = 0;
+        bool     bad  = false;
+        int      fd;
+
+        unix_socket = !is_port(addr, port, bad);
+        if(!unix_socket)
+        {
+            if(bad)
+            {
+                std::cerr << "Error: invalid port in '" << addr << "'" << std::endl;
+                return -1;
+            }
+
+            fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            int on = 1;
+            if(fd >= 0)
+                setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+            struct sockaddr_in sa;
+            memset(&sa, 0, sizeof(sa));
+            sa.sin_family      = AF_INET;
+            sa.sin_port        = htons(port);
+            sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            if(fd < 0 || ::bind(fd, (struct sockaddr*)&sa, sizeof(sa)) != 0 || ::listen(fd, SOMAXCONN) != 0)
+            {
+                std::cerr << "Error: cannot listen on localhost:" << port << ": " << strerror(errno) << std::endl;
+                if(fd >= 0)
+                    ::close(fd);
+                return -1;
+            }
+
+            where = "http://localhost:" + std::to_string(port) + "/";
+            return fd;
+        }
+
+        struct sockaddr_un sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sun_family = AF_UNIX;
+        if(addr.size() >= sizeof(sa.sun_path))
+        {
+            std::cerr << "Error: the socket path " << addr << " is too long" << std::endl;
+            return -1;
+        }
+        memcpy(sa.sun_path, addr.c_str(), addr.size());
+
+        fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(fd < 0)
+        {
+            std::cerr << "Error: cannot open a socket: " << strerror(errno) << std::endl;
+            return -1;
+        }
+
+        struct stat st;
+        if(::lstat(addr.c_str(), &st) == 0)
+        {
+            if(!S_ISSOCK(st.st_mode))
+            {
+                std::cerr << "Error: " << addr << " exists and is not a socket" << std::endl;
+                ::close(fd);
+                return -1;
+            }
+            if(::connect(fd, (struct sockaddr*)&sa, sizeof(sa)) == 0)
+            {
+                std::cerr << "Error: " << addr << " is already being served" << std::endl;
+                ::close(fd);
+                return -1;
+            }
+
+            // connect() may have left the socket unusable for bind()
+            ::close(fd);
+            ::unlink(addr.c_str());
+            fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        }
+
+        if(fd < 0 || ::bind(fd, (struct sockaddr*)&sa, sizeof(sa)) != 0 || ::listen(fd, SOMAXCONN) != 0)
+        {
+            std::cerr << "Error: cannot listen on " << addr << ": " << strerror(errno) << std::endl;
+            if(fd >= 0)
+                ::close(fd);
+            return -1;
+        }
+
+        where = "unix:" + addr;
+        return fd;
+    }
+
+
+    int run(opts::Settings& s)
+    {
+        if(s.threads == 0)
+            s.threads = pool::default_threads();
+
+        std::string where;
+        bool        unix_socket = false;
+        int         lfd = listen_on(s.serve, where, unix_socket);
+        if(lfd < 0)
+            return 1;
+
+        // a client hanging up mid image is an error on its socket,
+        // not the end of the server
+        signal(SIGPIPE, SIG_IGN);
+
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = on_signal;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGINT, &sa, NULL);
+        sigaction(SIGTERM, &sa, NULL);
+
+        // the pool every request renders on, and the tile cache
+        // they share, trimmed as it fills rather than per request
+        pool::ThreadPool tp(s.threads);
+        if(!s.cache_dir.empty())
+            s.tiles = std::make_shared<cache::TileCache>(s.cache_dir, uint64_t(s.cache_mb) << 20, s.verbose);
+
+        state_t st;
+        st.base    = &s;
+        st.tp      = &tp;
+        st.clients = 0;
+        st.served  = 0;
+
+        std::cout << "Listening on:      " << where << std::endl;
+        if(s.verbose)
+        {
+            std::cout << "Threads:           " << s.threads << std::endl;
+            std::cout << "Kernel:            " << simd::isa_name() << std::endl;
+            if(!s.cache_dir.empty())
+                std::cout << "Tile cache:        " << s.cache_dir << " (" << s.cache_mb << " MB)" << std::endl;
+            print_all();
+        }
+
+        while(!stopping)
+        {
+            // wake up now and then to see if a signal came in
+            struct pollfd p;
+            p.fd     = lfd;
+            p.events = POLLIN;
+            if(::poll(&p, 1, 250) <= 0)
+                continue;
+
+            int fd = ::accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+            if(fd < 0)
+                continue;
+
+            uint32_t id   = 0;
+            bool     full = false;
+            {
+                std::lock_guard<std::mutex> g(st.lock);
+                if(st.clients >= SERVER_CLIENTS)
+                    full = true;
+                else
+                {
+                    st.clients++;
+                    id = ++st.served;
+                }
+            }
+
+            if(full)
+            {
+                respond(fd, 503, "Error: too many renders at once, try again later\n");
+                ::close(fd);
+                continue;
+            }
+            std::thread(client, std::ref(st), fd, id).detach();
+        }
+
+        // let the renders in progress finish before the pool goes
+        ::close(lfd);
+        {
+            std::unique_lock<std::mutex> g(st.lock);
+            st.idle.wait(g, [&st]{ return st.clients == 0; });
+        }
+        if(unix_socket)
+            ::unlink(s.serve.c_str());
+        s.tiles.reset();
+
+        if(s.verbose)
+            std::cout << "Requests served:   " << st.served << std::endl;
+        return 0;
+    }
+}
+
+// end
@@ -0,0 +1,492 @@
+/*
+ * simd.cpp
+ *
+ * Escape-time kernels written with GCC vector extensions.
+ * One generic body is instantiated per vector width and compiled
+ * for each instruction set through target attributes, so the same
+ * binary runs everywhere and uses AVX2/AVX-512 where available.
+ *
+ * The arithmetic is done in exactly the same order as Cmp::mul,
+ * Cmp::add and Cmp::length2 so every lane produces the same count
+ * as the scalar render::iterate_m. The body is also templated on
+ * the lane type: the float instances run twice as many lanes per
+ * instruction for views shallow enough not to need a double.
+ */
+
+#include "include/simd.h"
+#include "include/rendering.h"
+
+namespace simd
+{
+    typedef double  v2df __attribute__((vector_size(16)));
+    typedef int64_t v2di __attribute__((vector_size(16)));
+    typedef double  v4df __attribute__((vector_size(32)));
+    typedef int64_t v4di __attribute__((vector_size(32)));
+    typedef double  v8df __attribute__((vector_size(64)));
+    typedef int64_t v8di __attribute__((vector_size(64)));
+
+    typedef float   v4sf __attribute__((vector_size(16)));
+    typedef int32_t v4si __attribute__((vector_size(16)));
+    typedef float   v8sf __attribute__((vector_size(32)));
+    typedef int32_t v8si __attribute__((vector_size(32)));
+    typedef float   v16sf __attribute__((vector_size(64)));
+    typedef int32_t v16si __attribute__((vector_size(64)));
+
+    thread_local uint64_t ran = 0;
+
+
+    /*
+     * Iterate one group of N lanes. Escaped lanes are frozen
+     * (their z stops changing) and stop accumulating counts;
+     * the group exits as soon as every lane has escaped.
+     *
+     * Cardioid: lanes inside the main cardioid or the period-2
+     * bulb are known interior points and never iterate.
+     * Periodic: Brent-style cycle detection, z is saved at every
+     * power of two and a lane whose orbit lands exactly back on
+     * the saved value is in a cycle. The comparison is exact, so
+     * a cycle found here would have repeated until the limit and
+     * the count is the same as a full iteration would give.
+     * E is the lane type, V/M the value and mask vectors of N lanes.
+     */
+    template<typename E, typename V, typename M, int N, bool Cardioid, bool Periodic>
+    static inline __attribute__((always_inline))
+    void mandel_group(const double* cr_in, const double* ci_in, double* out, uint32_t limit,
+                      uint64_t& steps, int lanes)
+    {
+        V cr, ci, zr, zi, count, saved_r, saved_i;
+        M active, hit, interior;
+
+        // the points always come in as doubles and are rounded
+        // to the lane type here
+        for(int l=0; l < N; l++)
+        {
+            cr[l] = E(cr_in[l]);
+            ci[l] = E(ci_in[l]);
+        }
+        const V zero = cr - cr;
+        const V four = zero + E(M_BREAKOUT);
+        const M one  = (M)(zero + E(1.0));
+        const M absmask = ~((M)(zero - E(1.0)) ^ (M)(zero + E(1.0)));
+        zr       = zero;
+        zi       = zero;
+        count    = zero;
+        active   = (M)(zero == zero);
+        interior = ~active;
+
+        if(Cardioid)
+        {
+            V xq = cr - E(0.25);
+            V y2 = ci * ci;
+            V q  = (xq * xq) + y2;
+            V xb = cr + E(1.0);
+            interior = (M)((q * (q + xq)) < (y2 * E(0.25)))
+                     | (M)(((xb * xb) + y2) < (zero + E(0.0625)));
+            active   = ~interior;
+        }
+
+        saved_r = zr;
+        saved_i = zi;
+        uint32_t check = 1;
+
+        for(uint32_t it=0; it <= limit; it++)
+        {
+            hit    = active & (M)((zr*zr) + (zi*zi) < four);
+            active = hit;
+
+            int any = 0;
+            for(int l=0; l < N; l++)
+                any |= (hit[l] != 0);
+            if(!any)
+                break;
+
+            // each entry into the loop body counts as one iteration,
+            // including the final failed check at the limit
+            count += (V)(one & hit);
+            if(it == limit)
+                break;
+
+            V r  = (zr * zr) - (zi * zi);
+            V i  = (zi * zr) + (zr * zi);
+            V nr = r + cr;
+            V ni = i + ci;
+            zr = (V)(((M)nr & hit) | ((M)zr & ~hit));
+            zi = (V)(((M)ni & hit) | ((M)zi & ~hit));
+
+            if(Periodic)
+            {
+                // |dr| + |di| is zero only when both are, and costs
+                // a single compare per iteration
+                V dr      = (V)((M)(zr - saved_r) & absmask);
+                V di      = (V)((M)(zi - saved_i) & absmask);
+                M cycle   = hit & (M)((dr + di) == zero);
+                interior |= cycle;
+                active   &= ~cycle;
+
+                if(it + 1 == check)
+                {
+                    saved_r = zr;
+                    saved_i = zi;
+                    check <<= 1;
+                }
+            }
+        }
+
+        // what the lanes really ran, before the fast exits are
+        // given the count of the inside (the failed check at the
+        // limit counts but doesn't step)
+        for(int l=0; l < lanes; l++)
+            steps += std::min(uint64_t(count[l]), uint64_t(limit));
+
+        if(Cardioid || Periodic)
+            count = (V)(((M)(zero + E(limit + 1.0)) & interior) | ((M)count & ~interior));
+
+        for(int l=0; l < N; l++)
+            out[l] = double(count[l]);
+    }
+
+
+    /*
+     * Walk a whole batch in groups of N, padding the tail group
+     * with copies of the last point
+     */
+    template<typename E, typename V, typename M, int N, bool Cardioid, bool Periodic>
+    static inline __attribute__((always_inline))
+    void mandel_batch(const double* cr, const double* ci, uint32_t n, double* out, uint32_t limit)
+    {
+        uint64_t steps = 0;
+        uint32_t k = 0;
+        for(; k + N <= n; k += N)
+            mandel_group<E, V, M, N, Cardioid, Periodic>(cr + k, ci + k, out + k, limit, steps, N);
+
+        if(k < n)
+        {
+            double tr[N], ti[N], to[N];
+            for(int l=0; l < N; l++)
+            {
+                uint32_t src = (k + l < n) ? k + l : n - 1;
+                tr[l] = cr[src];
+                ti[l] = ci[src];
+            }
+            mandel_group<E, V, M, N, Cardioid, Periodic>(tr, ti, to, limit, steps, n - k);
+            for(uint32_t l=0; k + l < n; l++)
+                out[k + l] = to[l];
+        }
+        ran += steps;
+    }
+
+
+    /*
+     * Resolve the fast-exit flags to one of the compiled variants
+     */
+    template<typename E, typename V, typename M, int N>
+    static inline __attribute__((always_inline))
+    void mandel_flags(const double* cr, const double* ci, uint32_t n, double* out, uint32_t flags, uint32_t limit)
+    {
+        switch(flags & (KERNEL_CARDIOID | KERNEL_PERIODIC))
+        {
+        case KERNEL_CARDIOID | KERNEL_PERIODIC:
+            mandel_batch<E, V, M, N, true,  true >(cr, ci, n, out, limit);
+            break;
+        case KERNEL_CARDIOID:
+            mandel_batch<E, V, M, N, true,  false>(cr, ci, n, out, limit);
+            break;
+        case KERNEL_PERIODIC:
+            mandel_batch<E, V, M, N, false, true >(cr, ci, n, out, limit);
+            break;
+        default:
+            mandel_batch<E, V, M, N, false, false>(cr, ci, n, out, limit);
+            break;
+        }
+    }
+
+
+    /*
+     * Carry on one group of N orbits from wherever each was left,
+     * so lanes start on different iterations and each one stops at
+     * the limit on its own. The arithmetic is the same as in
+     * mandel_group, which makes iterating to L1 and then carrying
+     * on to L2 give exactly the counts of going to L2 at once.
+     * Cycle detection starts over from the orbits as given; an
+     * exact repeat is a cycle wherever it's first seen.
+     */
+    template<typename E, typename V, typename M, int N, bool Cardioid, bool Periodic>
+    static inline __attribute__((always_inline))
+    void resume_group(const double* cr_in, const double* ci_in, resume::orbit_t* orb, uint32_t limit,
+                      uint64_t& steps, int lanes)
+    {
+        V cr, ci, zr, zi, count, saved_r, saved_i;
+        M active, hit, interior;
+
+        for(int l=0; l < N; l++)
+        {
+            cr[l]    = E(cr_in[l]);
+            ci[l]    = E(ci_in[l]);
+            zr[l]    = E(orb[l].zr);
+            zi[l]    = E(orb[l].zi);
+            count[l] = E(orb[l].n);
+        }
+        const V zero = cr - cr;
+        const V four = zero + E(M_BREAKOUT);
+        const V top  = zero + E(limit);
+        const M one  = (M)(zero + E(1.0));
+        const M absmask = ~((M)(zero - E(1.0)) ^ (M)(zero + E(1.0)));
+        M escaped = ~(M)(zero == zero);
+        active    = (M)(zero == zero);
+        interior  = escaped;
+
+        if(Cardioid)
+        {
+            V xq = cr - E(0.25);
+            V y2 = ci * ci;
+            V q  = (xq * xq) + y2;
+            V xb = cr + E(1.0);
+            interior = (M)((q * (q + xq)) < (y2 * E(0.25)))
+                     | (M)(((xb * xb) + y2) < (zero + E(0.0625)));
+            active   = ~interior;
+        }
+
+        saved_r = zr;
+        saved_i = zi;
+        uint32_t check = 1;
+
+        for(uint32_t it=0; ; it++)
+        {
+            hit      = active & (M)((zr*zr) + (zi*zi) < four);
+            escaped |= active & ~hit;
+
+            // lanes at the limit stay bounded with the z they have
+            active = hit & (M)(count < top);
+
+            int any = 0;
+            for(int l=0; l < N; l++)
+                any |= (active[l] != 0);
+            if(!any)
+                break;
+
+            count += (V)(one & active);
+
+            V r  = (zr * zr) - (zi * zi);
+            V i  = (zi * zr) + (zr * zi);
+            V nr = r + cr;
+            V ni = i + ci;
+            zr = (V)(((M)nr & active) | ((M)zr & ~active));
+            zi = (V)(((M)ni & active) | ((M)zi & ~active));
+
+            if(Periodic)
+            {
+                V dr      = (V)((M)(zr - saved_r) & absmask);
+                V di      = (V)((M)(zi - saved_i) & absmask);
+                M cycle   = active & (M)((dr + di) == zero);
+                interior |= cycle;
+                active   &= ~cycle;
+
+                if(it + 1 == check)
+                {
+                    saved_r = zr;
+                    saved_i = zi;
+                    check <<= 1;
+                }
+            }
+        }
+
+        for(int l=0; l < lanes; l++)
+            steps += uint32_t(count[l]) - orb[l].n;
+
+        for(int l=0; l < N; l++)
+        {
+            orb[l].zr    = double(zr[l]);
+            orb[l].zi    = double(zi[l]);
+            orb[l].n     = uint32_t(count[l]);
+            orb[l].state = interior[l] ? ORBIT_INSIDE : escaped[l] ? ORBIT_ESCAPED : ORBIT_RUNNING;
+        }
+    }
+
+
+    /*
+     * Walk a batch of orbits in groups of N, padding the tail
+     * group with copies of the last one
+     */
+    template<typename E, typename V, typename M, int N, bool Cardioid, bool Periodic>
+    static inline __attribute__((always_inline))
+    void resume_batch(const double* cr, const double* ci, uint32_t n, resume::orbit_t* orb, uint32_t limit)
+    {
+        uint64_t steps = 0;
+        uint32_t k = 0;
+        for(; k + N <= n; k += N)
+            resume_group<E, V, M, N, Cardioid, Periodic>(cr + k, ci + k, orb + k, limit, steps, N);
+
+        if(k < n)
+        {
+            double          tr[N], ti[N];
+            resume::orbit_t to[N];
+            for(int l=0; l < N; l++)
+            {
+                uint32_t src = (k + l < n) ? k + l : n - 1;
+                tr[l] = cr[src];
+                ti[l] = ci[src];
+                to[l] = orb[src];
+            }
+            resume_group<E, V, M, N, Cardioid, Periodic>(tr, ti, to, limit, steps, n - k);
+            for(uint32_t l=0; k + l < n; l++)
+                orb[k + l] = to[l];
+        }
+        ran += steps;
+    }
+
+
+    template<typename E, typename V, typename M, int N>
+    static inline __attribute__((always_inline))
+    void resume_flags(const double* cr, const double* ci, uint32_t n, resume::orbit_t* orb, uint32_t flags, uint32_t limit)
+    {
+        switch(flags & (KERNEL_CARDIOID | KERNEL_PERIODIC))
+        {
+        case KERNEL_CARDIOID | KERNEL_PERIODIC:
+            resume_batch<E, V, M, N, true,  true >(cr, ci, n, orb, limit);
+            break;
+        case KERNEL_CARDIOID:
+            resume_batch<E, V, M, N, true,  false>(cr, ci, n, orb, limit);
+            break;
+        case KERNEL_PERIODIC:
+            resume_batch<E, V, M, N, false, true >(cr, ci, n, orb, limit);
+            break;
+        default:
+            resume_batch<E, V, M, N, false, false>(cr, ci, n, orb, limit);
+            break;
+        }
+    }
+
+
+    static void mandel_sse2(const double* cr, const double* ci, uint32_t n, double* out, uint32_t flags, uint32_t limit)
+    {
+        mandel_flags<double, v2df, v2di, 2>(cr, ci, n, out, flags, limit);
+    }
+
+    static void resume_sse2(const double* cr, const double* ci, uint32_t n, resume::orbit_t* orb, uint32_t flags, uint32_t limit)
+    {
+        resume_flags<double, v2df, v2di, 2>(cr, ci, n, orb, flags, limit);
+    }
+
+    static void mandelf_sse2(const double* cr, const double* ci, uint32_t n, double* out, uint32_t flags, uint32_t limit)
+    {
+        mandel_flags<float, v4sf, v4si, 4>(cr, ci, n, out, flags, limit);
+    }
+
+    static void resumef_sse2(const double* cr, const double* ci, uint32_t n, resume::orbit_t* orb, uint32_t flags, uint32_t limit)
+    {
+        resume_flags<float, v4sf, v4si, 4>(cr, ci, n, orb, flags, limit);
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    __attribute__((target("avx2")))
+    static void mandel_avx2(const double* cr, const double* ci, uint32_t n, double* out, uint32_t flags, uint32_t limit)
+    {
+        mandel_flags<double, v4df, v4di, 4>(cr, ci, n, out, flags, limit);
+    }
+
+    __attribute__((target("avx2")))
+    static void resume_avx2(const double* cr, const double* ci, uint32_t n, resume::orbit_t* orb, uint32_t flags, uint32_t limit)
+    {
+        resume_flags<double, v4df, v4di, 4>(cr, ci, n, orb, flags, limit);
+    }
+
+    __attribute__((target("avx2")))
+    static void mandelf_avx2(const double* cr, const double* ci, uint32_t n, double* out, uint32_t flags, uint32_t limit)
+    {
+        mandel_flags<float, v8sf, v8si, 8>(cr, ci, n, out, flags, limit);
+    }
+
+    __attribute__((target("avx2")))
+    static void resumef_avx2(const double* cr, const double* ci, uint32_t n, resume::orbit_t* orb, uint32_t flags, uint32_t limit)
+    {
+        resume_flags<float, v8sf, v8si, 8>(cr, ci, n, orb, flags, limit);
+    }
+
+    __attribute__((target("avx512f")))
+    static void mandel_avx512(const double* cr, const double* ci, uint32_t n, double* out, uint32_t flags, uint32_t limit)
+    {
+        mandel_flags<double, v8df, v8di, 8>(cr, ci, n, out, flags, limit);
+    }
+
+    __attribute__((target("avx512f")))
+    static void resume_avx512(const double* cr, const double* ci, uint32_t n, resume::orbit_t* orb, uint32_t flags, uint32_t limit)
+    {
+        resume_flags<double, v8df, v8di, 8>(cr, ci, n, orb, flags, limit);
+    }
+
+    __attribute__((target("avx512f")))
+    static void mandelf_avx512(const double* cr, const double* ci, uint32_t n, double* out, uint32_t flags, uint32_t limit)
+    {
+        mandel_flags<float, v16sf, v16si, 16>(cr, ci, n, out, flags, limit);
+    }
+
+    __attribute__((target("avx512f")))
+    static void resumef_avx512(const double* cr, const double* ci, uint32_t n, resume::orbit_t* orb, uint32_t flags, uint32_t limit)
+    {
+        resume_flags<float, v16sf, v16si, 16>(cr, ci, n, orb, flags, limit);
+    }
+#endif
+
+
+    /*
+     * The kernel chosen for this CPU, picked once on first use
+     */
+    typedef struct kernel_t
+    {
+        const char*  name;
+        MandelRow_t  mandel;
+        MandelRow_t  mandelf;
+        ResumeRow_t  resume;
+        ResumeRow_t  resumef;
+    } kernel_t;
+
+    static kernel_t pick()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx512f"))
+            return kernel_t{"avx512", &mandel_avx512, &mandelf_avx512, &resume_avx512, &resumef_avx512};
+        if(__builtin_cpu_supports("avx2"))
+            return kernel_t{"avx2", &mandel_avx2, &mandelf_avx2, &resume_avx2, &resumef_avx2};
+#endif
+        return kernel_t{"sse2", &mandel_sse2, &mandelf_sse2, &resume_sse2, &resumef_sse2};
+    }
+
+    static const kernel_t& kernel()
+    {
+        static const kernel_t k = pick();
+        return k;
+    }
+
+
+    void iterate_m(const double* cr, const double* ci, uint32_t n, double* out, uint32_t flags, uint32_t limit)
+    {
+        kernel().mandel(cr, ci, n, out, flags, limit);
+    }
+
+
+    void iterate_mf(const double* cr, const double* ci, uint32_t n, double* out, uint32_t flags, uint32_t limit)
+    {
+        kernel().mandelf(cr, ci, n, out, flags, limit);
+    }
+
+
+    void resume_m(const double* cr, const double* ci, uint32_t n, resume::orbit_t* orb, uint32_t flags, uint32_t limit)
+    {
+        kernel().resume(cr, ci, n, orb, flags, limit);
+    }
+
+
+    void resume_mf(const double* cr, const double* ci, uint32_t n, resume::orbit_t* orb, uint32_t flags, uint32_t limit)
+    {
+        kernel().resumef(cr, ci, n, orb, flags, limit);
+    }
+
+
+    const char* isa_name()
+    {
+        return kernel().name;
+    }
+}
+
+// end
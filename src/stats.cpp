@@ -0,0 +1,415 @@
+/*
+ * stats.cpp
+ *
+ * Collecting and printing render statistics. Times are kept in
+ * whole nanoseconds so they can be summed with atomics; the list
+ * of tiles is the only thing behind a lock, taken once per tile.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <cmath>
+#include <time.h>
+
+#include "include/stats.h"
+#include "include/simd.h"
+
+namespace stats
+{
+    const FormatInfo all[] =
+    {
+        {"table", STATS_TABLE},
+        {"json",  STATS_JSON},
+    };
+    const uint32_t FORMAT_COUNT = sizeof(all) / sizeof(all[0]);
+
+    static const char* phase_names[PHASE_COUNT] =
+    {
+        "setup", "compute", "wait", "color", "output",
+    };
+
+
+    void print_all()
+    {
+        std::cout << "Statistics formats available: " << std::endl;
+        for(uint32_t k=0; k < FORMAT_COUNT; k++)
+            std::cout << " -- " << all[k].name << std::endl;
+    }
+
+
+    static double clock_seconds(clockid_t id)
+    {
+        struct timespec ts;
+        clock_gettime(id, &ts);
+        return ts.tv_sec + (ts.tv_nsec * 1e-9);
+    }
+
+    double wall() { return clock_seconds(CLOCK_MONOTONIC); }
+    double cpu()  { return clock_seconds(CLOCK_THREAD_CPUTIME_ID); }
+
+
+    stamp_t now()
+    {
+        stamp_t st;
+        perf::read(st.events);
+        st.wall = wall();
+        st.cpu  = cpu();
+        st.ran  = simd::ran;
+        return st;
+    }
+
+
+    static uint64_t to_ns(double seconds)
+    {
+        return (seconds > 0.0) ? uint64_t(llround(seconds * 1e9)) : 0;
+    }
+
+
+    Report::Report(uint32_t f, uint32_t n) : busy(new std::atomic<uint64_t>[n])
+    {
+        format     = f;
+        threads    = n;
+        start_wall = wall();
+        start_cpu  = clock_seconds(CLOCK_PROCESS_CPUTIME_ID);
+        escaped    = 0;
+        inside     = 0;
+        iterations = 0;
+        frames     = 0;
+
+        for(uint32_t p=0; p < PHASE_COUNT; p++)
+        {
+            wall_ns[p] = 0;
+            cpu_ns[p]  = 0;
+            opened[p]  = false;
+            for(uint32_t e=0; e < PERF_EVENTS; e++)
+                counted[p][e] = 0;
+        }
+        for(uint32_t b=0; b < STATS_BUCKETS; b++)
+            histogram[b] = 0;
+        for(uint32_t t=0; t < threads; t++)
+            busy[t] = 0;
+    }
+
+
+    Report::~Report()
+    {
+        if(format == STATS_JSON)
+            print_json();
+        else if(format == STATS_TABLE)
+            print_table();
+    }
+
+
+    uint64_t Report::ran() const
+    {
+        return iterations;
+    }
+
+
+    void Report::begin(uint32_t phase)
+    {
+        marks[phase]  = now();
+        opened[phase] = true;
+    }
+
+
+    void Report::end(uint32_t phase)
+    {
+        if(!opened[phase])
+            return;
+        add(phase, marks[phase]);
+        opened[phase] = false;
+    }
+
+
+    void Report::add(uint32_t phase, const stamp_t& since)
+    {
+        stamp_t at = now();
+        wall_ns[phase].fetch_add(to_ns(at.wall - since.wall), std::memory_order_relaxed);
+        cpu_ns[phase].fetch_add(to_ns(at.cpu - since.cpu), std::memory_order_relaxed);
+        for(uint32_t e=0; e < PERF_EVENTS; e++)
+            counted[phase][e].fetch_add(at.events.value[e] - since.events.value[e], std::memory_order_relaxed);
+    }
+
+
+    void Report::tile(uint32_t id, uint32_t x, uint32_t y, uint32_t w, uint32_t h,
+                      const float* px, size_t stride, uint32_t limit, const stamp_t& since)
+    {
+        double took = wall() - since.wall;
+        add(PHASE_COMPUTE, since);
+
+        uint64_t hist[STATS_BUCKETS] = {0};
+        uint64_t total = simd::ran - since.ran, in = 0;
+
+        for(uint32_t j=0; j < h; j++)
+            for(uint32_t i=0; i < w; i++)
+            {
+                float v = px[(j * stride) + i];
+                if(v > 1.0f)
+                {
+                    in++;
+                    continue;
+                }
+
+                uint32_t n = uint32_t(lrintf(v * limit));
+                hist[31 - __builtin_clz(n | 1)]++;
+            }
+
+        if(id < threads)
+            busy[id].fetch_add(to_ns(took), std::memory_order_relaxed);
+
+        escaped.fetch_add((uint64_t(w) * h) - in, std::memory_order_relaxed);
+        inside.fetch_add(in, std::memory_order_relaxed);
+        iterations.fetch_add(total, std::memory_order_relaxed);
+        for(uint32_t b=0; b < STATS_BUCKETS; b++)
+            if(hist[b] > 0)
+                histogram[b].fetch_add(hist[b], std::memory_order_relaxed);
+
+        std::lock_guard<std::mutex> hold(lock);
+        tiles.push_back(tile_stat_t{frames.load(), x, y, w, h, total, took});
+    }
+
+
+    void Report::wrote(const std::string& what, uint64_t bytes)
+    {
+        std::lock_guard<std::mutex> hold(lock);
+        for(auto& f : files)
+            if(f.first == what)
+            {
+                f.second += bytes;
+                return;
+            }
+        files.push_back(std::make_pair(what, bytes));
+    }
+
+
+    /*
+     * Aligned columns for reading at a terminal
+     */
+    void Report::print_table()
+    {
+        double total_wall = wall() - start_wall;
+        double total_cpu  = clock_seconds(CLOCK_PROCESS_CPUTIME_ID) - start_cpu;
+        uint64_t pixels   = escaped + inside;
+
+        std::cout << std::fixed << std::setprecision(3);
+        std::cout << "Phase              wall (s)   CPU (s)" << std::endl;
+        for(uint32_t p=0; p < PHASE_COUNT; p++)
+            std::cout << std::left << std::setw(15) << phase_names[p] << std::right
+                      << std::setw(12) << wall_ns[p] * 1e-9
+                      << std::setw(10) << cpu_ns[p] * 1e-9 << std::endl;
+        std::cout << std::left << std::setw(15) << "total" << std::right
+                  << std::setw(12) << total_wall << std::setw(10) << total_cpu << std::endl;
+
+        std::cout << std::endl;
+        for(uint32_t t=0; t < threads; t++)
+            std::cout << "Thread " << std::left << std::setw(8) << t << std::right
+                      << std::setw(12) << busy[t] * 1e-9 << " busy ("
+                      << std::setprecision(1) << (100.0 * busy[t] * 1e-9) / std::max(total_wall, 1e-9)
+                      << "%)" << std::setprecision(3) << std::endl;
+
+        std::cout << std::endl;
+        std::cout << "Frames:            " << frames << std::endl;
+        std::cout << "Pixels:            " << pixels << ", " << escaped << " escaped, "
+                  << inside << " inside" << std::endl;
+        std::cout << "Iterations:        " << iterations;
+        if(pixels > 0)
+            std::cout << ", " << std::setprecision(1) << double(iterations) / pixels
+                      << " per pixel" << std::setprecision(3);
+        std::cout << std::endl;
+
+        if(!tiles.empty())
+        {
+            auto slowest = std::max_element(tiles.begin(), tiles.end(),
+                [](const tile_stat_t& a, const tile_stat_t& b) { return a.seconds < b.seconds; });
+            auto fewest  = std::min_element(tiles.begin(), tiles.end(),
+                [](const tile_stat_t& a, const tile_stat_t& b) { return a.iterations < b.iterations; });
+            auto most    = std::max_element(tiles.begin(), tiles.end(),
+                [](const tile_stat_t& a, const tile_stat_t& b) { return a.iterations < b.iterations; });
+
+            std::cout << "Tiles:             " << tiles.size() << ", " << fewest->iterations
+                      << " to " << most->iterations << " iterations" << std::endl;
+            std::cout << "Slowest tile:      " << slowest->x << "," << slowest->y
+                      << " (" << slowest->w << "x" << slowest->h << ") in "
+                      << slowest->seconds << " s" << std::endl;
+        }
+
+        for(const auto& f : files)
+            std::cout << "Bytes written:     " << f.second << " (" << f.first << ")" << std::endl;
+
+        uint32_t top = STATS_BUCKETS;
+        while(top > 0 && histogram[top - 1] == 0)
+            top--;
+        if(top > 0)
+            std::cout << std::endl << "Escape counts      pixels" << std::endl;
+        for(uint32_t b=0; b < top; b++)
+            std::cout << std::left << std::setw(19)
+                      << ((b == 0) ? std::string("0-1") : std::to_string(1u << b) + "-" + std::to_string((2u << b) - 1))
+                      << std::right << histogram[b] << std::endl;
+        if(top > 0)
+            std::cout << std::left << std::setw(19) << "inside" << std::right << inside << std::endl;
+
+        if(perf::enabled())
+            print_counters();
+        std::cout << std::defaultfloat;
+    }
+
+
+    static bool has(uint32_t event)
+    {
+        return (perf::available() & (1u << event)) != 0;
+    }
+
+
+    static bool has_ipc()
+    {
+        return has(PERF_CYCLES) && has(PERF_INSTRUCTIONS);
+    }
+
+
+    /*
+     * Every event of every phase, with the IPC, and the compute
+     * phase's events per pixel; events this machine doesn't
+     * count are dashes
+     */
+    void Report::print_counters()
+    {
+        uint64_t pixels = escaped + inside;
+
+        std::cout << std::endl << std::left << std::setw(15) << "Counters" << std::right;
+        for(uint32_t e=0; e < PERF_EVENTS; e++)
+            std::cout << std::setw(15) << perf::all[e].name;
+        std::cout << std::setw(7) << "IPC" << std::endl;
+
+        for(uint32_t p=0; p <= PHASE_COUNT; p++)
+        {
+            // the last row is the compute phase per pixel
+            bool per_pixel = (p == PHASE_COUNT);
+            const std::atomic<uint64_t>* c = counted[per_pixel ? PHASE_COMPUTE : p];
+            if(per_pixel && pixels == 0)
+                break;
+
+            std::cout << std::left << std::setw(15) << (per_pixel ? "per pixel" : phase_names[p]) << std::right;
+            for(uint32_t e=0; e < PERF_EVENTS; e++)
+            {
+                std::cout << std::setw(15);
+                if(!has(e))
+                    std::cout << "-";
+                else if(per_pixel)
+                    std::cout << std::setprecision(2) << double(c[e]) / pixels << std::setprecision(3);
+                else
+                    std::cout << c[e];
+            }
+
+            std::cout << std::setw(7);
+            if(has_ipc() && c[PERF_CYCLES] > 0)
+                std::cout << std::setprecision(2) << double(c[PERF_INSTRUCTIONS]) / c[PERF_CYCLES] << std::setprecision(3);
+            else
+                std::cout << "-";
+            std::cout << std::endl;
+        }
+    }
+
+
+    /*
+     * One object, with every tile for scripts to dig into
+     */
+    void Report::print_json()
+    {
+        double total_wall = wall() - start_wall;
+        double total_cpu  = clock_seconds(CLOCK_PROCESS_CPUTIME_ID) - start_cpu;
+
+        std::cout << std::setprecision(9);
+        std::cout << "{" << std::endl
+                  << "  \"frames\": " << frames << "," << std::endl
+                  << "  \"threads\": " << threads << "," << std::endl
+                  << "  \"wall_s\": " << total_wall << "," << std::endl
+                  << "  \"cpu_s\": " << total_cpu << "," << std::endl;
+
+        std::cout << "  \"phases\": {";
+        for(uint32_t p=0; p < PHASE_COUNT; p++)
+            std::cout << (p ? ", " : "") << "\"" << phase_names[p] << "\": {\"wall_s\": "
+                      << wall_ns[p] * 1e-9 << ", \"cpu_s\": " << cpu_ns[p] * 1e-9 << "}";
+        std::cout << "}," << std::endl;
+
+        // hardware events of each phase, only the ones counted
+        if(perf::enabled())
+        {
+            std::cout << "  \"counters\": {";
+            for(uint32_t p=0; p < PHASE_COUNT; p++)
+            {
+                std::cout << (p ? ", " : "") << "\"" << phase_names[p] << "\": {";
+                const char* sep = "";
+                for(uint32_t e=0; e < PERF_EVENTS; e++)
+                    if(has(e))
+                    {
+                        std::cout << sep << "\"" << perf::all[e].name << "\": " << counted[p][e];
+                        sep = ", ";
+                    }
+                if(has_ipc() && counted[p][PERF_CYCLES] > 0)
+                    std::cout << sep << "\"ipc\": " << double(counted[p][PERF_INSTRUCTIONS]) / counted[p][PERF_CYCLES];
+                std::cout << "}";
+            }
+            std::cout << "}," << std::endl;
+
+            uint64_t pixels = escaped + inside;
+            std::cout << "  \"per_pixel\": {";
+            const char* sep = "";
+            for(uint32_t e=0; e < PERF_EVENTS && pixels > 0; e++)
+                if(has(e))
+                {
+                    std::cout << sep << "\"" << perf::all[e].name << "\": " << double(counted[PHASE_COMPUTE][e]) / pixels;
+                    sep = ", ";
+                }
+            std::cout << "}," << std::endl;
+        }
+
+        std::cout << "  \"busy_s\": [";
+        for(uint32_t t=0; t < threads; t++)
+            std::cout << (t ? ", " : "") << busy[t] * 1e-9;
+        std::cout << "]," << std::endl;
+
+        std::cout << "  \"pixels\": {\"escaped\": " << escaped << ", \"inside\": " << inside << "}," << std::endl
+                  << "  \"iterations\": " << iterations << "," << std::endl;
+
+        // bucket b counts escapes in [from, to]
+        std::cout << "  \"histogram\": [";
+        for(uint32_t b=0; b < STATS_BUCKETS; b++)
+            std::cout << (b ? ", " : "") << "{\"from\": " << ((b == 0) ? 0 : (1u << b))
+                      << ", \"to\": " << (2u << b) - 1 << ", \"pixels\": " << histogram[b] << "}";
+        std::cout << "]," << std::endl;
+
+        std::cout << "  \"bytes\": {";
+        for(size_t k=0; k < files.size(); k++)
+            std::cout << (k ? ", " : "") << "\"" << files[k].first << "\": " << files[k].second;
+        std::cout << "}," << std::endl;
+
+        std::cout << "  \"tiles\": [";
+        for(size_t k=0; k < tiles.size(); k++)
+        {
+            const tile_stat_t& t = tiles[k];
+            std::cout << (k ? "," : "") << std::endl << "    {\"frame\": " << t.frame
+                      << ", \"x\": " << t.x << ", \"y\": " << t.y << ", \"w\": " << t.w
+                      << ", \"h\": " << t.h << ", \"iterations\": " << t.iterations
+                      << ", \"seconds\": " << t.seconds << "}";
+        }
+        std::cout << std::endl << "  ]" << std::endl << "}" << std::endl;
+    }
+
+
+    Timer::Timer(Report* r, uint32_t p) : report(r), phase(p)
+    {
+        if(report != NULL)
+            since = now();
+    }
+
+
+    Timer::~Timer()
+    {
+        if(report != NULL)
+            report->add(phase, since);
+    }
+}
+
+// end
@@ -0,0 +1,191 @@
+/*
+ * strategy.cpp
+ *
+ * Tile filling strategies. Both strategies compute each pixel's
+ * plane coordinate the same way, so any pixel they both iterate
+ * gets exactly the same count.
+ */
+
+#include <iostream>
+#include <string.h>
+#include "include/strategy.h"
+
+// rectangles this thin are iterated directly instead of split
+#define MARIANI_MIN  6
+
+// how many points are batched up before calling the kernel
+#define BATCH_SIZE   (4 * TILE_SIZE)
+
+namespace strategy
+{
+    const uint32_t STRATEGY_COUNT = 2;
+
+    const StrategyInfo all[] =
+    {
+        {"scan",    &scan},
+        {"mariani", &mariani},
+    };
+
+
+    /*
+     * Iterate every pixel of the tile, one row per batch
+     */
+    void scan(const opts::Settings& s, const render::tile_t& t,
+              const render::BatchFunc& batch, double* counts)
+    {
+        double cr[TILE_SIZE], ci[TILE_SIZE];
+
+        for(uint32_t x=0; x < t.w; x++)
+            cr[x] = s.topleft_x + (t.x + x) * s.inc_re;
+
+        for(uint32_t y=0; y < t.h; y++)
+        {
+            double im = s.topleft_y + (t.y + y) * s.inc_im;
+            for(uint32_t x=0; x < t.w; x++)
+                ci[x] = im;
+
+            batch(cr, ci, t.w, counts + (y * t.w));
+        }
+    }
+
+
+    /*
+     * Working state for subdividing one tile. Pixels are queued
+     * up and handed to the kernel in batches; `done` marks every
+     * pixel that already holds a count.
+     */
+    class Mariani
+    {
+    private:
+        const opts::Settings&    s;
+        const render::tile_t&    t;
+        const render::BatchFunc& batch;
+        double*                  counts;
+
+        uint8_t  done[TILE_SIZE * TILE_SIZE];
+        double   cr[BATCH_SIZE], ci[BATCH_SIZE], out[BATCH_SIZE];
+        uint32_t where[BATCH_SIZE];
+        uint32_t queued;
+
+    public:
+        Mariani(const opts::Settings& st, const render::tile_t& tl,
+                const render::BatchFunc& b, double* c)
+            : s(st), t(tl), batch(b), counts(c), queued(0)
+        {
+            memset(done, 0, sizeof(done));
+        }
+
+        void flush()
+        {
+            if(queued == 0)
+                return;
+            batch(cr, ci, queued, out);
+            for(uint32_t k=0; k < queued; k++)
+                counts[where[k]] = out[k];
+            queued = 0;
+        }
+
+        void queue(uint32_t x, uint32_t y)
+        {
+            uint32_t i = (y * t.w) + x;
+            if(done[i])
+                return;
+            done[i]       = 1;
+            cr[queued]    = s.topleft_x + (t.x + x) * s.inc_re;
+            ci[queued]    = s.topleft_y + (t.y + y) * s.inc_im;
+            where[queued] = i;
+            if(++queued == BATCH_SIZE)
+                flush();
+        }
+
+        /*
+         * Fill the inclusive rectangle (x0,y0)-(x1,y1): compute its
+         * border, flood the interior if the border is uniform,
+         * otherwise split it in two along the longer side
+         */
+        void rect(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1)
+        {
+            for(uint32_t x=x0; x <= x1; x++)
+            {
+                queue(x, y0);
+                queue(x, y1);
+            }
+            for(uint32_t y=y0+1; y < y1; y++)
+            {
+                queue(x0, y);
+                queue(x1, y);
+            }
+            flush();
+
+            if(x1 - x0 < 2 || y1 - y0 < 2)
+                return;
+
+            double v       = counts[(y0 * t.w) + x0];
+            bool   uniform = true;
+            for(uint32_t x=x0; x <= x1 && uniform; x++)
+                uniform = counts[(y0 * t.w) + x] == v && counts[(y1 * t.w) + x] == v;
+            for(uint32_t y=y0+1; y < y1 && uniform; y++)
+                uniform = counts[(y * t.w) + x0] == v && counts[(y * t.w) + x1] == v;
+
+            if(uniform)
+            {
+                for(uint32_t y=y0+1; y < y1; y++)
+                    for(uint32_t x=x0+1; x < x1; x++)
+                    {
+                        counts[(y * t.w) + x] = v;
+                        done[(y * t.w) + x]   = 1;
+                    }
+                return;
+            }
+
+            if(x1 - x0 < MARIANI_MIN || y1 - y0 < MARIANI_MIN)
+            {
+                for(uint32_t y=y0+1; y < y1; y++)
+                    for(uint32_t x=x0+1; x < x1; x++)
+                        queue(x, y);
+                flush();
+                return;
+            }
+
+            if(x1 - x0 >= y1 - y0)
+            {
+                uint32_t mid = (x0 + x1) / 2;
+                rect(x0, y0, mid, y1);
+                rect(mid, y0, x1, y1);
+            }
+            else
+            {
+                uint32_t mid = (y0 + y1) / 2;
+                rect(x0, y0, x1, mid);
+                rect(x0, mid, x1, y1);
+            }
+        }
+    };
+
+
+    /*
+     * Mariani-Silver subdivision over a whole tile
+     */
+    void mariani(const opts::Settings& s, const render::tile_t& t,
+                 const render::BatchFunc& batch, double* counts)
+    {
+        Mariani m(s, t, batch, counts);
+        m.rect(0, 0, t.w - 1, t.h - 1);
+    }
+
+
+    /*
+     * Prints out all available rendering strategies
+     */
+    void print_all()
+    {
+        std::cout << "Available rendering strategies:" << std::endl;
+
+        for(uint32_t j=0; j < STRATEGY_COUNT; j++)
+            std::cout << "  * " << all[j].name << std::endl;
+
+        std::cout << std::endl;
+    }
+}
+
+// end
@@ -0,0 +1,209 @@
+/*
+ * supersample.cpp
+ *
+ * Edge detection needs the neighbors of the tile's border pixels,
+ * so a one pixel ring around the tile is iterated as well. Extra
+ * samples follow the R2 low-discrepancy sequence, shifted by a hash
+ * of the pixel's position: any sample count covers the filter's
+ * footprint evenly, neighboring pixels don't share a pattern, and
+ * the same pixel always gets the same samples.
+ */
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+
+#include "include/supersample.h"
+
+// points handed to the kernel at once
+#define AA_BATCH  (4 * TILE_SIZE)
+
+// the R2 sequence steps, 1/g and 1/g^2 for the plastic number g
+#define R2_A1  0.7548776662466927
+#define R2_A2  0.5698402909980532
+
+namespace aa
+{
+    const uint32_t FILTER_COUNT = 2;
+
+    const FilterInfo all[] =
+    {
+        {"box",      0.5, &box},
+        {"gaussian", 1.0, &gaussian},
+    };
+
+
+    /*
+     * Every sample inside the pixel counts the same
+     */
+    double box(double dx, double dy)
+    {
+        return (std::fabs(dx) <= 0.5 && std::fabs(dy) <= 0.5) ? 1.0 : 0.0;
+    }
+
+
+    /*
+     * A Gaussian of half a pixel's deviation, reaching into
+     * the neighbors for a softer edge
+     */
+    double gaussian(double dx, double dy)
+    {
+        return std::exp(-2.0 * ((dx * dx) + (dy * dy)));
+    }
+
+
+    void print_all()
+    {
+        std::cout << "Filters available: " << std::endl;
+        for(uint32_t f=0; f < FILTER_COUNT; f++)
+            std::cout << " -- " << all[f].name << std::endl;
+    }
+
+
+    Tally::Tally(bool v) : pixels(0), edges(0), verbose(v)
+    {
+    }
+
+
+    Tally::~Tally()
+    {
+        if(verbose && pixels > 0)
+            std::cout << "Supersampled:      " << edges << " of " << pixels << " pixels ("
+                      << (100.0 * edges) / pixels << "%)" << std::endl;
+    }
+
+
+    /*
+     * A fixed pseudo-random value in [0, 1) for a pixel
+     */
+    static double hash01(uint64_t v)
+    {
+        v ^= v >> 33;
+        v *= 0xff51afd7ed558ccdULL;
+        v ^= v >> 33;
+        v *= 0xc4ceb9fe1a85ec53ULL;
+        v ^= v >> 33;
+        return double(v >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+
+    void refine(const opts::Settings& s, const render::tile_t& t, const render::BatchFunc& batch,
+                const double* counts, const colors::Palette& palette, uint8_t* overlay, size_t stride,
+                Tally& tally)
+    {
+        uint32_t ew = t.w + 2, eh = t.h + 2;
+        const FilterInfo& f = all[s.filter];
+
+        // the tile's counts with a ring of neighbors around them
+        std::vector<float> ext(size_t(ew) * eh);
+        for(uint32_t y=0; y < t.h; y++)
+            for(uint32_t x=0; x < t.w; x++)
+                ext[(size_t(y + 1) * ew) + x + 1] = float(counts[(y * t.w) + x] / s.max_iters);
+
+        std::vector<double>   cr, ci, got;
+        std::vector<uint32_t> where;
+        for(uint32_t y=0; y < eh; y++)
+            for(uint32_t x=0; x < ew; x++)
+            {
+                if(y != 0 && y != eh - 1 && x != 0 && x != ew - 1)
+                    continue;
+                cr.push_back(s.topleft_x + (double(t.x + x) - 1.0) * s.inc_re);
+                ci.push_back(s.topleft_y + (double(t.y + y) - 1.0) * s.inc_im);
+                where.push_back((y * ew) + x);
+            }
+        got.resize(cr.size());
+        batch(cr.data(), ci.data(), cr.size(), got.data());
+        for(size_t k=0; k < where.size(); k++)
+            ext[where[k]] = float(got[k] / s.max_iters);
+
+        // pixels whose color differs enough from a neighbor's
+        std::vector<const uint8_t*> col(ext.size());
+        for(size_t k=0; k < ext.size(); k++)
+            col[k] = palette.color(ext[k]);
+
+        std::vector<uint32_t> edges;
+        for(uint32_t y=1; y <= t.h; y++)
+            for(uint32_t x=1; x <= t.w; x++)
+            {
+                const uint8_t* c = col[(y * ew) + x];
+                bool edge = false;
+                for(int dy=-1; dy <= 1 && !edge; dy++)
+                    for(int dx=-1; dx <= 1 && !edge; dx++)
+                    {
+                        const uint8_t* n = col[((y + dy) * ew) + x + dx];
+                        if(n == c)
+                            continue;
+                        int diff = std::abs(c[0] - n[0]) + std::abs(c[1] - n[1]) + std::abs(c[2] - n[2]);
+                        edge = diff > AA_CONTRAST;
+                    }
+                if(edge)
+                    edges.push_back(((y - 1) * t.w) + x - 1);
+            }
+
+        tally.pixels += t.w * t.h;
+        tally.edges  += edges.size();
+        if(edges.empty())
+            return;
+
+        // every edge pixel's samples, iterated a batch at a time
+        uint32_t n = s.supersample;
+        std::vector<double> dxs(edges.size() * n), dys(edges.size() * n);
+        cr.resize(edges.size() * n);
+        ci.resize(edges.size() * n);
+        got.resize(edges.size() * n);
+
+        for(size_t e=0; e < edges.size(); e++)
+        {
+            uint32_t px = t.x + (edges[e] % t.w);
+            uint32_t py = t.y + (edges[e] / t.w);
+            double   u0 = hash01((uint64_t(py) << 32) | px);
+            double   v0 = hash01((uint64_t(px) << 32) | py | (1ULL << 63));
+
+            for(uint32_t k=0; k < n; k++)
+            {
+                double u  = std::fmod(u0 + (k + 1) * R2_A1, 1.0);
+                double v  = std::fmod(v0 + (k + 1) * R2_A2, 1.0);
+                size_t i  = (e * n) + k;
+                dxs[i] = ((2.0 * u) - 1.0) * f.radius;
+                dys[i] = ((2.0 * v) - 1.0) * f.radius;
+                cr[i]  = s.topleft_x + (px + dxs[i]) * s.inc_re;
+                ci[i]  = s.topleft_y + (py + dys[i]) * s.inc_im;
+            }
+        }
+
+        for(size_t k=0; k < cr.size(); k += AA_BATCH)
+        {
+            uint32_t m = std::min<size_t>(AA_BATCH, cr.size() - k);
+            batch(&cr[k], &ci[k], m, &got[k]);
+        }
+
+        // the filtered color of the pixel's own sample and its new ones
+        for(size_t e=0; e < edges.size(); e++)
+        {
+            uint32_t x = edges[e] % t.w, y = edges[e] / t.w;
+
+            double         w0 = f.weight(0.0, 0.0);
+            const uint8_t* c  = palette.color(float(counts[edges[e]] / s.max_iters));
+            double r = w0 * c[0], g = w0 * c[1], b = w0 * c[2], sum = w0;
+
+            for(uint32_t k=0; k < n; k++)
+            {
+                size_t i = (e * n) + k;
+                double w = f.weight(dxs[i], dys[i]);
+                c = palette.color(float(got[i] / s.max_iters));
+                r   += w * c[0];
+                g   += w * c[1];
+                b   += w * c[2];
+                sum += w;
+            }
+
+            uint8_t* o = overlay + (y * stride * 4) + (x * 4);
+            o[0] = colors::flatten((r / sum) + 0.5);
+            o[1] = colors::flatten((g / sum) + 0.5);
+            o[2] = colors::flatten((b / sum) + 0.5);
+            o[3] = 1;
+        }
+    }
+}
+
+// end
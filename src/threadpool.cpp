@@ -0,0 +1,186 @@
+/*
+ * threadpool.cpp
+ *
+ * Work-stealing thread pool implementation.
+ * Work items are handed out in contiguous chunks so that
+ * neighbouring tiles tend to stay on the same worker, and
+ * idle workers steal from the back of a busy worker's deque.
+ */
+
+#include "include/threadpool.h"
+
+namespace pool
+{
+    Job::Job(const Task& t, uint32_t count) : task(t), remaining(count) {}
+
+
+    ThreadPool::ThreadPool(uint32_t n)
+    {
+        nthreads = (n == 0) ? default_threads() : n;
+        pending  = 0;
+        stopping = false;
+
+        queues.resize(nthreads);
+        for(uint32_t t=0; t < nthreads; t++)
+            qlocks.push_back(new std::mutex());
+
+        for(uint32_t t=0; t < nthreads; t++)
+            workers.push_back(std::thread(&ThreadPool::work, this, t));
+    }
+
+
+    /*
+     * Wake every worker, let them drain and join them
+     */
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> g(idle_lock);
+            stopping = true;
+        }
+        wake.notify_all();
+
+        for(uint32_t t=0; t < nthreads; t++)
+            workers[t].join();
+        for(uint32_t t=0; t < nthreads; t++)
+            delete qlocks[t];
+    }
+
+
+    uint32_t ThreadPool::size() const
+    {
+        return nthreads;
+    }
+
+
+    /*
+     * Pop from our own deque first, then try to steal
+     * from the back of every other worker in turn
+     */
+    bool ThreadPool::take(uint32_t id, item_t& out)
+    {
+        {
+            std::lock_guard<std::mutex> g(*qlocks[id]);
+            if(!queues[id].empty())
+            {
+                out = queues[id].front();
+                queues[id].pop_front();
+                return true;
+            }
+        }
+
+        for(uint32_t k=1; k < nthreads; k++)
+        {
+            uint32_t victim = (id + k) % nthreads;
+            std::lock_guard<std::mutex> g(*qlocks[victim]);
+            if(!queues[victim].empty())
+            {
+                out = queues[victim].back();
+                queues[victim].pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+
+    /*
+     * Worker main loop
+     */
+    void ThreadPool::work(uint32_t id)
+    {
+        item_t item;
+
+        for(;;)
+        {
+            {
+                std::unique_lock<std::mutex> g(idle_lock);
+                wake.wait(g, [this]{ return stopping || pending > 0; });
+                if(stopping && pending == 0)
+                    return;
+            }
+
+            if(!take(id, item))
+            {
+                std::this_thread::yield();
+                continue;
+            }
+
+            {
+                std::lock_guard<std::mutex> g(idle_lock);
+                pending--;
+            }
+
+            item.job->task(item.index, id);
+
+            if(--item.job->remaining == 0)
+            {
+                std::lock_guard<std::mutex> g(item.job->lock);
+                item.job->done.notify_all();
+            }
+            item.job.reset();
+        }
+    }
+
+
+    /*
+     * Queue up `count` work items for the given task and return
+     * immediately. Items are split into contiguous runs, one run
+     * per worker deque.
+     */
+    JobRef ThreadPool::submit(uint32_t count, const Task& task)
+    {
+        JobRef job = std::make_shared<Job>(task, count);
+        if(count == 0)
+            return job;
+
+        // count the items before they become visible so a worker
+        // can never take one that isn't accounted for yet
+        {
+            std::lock_guard<std::mutex> g(idle_lock);
+            pending += count;
+        }
+
+        for(uint32_t t=0; t < nthreads; t++)
+        {
+            uint32_t first = (uint64_t(count) *  t     ) / nthreads;
+            uint32_t last  = (uint64_t(count) * (t + 1)) / nthreads;
+            if(first == last)
+                continue;
+
+            std::lock_guard<std::mutex> g(*qlocks[t]);
+            for(uint32_t i=first; i < last; i++)
+                queues[t].push_back(item_t{job, i});
+        }
+        wake.notify_all();
+        return job;
+    }
+
+
+    /*
+     * Block until every item of the job has been executed
+     */
+    void ThreadPool::wait(const JobRef& job)
+    {
+        std::unique_lock<std::mutex> g(job->lock);
+        job->done.wait(g, [&job]{ return job->remaining == 0; });
+    }
+
+
+    void ThreadPool::run(uint32_t count, const Task& task)
+    {
+        wait(submit(count, task));
+    }
+
+
+    /*
+     * Number of hardware threads, never less than one
+     */
+    uint32_t default_threads()
+    {
+        uint32_t n = std::thread::hardware_concurrency();
+        return (n == 0) ? 1 : n;
+    }
+}
+
+// end